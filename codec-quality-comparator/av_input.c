@@ -0,0 +1,294 @@
+#include "av_input.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/pixdesc.h>
+
+#define DECODE_AHEAD 8                  // Decoded frames queued ahead of the reader
+
+struct av_decoder {
+  AVFormatContext* format_context;
+  AVCodecContext* codec_context;
+  int stream_index;
+  enum AVPixelFormat pixel_format;      // The stream's, which every frame must keep
+
+  // Ring of decoded frames, filled by the decoding thread and emptied by the reader.
+  AVFrame* frames[DECODE_AHEAD];
+  int head;                             // Oldest queued frame
+  int queued;
+  int finished;                         // The decoding thread has queued its last frame
+  int status;                           // What to return once the queue is empty
+  int stop;                             // Set by av_input_close()
+  pthread_mutex_t lock;
+  pthread_cond_t frame_ready;
+  pthread_cond_t space_ready;
+  pthread_t thread;
+  int thread_started;
+};
+
+// The Y4M colour space tag for a decoder pixel format we can use as it is, or NULL.
+// The full-range (J) variants have the same layout.
+static const char* chroma_tag(enum AVPixelFormat pixel_format) {
+  switch (pixel_format) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+      return "420jpeg";
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUVJ422P:
+      return "422";
+    case AV_PIX_FMT_YUV444P:
+    case AV_PIX_FMT_YUVJ444P:
+      return "444";
+    default:
+      return NULL;
+  }
+}
+
+// Queues a decoded frame, waiting for room. Returns 0 if the input is being closed.
+static int queue_frame(struct av_decoder* decoder, AVFrame* frame) {
+  int slot;
+
+  pthread_mutex_lock(&decoder->lock);
+  while (decoder->queued == DECODE_AHEAD && !decoder->stop) {
+    pthread_cond_wait(&decoder->space_ready, &decoder->lock);
+  }
+  if (decoder->stop) {
+    pthread_mutex_unlock(&decoder->lock);
+    av_frame_unref(frame);
+    return 0;
+  }
+  // The reader only touches the head frame, and the free slot after the queue stays put
+  // as it moves the head on, so the frame is moved in without holding the lock.
+  slot = (decoder->head + decoder->queued) % DECODE_AHEAD;
+  pthread_mutex_unlock(&decoder->lock);
+  av_frame_move_ref(decoder->frames[slot], frame);
+
+  pthread_mutex_lock(&decoder->lock);
+  decoder->queued++;
+  pthread_cond_signal(&decoder->frame_ready);
+  pthread_mutex_unlock(&decoder->lock);
+  return 1;
+}
+
+// Demuxes and decodes the video stream into the queue until it ends, the decoder fails
+// or the input is closed.
+static void* decode_thread(void* arg) {
+  struct av_decoder* decoder = (struct av_decoder*)arg;
+  AVPacket* packet = av_packet_alloc();
+  AVFrame* frame = av_frame_alloc();
+  int status = Y4M_END;
+  int draining = 0;
+  int running = 1;
+  int error = 0;
+
+  if (packet == NULL || frame == NULL) {
+    status = Y4M_DECODE_ERROR;
+    running = 0;
+  }
+
+  while (running) {
+    if (!draining) {
+      error = av_read_frame(decoder->format_context, packet);
+      if (error < 0) {
+        // End of file, or a read error we treat as one: flush out the frames still in the decoder.
+        draining = 1;
+        error = avcodec_send_packet(decoder->codec_context, NULL);
+      } else if (packet->stream_index != decoder->stream_index) {
+        av_packet_unref(packet);
+        continue;
+      } else {
+        error = avcodec_send_packet(decoder->codec_context, packet);
+        av_packet_unref(packet);
+      }
+    }
+
+    // Every frame a packet produced is taken before the next is sent, so sending never has
+    // to wait. Frames aren't dropped on errors as ffmpeg would: a missing frame would pair
+    // every later one with the wrong frame of the other stream.
+    while (error == 0 && (error = avcodec_receive_frame(decoder->codec_context, frame)) == 0) {
+      if (!queue_frame(decoder, frame)) {
+        running = 0;
+        break;
+      }
+    }
+    if (!running) {
+      break;
+    } else if (error == AVERROR_EOF || (draining && error == AVERROR(EAGAIN))) {
+      running = 0;
+    } else if (error != AVERROR(EAGAIN)) {
+      status = Y4M_DECODE_ERROR;
+      running = 0;
+    }
+    error = 0;
+  }
+
+  av_frame_free(&frame);
+  av_packet_free(&packet);
+
+  pthread_mutex_lock(&decoder->lock);
+  decoder->finished = 1;
+  decoder->status = status;
+  pthread_cond_signal(&decoder->frame_ready);
+  pthread_mutex_unlock(&decoder->lock);
+  return NULL;
+}
+
+const char* av_input_open(struct y4m_input* input, const char* path) {
+  struct av_decoder* decoder;
+  AVStream* stream;
+  AVRational frame_rate;
+  const AVCodec* codec;
+  const char* chroma;
+  const char* problem;
+  char header[128];
+  unsigned int i;
+
+  memset(input, 0, sizeof(*input));
+  decoder = calloc(1, sizeof(struct av_decoder));
+  if (decoder == NULL) return "out of memory";
+  pthread_mutex_init(&decoder->lock, NULL);
+  pthread_cond_init(&decoder->frame_ready, NULL);
+  pthread_cond_init(&decoder->space_ready, NULL);
+  input->decoder = decoder;
+
+  if (avformat_open_input(&decoder->format_context, path, NULL, NULL) < 0) return "can't open or recognise the file";
+  if (avformat_find_stream_info(decoder->format_context, NULL) < 0) return "can't find the stream parameters";
+  decoder->stream_index = av_find_best_stream(decoder->format_context, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+  if (decoder->stream_index < 0) return "no video stream";
+
+  // Don't demux anything we won't decode.
+  for (i = 0; i < decoder->format_context->nb_streams; i++) {
+    if ((int)i != decoder->stream_index) decoder->format_context->streams[i]->discard = AVDISCARD_ALL;
+  }
+  stream = decoder->format_context->streams[decoder->stream_index];
+
+  decoder->pixel_format = (enum AVPixelFormat)stream->codecpar->format;
+  chroma = chroma_tag(decoder->pixel_format);
+  if (chroma == NULL) return "pixel format isn't 8-bit planar 4:2:0, 4:2:2 or 4:4:4";
+
+  codec = avcodec_find_decoder(stream->codecpar->codec_id);
+  if (codec == NULL) return "no decoder for the video codec";
+  decoder->codec_context = avcodec_alloc_context3(codec);
+  if (decoder->codec_context == NULL) return "out of memory";
+  if (avcodec_parameters_to_context(decoder->codec_context, stream->codecpar) < 0) return "can't set up the decoder";
+  // Frame threading: as many threads as the library thinks the CPUs can use.
+  decoder->codec_context->thread_count = 0;
+  decoder->codec_context->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  if (avcodec_open2(decoder->codec_context, codec, NULL) < 0) return "can't open the decoder";
+
+  // Describe the frames as a Y4M header would, so the layout is worked out in one place.
+  frame_rate = av_guess_frame_rate(decoder->format_context, stream, NULL);
+  if (frame_rate.num > 0 && frame_rate.den > 0) {
+    snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:%d C%s\n", stream->codecpar->width, stream->codecpar->height,
+             frame_rate.num, frame_rate.den, chroma);
+  } else {
+    snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d C%s\n", stream->codecpar->width, stream->codecpar->height, chroma);
+  }
+  problem = y4m_parse_header(header, &input->format);
+  if (problem != NULL) return problem;
+
+  for (i = 0; i < DECODE_AHEAD; i++) {
+    decoder->frames[i] = av_frame_alloc();
+    if (decoder->frames[i] == NULL) return "out of memory";
+  }
+  if (pthread_create(&decoder->thread, NULL, decode_thread, decoder) != 0) return "can't start the decoding thread";
+  decoder->thread_started = 1;
+  return NULL;
+}
+
+// Waits for the next decoded frame. Returns it, or NULL at the end, with the status to
+// return in '*status'.
+static AVFrame* next_decoded_frame(struct av_decoder* decoder, int* status) {
+  AVFrame* frame = NULL;
+
+  pthread_mutex_lock(&decoder->lock);
+  while (decoder->queued == 0 && !decoder->finished) {
+    pthread_cond_wait(&decoder->frame_ready, &decoder->lock);
+  }
+  if (decoder->queued > 0) {
+    frame = decoder->frames[decoder->head];
+  } else {
+    *status = decoder->status;
+  }
+  pthread_mutex_unlock(&decoder->lock);
+  return frame;
+}
+
+// Releases the head frame and makes room for another.
+static void release_decoded_frame(struct av_decoder* decoder) {
+  av_frame_unref(decoder->frames[decoder->head]);
+
+  pthread_mutex_lock(&decoder->lock);
+  decoder->head = (decoder->head + 1) % DECODE_AHEAD;
+  decoder->queued--;
+  pthread_cond_signal(&decoder->space_ready);
+  pthread_mutex_unlock(&decoder->lock);
+}
+
+int av_input_read_frame(struct y4m_input* input, unsigned char* buffer) {
+  struct av_decoder* decoder = input->decoder;
+  const struct y4m_format* format = &input->format;
+  AVFrame* frame;
+  unsigned int plane, row;
+  int status = Y4M_END;
+
+  frame = next_decoded_frame(decoder, &status);
+  if (frame == NULL) return status;
+
+  if (frame->width != (int)format->width || frame->height != (int)format->height || frame->format != decoder->pixel_format) {
+    fprintf(stderr, "Decoded frame changed to %dx%d %s; expected %ux%u %s\n", frame->width, frame->height,
+            av_get_pix_fmt_name((enum AVPixelFormat)frame->format), format->width, format->height,
+            av_get_pix_fmt_name(decoder->pixel_format));
+    release_decoded_frame(decoder);
+    return Y4M_DECODE_ERROR;
+  }
+
+  // Decoded planes have padded rows; the Y4M layout has none.
+  for (plane = 0; plane < 3; plane++) {
+    for (row = 0; row < format->plane_height[plane]; row++) {
+      memcpy(buffer + format->plane_offset[plane] + row * format->plane_width[plane],
+             frame->data[plane] + row * frame->linesize[plane], format->plane_width[plane]);
+    }
+  }
+  release_decoded_frame(decoder);
+  return Y4M_FRAME;
+}
+
+unsigned long av_input_skip_frames(struct y4m_input* input, unsigned long count) {
+  unsigned long skipped;
+  int status = Y4M_END;
+
+  // Frames depend on the ones before them, so skipping still decodes; it only saves the copy.
+  for (skipped = 0; skipped < count; skipped++) {
+    if (next_decoded_frame(input->decoder, &status) == NULL) break;
+    release_decoded_frame(input->decoder);
+  }
+  return skipped;
+}
+
+void av_input_close(struct y4m_input* input) {
+  struct av_decoder* decoder = input->decoder;
+  int i;
+
+  if (decoder->thread_started) {
+    pthread_mutex_lock(&decoder->lock);
+    decoder->stop = 1;
+    pthread_cond_signal(&decoder->space_ready);
+    pthread_mutex_unlock(&decoder->lock);
+    pthread_join(decoder->thread, NULL);
+  }
+
+  for (i = 0; i < DECODE_AHEAD; i++) {
+    av_frame_free(&decoder->frames[i]);
+  }
+  avcodec_free_context(&decoder->codec_context);
+  avformat_close_input(&decoder->format_context);
+  pthread_cond_destroy(&decoder->space_ready);
+  pthread_cond_destroy(&decoder->frame_ready);
+  pthread_mutex_destroy(&decoder->lock);
+  free(decoder);
+  input->decoder = NULL;
+}
@@ -0,0 +1,30 @@
+#ifndef AV_INPUT_H
+#define AV_INPUT_H
+
+#include "y4m.h"
+
+// In-process decoding with the FFmpeg libraries (libavformat/libavcodec), built only
+// with 'make WITH_LIBAV=1'. A decoded input is a y4m_input like any other: the y4m_*
+// functions pass it on to these, so the comparators read it the same way.
+//
+// Each input's first video stream is decoded on a thread of its own, with the codec's
+// frame threading, a few frames ahead of the reader. Frames keep the pixel format they
+// were coded in (8-bit planar 4:2:0, 4:2:2 or 4:4:4) and are copied straight into the
+// caller's buffer in the Y4M layout, with no conversion and no pipe in between.
+
+// Opens 'path' (any container and codec the libraries read), fills in input->format as
+// y4m_read_header() would and starts decoding. Returns NULL on success, or a description
+// of the problem; either way y4m_close() releases the input.
+const char* av_input_open(struct y4m_input* input, const char* path);
+
+// Copies the next decoded frame into 'buffer' (format.frame_size bytes). Returns
+// Y4M_FRAME, Y4M_END, or Y4M_DECODE_ERROR.
+int av_input_read_frame(struct y4m_input* input, unsigned char* buffer);
+
+// Drops up to 'count' decoded frames. Returns the number dropped.
+unsigned long av_input_skip_frames(struct y4m_input* input, unsigned long count);
+
+// Stops the decoding thread and frees the decoder.
+void av_input_close(struct y4m_input* input);
+
+#endif
@@ -1,4 +1,11 @@
 #include "iqa.h"
+#include "cpus.h"
+#include "y4m.h"
+#include "results.h"
+#include "stats.h"
+#ifdef HAVE_LIBAV
+#include "av_input.h"
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
@@ -6,9 +13,22 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <getopt.h>
+#include <math.h>
 
 #define DO_MS_SSIM 0
-#define THREAD_COUNT 8
+#define PLANE_COUNT 3
+#define CONFIDENCE_Z 1.96            // Normal quantile for the 95% confidence intervals of sampled runs
+
+#define GATE_FAIL_EXIT 3             // Exit code when --gate-* thresholds aren't met
+
+#define ALIGN_GRID 16                // Alignment fingerprints are the mean luma of a 16x16 grid of blocks
+#define ALIGN_SWITCH_RATIO 0.75f     // Leave the expected degraded frame only for one at most this fraction as far from the reference
+
+#define SAMPLE_ALL    0              // Sampling modes (--sample-*)
+#define SAMPLE_EVERY  1
+#define SAMPLE_RANDOM 2
+#define SAMPLE_GOP    3
 
 int DEBUG = 0;
 #define DEBUG1(fmt, ...) if (DEBUG >= 1) { printf("DEBUG1: "); printf(fmt, ##__VA_ARGS__); printf("\n"); }
@@ -17,281 +37,1107 @@ int DEBUG = 0;
 #define HEADER_BUFFER_SIZE 256
 
 
-#if defined CLOCK_MONOTONIC_COARSE
-#define XCLOCK_MONOTONIC CLOCK_MONOTONIC_COARSE
-#else
-#define XCLOCK_MONOTONIC CLOCK_MONOTONIC
-#endif
+// One degraded stream's results for a frame.
+struct scores {
+  float psnr_results[PLANE_COUNT];   // Y, Cb, Cr
+  float ssim_results[PLANE_COUNT];
+  float ms_ssim_results[PLANE_COUNT];
+};
 
 struct frameinfo {
-  int active;
-  unsigned long frame_number;
-  unsigned char* reference_frame_buffer;
-  unsigned char* degraded_frame_buffer;
-  float psnr_results[4];
-  float ssim_results[4];
-  float ms_ssim_results[4];
+  int planes_done;                   // Results are ready to print when all planes are done. Guarded by queue_lock.
+  unsigned long frame_number;        // Position in the stream, counting frames skipped before the range
+  unsigned char* reference_frame_buffer;   // The slot's own storage, for streams that aren't mapped
+  unsigned char** degraded_frame_buffer;   // One per degraded stream
+  unsigned char* reference_frame;          // The current frames: in the buffers above, or in place in a mapped file
+  unsigned char** degraded_frame;
+  struct scores* scores;             // One per degraded stream
+};
+
+struct workerinfo {
+  pthread_t thread;
+  int cpu;                           // CPU the worker is pinned to, or -1
+  unsigned long next_frame;          // Pinned only: the next frame this worker owns
+  struct iqa_ssim_ws* ssim_ws[2];    // Luma and chroma sized, reused for every plane this worker analyzes
+  struct iqa_ms_ssim_ws* ms_ssim_ws[2];
+  const unsigned char** deg_planes;  // Per degraded stream, for iqa_ssim_ws_run_multi()
+  float* ssim_values;
 };
 
-pthread_t threads[THREAD_COUNT];
-struct frameinfo frames_info[THREAD_COUNT];
+int thread_count = 0;                // Workers. Defaults to the CPUs available to us.
+int slot_count = 0;                  // Frames in flight (being read, queued, analyzed or waiting to print)
+int pin_threads = 0;                 // Pin each worker to a CPU, with its frame buffers in local memory
+int decode_inputs = 0;               // Decode the inputs in-process (WITH_LIBAV builds) instead of reading Y4M
+int output_format = RESULTS_TEXT;
+const char* stats_path = NULL;       // --stats: where to dump the stage timing, or NULL for none
+int stats_output_format = STATS_JSON;
+int integer_ssim = 0;                // --integer-ssim: fixed-point SSIM, the same on every machine
+FILE* report;                        // Warnings and summaries: stdout, unless that's structured output
+unsigned long start_frame = 0;       // First frame to score, from --start-frame or --start-time
+unsigned long frame_limit = 0;       // Frames to score, from --frame-count or --duration. 0 is to the end.
+double start_time = -1;              // Seconds, converted to frames once the stream's frame rate is known
+double duration = -1;
+int sample_mode = SAMPLE_ALL;
+unsigned long sample_interval = 1;   // Every Nth frame, 1 in N at random, or one per N-frame GOP
+unsigned long long sample_seed = 1;  // For the random modes, so a sweep can be repeated
+unsigned char* skip_buffer = NULL;   // Somewhere to read skipped frames of unmapped streams
+unsigned long align_window = 0;      // --align: how far a degraded stream may drift, in frames. 0 pairs frames as they come.
+int gate_metric = -1;                // Quality gate: 0 PSNR, 1 SSIM, 2 MS-SSIM (luma), or -1 for no gate
+int have_gate_mean = 0, have_gate_floor = 0;
+double gate_mean, gate_floor;        // The mean must reach gate_mean, and no frame may fall below gate_floor
+struct workerinfo* workers;
 
-FILE* reference_file;
-FILE* degraded_file;
+// Frame n always lives in slot n % slot_count, so the slots form a bounded ring that
+// doubles as the reorder buffer. Frames move through it in three stages, each tracked
+// by a counter that only grows:
+//   frame_count  - frames read into slots and queued for the workers
+//   next_work    - plane tasks handed to a worker. Task t is plane t % PLANE_COUNT of
+//                  frame t / PLANE_COUNT, so the work queue is [next_work, frame_count * PLANE_COUNT)
+//   next_output  - frames printed, whose slots the reader may refill
+// All three, and each slot's 'planes_done' count, are guarded by queue_lock. Planes are
+// scored straight from the slot's buffers, so the three tasks of a frame share them.
+//
+// With pinned workers, whole frames are dealt out round-robin instead (worker i takes
+// frames i, i+thread_count, ...). Since slot_count = 2 * thread_count, each slot is then
+// only ever used by one worker, and its buffers are allocated on that worker's NUMA node.
+struct frameinfo* frames_info;
+pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t slot_free = PTHREAD_COND_INITIALIZER;     // Signalled when next_output advances
+pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;    // Signalled when frame_count advances or reading ends
+pthread_cond_t result_ready = PTHREAD_COND_INITIALIZER;  // Signalled when a frame's last plane is done or reading ends
+unsigned long next_work = 0;
+unsigned long next_output = 0;
 
+// One reference is compared with any number of degraded streams (candidates), read in
+// lockstep. The reference side of SSIM is computed once per plane for all of them.
+struct y4m_input reference_input;
+struct y4m_input* degraded_inputs;
+char** degraded_names;
+int candidate_count = 0;
+
+struct y4m_format frame_format;     // Plane layout, from the reference stream header
 unsigned int width = 0;
 unsigned int height = 0;
 unsigned int frame_size = 0;
 unsigned long frame_count = 0;
 int all_frames_read = 0;
+int stop_requested = 0;              // The gate is decided; drop the rest. Guarded by queue_lock.
+int gate_stop_pipe[2] = { -1, -1 };  // With a gate, the collector closes the write end to cancel reads
 
-double timespec_to_double(struct timespec *the_time) {
-  double decimal_time = (double)(the_time->tv_sec);
-  decimal_time += (double)(the_time->tv_nsec) / 1e9;
-  return decimal_time;
-}
-
-double get_current_time() {
-  struct timespec now;
-  clock_gettime(XCLOCK_MONOTONIC, &now);
-  return timespec_to_double(&now);
-}
-
-void* analyze_frame_pair(void* thread_data) {
-  struct frameinfo *frame = (struct frameinfo*)thread_data;
-  double before,after;
-  unsigned char* ref_plane_buf;
-  unsigned char* deg_plane_buf;
-  float luma_result, chroma_cb_result, chroma_cr_result;
-
-  frame->active = 1;
-
-  chroma_cb_result = 0.0;
-  chroma_cr_result = 0.0;
-
-  ref_plane_buf = frame->reference_frame_buffer;
-  deg_plane_buf = frame->degraded_frame_buffer;
-  before = get_current_time();
-  luma_result =      iqa_psnr(ref_plane_buf, deg_plane_buf, width, height, width);
-  // ref_plane_buf += (width*height);
-  // deg_plane_buf += (width*height);
-  // chroma_cb_result = iqa_psnr(ref_plane_buf, deg_plane_buf, width, height, width);
-  // ref_plane_buf += (width*height);
-  // deg_plane_buf += (width*height);
-  // chroma_cr_result = iqa_psnr(ref_plane_buf, deg_plane_buf, width, height, width);
-  after = get_current_time();
-
-  frame->psnr_results[0] = luma_result;
-  frame->psnr_results[1] = chroma_cb_result;
-  frame->psnr_results[2] = chroma_cr_result;
-  frame->psnr_results[3] = after-before;
-
-  ref_plane_buf = frame->reference_frame_buffer;
-  deg_plane_buf = frame->degraded_frame_buffer;
-  before = get_current_time();
-  luma_result =      iqa_ssim(ref_plane_buf, deg_plane_buf, width, height, width, 0, 0);
-  // ref_plane_buf += (width*height);
-  // deg_plane_buf += (width*height);
-  // chroma_cb_result = iqa_ssim(ref_plane_buf, deg_plane_buf, width, height, width, 0, 0);
-  // ref_plane_buf += (width*height);
-  // deg_plane_buf += (width*height);
-  // chroma_cr_result = iqa_ssim(ref_plane_buf, deg_plane_buf, width, height, width, 0, 0);
-  after = get_current_time();
-
-  frame->ssim_results[0] = luma_result;
-  frame->ssim_results[1] = chroma_cb_result;
-  frame->ssim_results[2] = chroma_cr_result;
-  frame->ssim_results[3] = after-before;
-
-  if (DO_MS_SSIM) {
-    ref_plane_buf = frame->reference_frame_buffer;
-    deg_plane_buf = frame->degraded_frame_buffer;
-    before = get_current_time();
-    luma_result =      iqa_ms_ssim(ref_plane_buf, deg_plane_buf, width, height, width, 0);
-    // ref_plane_buf += (width*height);
-    // deg_plane_buf += (width*height);
-    // chroma_cb_result = iqa_ms_ssim(ref_plane_buf, deg_plane_buf, width, height, width, 0);
-    // ref_plane_buf += (width*height);
-    // deg_plane_buf += (width*height);
-    // chroma_cr_result = iqa_ms_ssim(ref_plane_buf, deg_plane_buf, width, height, width, 0);
-    after = get_current_time();
-  }
-
-  frame->ms_ssim_results[0] = luma_result;
-  frame->ms_ssim_results[1] = chroma_cb_result;
-  frame->ms_ssim_results[2] = chroma_cr_result;
-  frame->ms_ssim_results[3] = after-before;
-
-  pthread_exit(thread_data);
-}
-
-void validate_headers(FILE* stream, char* stream_name) {
-  char buf[HEADER_BUFFER_SIZE];
-  char* tag;
-  unsigned int stream_width;
-  unsigned int stream_height;
-
-  // Running on the assumption that a STREAM or FRAME header line is never more than BUFFER_SIZE long.
-  //   -- generally safe, especially with controlled streams, but not literally guaranteed.
-  if (fgets(buf, HEADER_BUFFER_SIZE, stream) != NULL) {
-    // printf("Header line: %s", buf);
-
-    if (strstr(buf, "YUV4MPEG2") != buf) {
-      error_exit("Unsupported file: %s is not YUV4MPEG formatted!", stream_name);
-    }
-
-    if (strstr(buf, "C444 ") == NULL) { // Note: 10-bit would be C444p10, for example.
-      error_exit("Unsupported file: %s must be in 8-bit 4:4:4 format!", stream_name);
-    }
-
-    if ((tag = strstr(buf, " W")) != NULL) {
-      sscanf(tag + 2, "%u", &stream_width);
-      if (stream_width == 0) {
-        error_exit("Couldn't determine %s frame width!", stream_name);
-      }
+// Quality gate progress, updated by the collector in frame order.
+struct gate_state {
+  unsigned long frames;              // Frames the gate will see, if known up front (mapped inputs), or 0
+  unsigned long scored;
+  double sum;                        // Of gate_sample()s
+  int result;                        // 0 while undecided, then 1 pass or -1 fail
+  char reason[160];
+} gate;
+
+// With --align, each degraded stream is read up to align_window frames ahead of the frame
+// it was last paired with. Every reference frame is fingerprinted and paired with the frame
+// after the last match, unless another in that window looks clearly closer, so a dropped
+// or duplicated frame shifts the pairing instead of spoiling every later score.
+// Only touched by the reader.
+struct alignment {
+  unsigned char** buffers;           // A ring of align_window + 1 frames, by frame number. NULL entries when mapped.
+  unsigned char** frames;            // Where each ring entry's data is
+  float* prints;                     // ALIGN_GRID * ALIGN_GRID per ring entry
+  unsigned long read;                // Frames read so far, counting from the start of the range
+  int ended;
+  long last;                         // Frame paired with the previous reference frame, or -1
+  unsigned long repeats;             // Reference frames 'last' was paired with, after the first
+  long offset;                       // Degraded minus reference frame number, as last reported
+} *alignments;
+float reference_print[ALIGN_GRID * ALIGN_GRID];
+
+// Running sums of the scored frames' luma and combined values, for the sampling estimate.
+// One per candidate. Only touched by the collector until it has been joined.
+struct sample_stats {
+  double sum[3][2];                  // PSNR, SSIM, MS-SSIM by luma, yuv
+  double sum_squares[3][2];
+} *sample_stats;
+
+// Scores one plane of a frame for every candidate, in place in the frame buffers.
+void analyze_plane(struct workerinfo *worker, struct frameinfo *frame, int plane) {
+  double before;
+  struct iqa_ssim_timing timing;
+  unsigned char* ref_plane_buf = frame->reference_frame + frame_format.plane_offset[plane];
+  const unsigned char** deg_planes = worker->deg_planes;
+  unsigned int plane_width = frame_format.plane_width[plane];
+  unsigned int plane_height = frame_format.plane_height[plane];
+  struct scores* scores = frame->scores;
+  int ws = plane ? 1 : 0;
+  int c;
+
+  for (c = 0; c < candidate_count; c++) {
+    deg_planes[c] = frame->degraded_frame[c] + frame_format.plane_offset[plane];
+  }
+
+  before = stats_now();
+  for (c = 0; c < candidate_count; c++) {
+    scores[c].psnr_results[plane] = iqa_psnr(ref_plane_buf, deg_planes[c], plane_width, plane_height, plane_width);
+  }
+  stats_record(STAGE_PSNR, stats_now() - before);
+
+  if (candidate_count == 1) {
+    scores[0].ssim_results[plane] = iqa_ssim_ws_run(worker->ssim_ws[ws], ref_plane_buf, deg_planes[0], plane_width);
+  } else {
+    // Can't run out of memory: allocate_worker() reserved the buffers for every candidate.
+    iqa_ssim_ws_run_multi(worker->ssim_ws[ws], ref_plane_buf, deg_planes, candidate_count, plane_width, worker->ssim_values);
+    for (c = 0; c < candidate_count; c++) {
+      scores[c].ssim_results[plane] = worker->ssim_values[c];
+    }
+  }
+  if (stats_enabled) {
+    iqa_ssim_ws_take_timing(worker->ssim_ws[ws], &timing);
+    stats_record(STAGE_CONVERT, timing.convert);
+    stats_record(STAGE_FILTER, timing.filter);
+    stats_record(STAGE_COMBINE, timing.combine);
+  }
+
+  for (c = 0; c < candidate_count; c++) {
+    if (DO_MS_SSIM) {
+      scores[c].ms_ssim_results[plane] = iqa_ms_ssim_ws_run(worker->ms_ssim_ws[ws], ref_plane_buf, deg_planes[c], plane_width);
     } else {
-      error_exit("Couldn't determine %s frame width!", stream_name);
+      scores[c].ms_ssim_results[plane] = scores[c].ssim_results[plane];
     }
+  }
+}
 
-    if ((tag = strstr(buf, " H")) != NULL) {
-      sscanf(tag + 2, "%u", &stream_height);
-      if (stream_height == 0) {
-        error_exit("Couldn't determine %s frame height!", stream_name);
+// Worker thread: analyzes queued planes until the input is exhausted.
+void* analyze_frames(void* thread_data) {
+  struct workerinfo *worker = (struct workerinfo*)thread_data;
+  struct frameinfo *frame;
+  int plane, first_plane, last_plane;
+  double before;
+
+  pthread_mutex_lock(&queue_lock);
+  for (;;) {
+    if (stop_requested) break;
+    before = stats_now();
+    if (pin_threads) {
+      while (worker->next_frame >= frame_count && !all_frames_read && !stop_requested) {
+        pthread_cond_wait(&work_ready, &queue_lock);
       }
+      stats_record(STAGE_IDLE, stats_now() - before);
+      if (worker->next_frame >= frame_count || stop_requested) break;   // All frames read, none left for us.
+
+      frame = &frames_info[worker->next_frame % slot_count];
+      worker->next_frame += thread_count;
+      first_plane = 0;
+      last_plane = PLANE_COUNT - 1;
     } else {
-      error_exit("Couldn't determine %s frame height!", stream_name);
+      while (next_work == frame_count * PLANE_COUNT && !all_frames_read && !stop_requested) {
+        pthread_cond_wait(&work_ready, &queue_lock);
+      }
+      stats_record(STAGE_IDLE, stats_now() - before);
+      if (next_work == frame_count * PLANE_COUNT || stop_requested) break;   // All frames read and handed out.
+
+      frame = &frames_info[(next_work / PLANE_COUNT) % slot_count];
+      first_plane = last_plane = next_work % PLANE_COUNT;
+      next_work++;
     }
+    pthread_mutex_unlock(&queue_lock);
 
-  } else {
-    error_exit("No %s input!", stream_name);
-  }
+    for (plane = first_plane; plane <= last_plane; plane++) {
+      analyze_plane(worker, frame, plane);
+    }
 
-  // Make sure we read the whole header before we go on.
-  while (!feof(stream) && !strchr(buf, '\n')) {
-    if (fgets(buf, HEADER_BUFFER_SIZE, stream) == NULL) {
-      error_exit("Invalid %s input - no newline after header.", stream_name);
+    pthread_mutex_lock(&queue_lock);
+    frame->planes_done += last_plane - first_plane + 1;
+    if (frame->planes_done == PLANE_COUNT && frame == &frames_info[next_output % slot_count]) {
+      pthread_cond_signal(&result_ready);
     }
   }
-  if (feof(reference_file)) {
-    error_exit("Invalid %s input - no newline after header.", stream_name);
+  pthread_mutex_unlock(&queue_lock);
+
+  return NULL;
+}
+
+void validate_headers(struct y4m_input* input, char* stream_name) {
+  struct y4m_format stream_format;
+  const char* problem;
+  double before = stats_now();
+
+  problem = y4m_read_header(input);
+  stats_record(STAGE_HEADER, stats_now() - before);
+  if (problem != NULL) {
+    error_exit("Unsupported or invalid file: %s - %s!", stream_name, problem);
   }
+  stream_format = input->format;
 
-  if (stream_width < 32 || stream_height < 32) {
+  if (stream_format.width < 32 || stream_format.height < 32) {
     error_exit("Invalid dimensions -- %s width and height must both be 16 or greater.", stream_name);
   }
 
   if (width == 0) {
     // First stream we're checking - just set the reference values.
-    width = stream_width;
-    height = stream_height;
+    frame_format = stream_format;
+    width = stream_format.width;
+    height = stream_format.height;
   } else {
     // All other streams -- compare to reference values.
-    if (stream_width != width || stream_height != height) {
+    if (!y4m_same_layout(&stream_format, &frame_format)) {
       error_exit("Dimensions for %s do not match reference stream!", stream_name);
     }
   }
 }
 
-void read_frame_header(FILE* file, char* stream_name) {
-  char buf[HEADER_BUFFER_SIZE];
-  if (fgets(buf, HEADER_BUFFER_SIZE, file) != NULL) {
-    if (strstr(buf, "FRAME") != buf) {
-      error_exit("Frame header not found in %s!", stream_name);
-    } else if (!strchr(buf, '\n')) {
-      error_exit("Frame header in %s too long - aborting!", stream_name);
+// Fingerprints a frame for alignment: the mean of each block of its luma plane.
+void fingerprint(const unsigned char* luma, float* print) {
+  unsigned long sums[ALIGN_GRID];
+  unsigned int x, y, block_x, block_y, first_row, last_row;
+
+  for (block_y = 0; block_y < ALIGN_GRID; block_y++) {
+    first_row = block_y * height / ALIGN_GRID;
+    last_row = (block_y + 1) * height / ALIGN_GRID;
+    memset(sums, 0, sizeof(sums));
+    for (y = first_row; y < last_row; y++) {
+      for (block_x = 0; block_x < ALIGN_GRID; block_x++) {
+        for (x = block_x * width / ALIGN_GRID; x < (block_x + 1) * width / ALIGN_GRID; x++) {
+          sums[block_x] += luma[y * width + x];
+        }
+      }
+    }
+    for (block_x = 0; block_x < ALIGN_GRID; block_x++) {
+      print[block_y * ALIGN_GRID + block_x] = (float)sums[block_x] /
+        ((last_row - first_row) * ((block_x + 1) * width / ALIGN_GRID - block_x * width / ALIGN_GRID));
     }
   }
 }
 
-int read_frame_pair(FILE* ref_file, FILE* deg_file, struct frameinfo* frame) {
-  unsigned int bytes_read;
+// Mean absolute difference between two fingerprints, in luma levels.
+float fingerprint_distance(const float* a, const float* b) {
+  float sum = 0;
+  int i;
 
-  read_frame_header(ref_file, "reference stream");
-  read_frame_header(deg_file, "degraded stream");
+  for (i = 0; i < ALIGN_GRID * ALIGN_GRID; i++) {
+    sum += fabsf(a[i] - b[i]);
+  }
+  return sum / (ALIGN_GRID * ALIGN_GRID);
+}
 
-  bytes_read = fread(frame->reference_frame_buffer, 1, frame_size, ref_file);
-  if (bytes_read < frame_size) {
-    // All done.
-    if (bytes_read > 0) printf("Warning: Final frame of reference stream was incomplete.\n");
-    return 0;
+// Pairs reference frame 'position' (whose fingerprint is in reference_print) with a frame
+// of degraded stream c, and puts it in the slot. Returns 0 when the stream has nothing
+// left within reach.
+int read_aligned_frame(struct frameinfo* frame, int c, unsigned long position) {
+  struct alignment* alignment = &alignments[c];
+  unsigned long ring = align_window + 1;
+  long expected = alignment->last + 1, first, last, j, best = -1;
+  float distance, best_distance = 0, expected_distance = 0;
+  unsigned long k;
+
+  // The last match may be used again (a duplicated reference frame, or one the degraded
+  // stream dropped), but not for more than align_window reference frames in a row.
+  first = alignment->last >= 0 && alignment->repeats < align_window ? alignment->last : expected;
+  last = (alignment->last >= 0 ? alignment->last : 0) + (long)align_window;
+  while (!alignment->ended && (long)alignment->read <= last) {
+    k = alignment->read % ring;
+    if (y4m_read_stream_frame(&degraded_inputs[c], degraded_names[c], report, alignment->buffers[k], &alignment->frames[k])) {
+      fingerprint(alignment->frames[k], alignment->prints + k * ALIGN_GRID * ALIGN_GRID);
+      alignment->read++;
+    } else {
+      alignment->ended = 1;
+    }
   }
+  if (last >= (long)alignment->read) last = (long)alignment->read - 1;
 
-  bytes_read = fread(frame->degraded_frame_buffer, 1, frame_size, deg_file);
-  if (bytes_read < frame_size) {
-    // All done.
-    if (bytes_read > 0) printf("Warning: Final frame of degraded stream was incomplete.\n");
-    return 0;
+  // Stay on the expected frame unless another is clearly closer. The margin scales with the
+  // expected frame's distance, so it means the same on flat or noisy content, where every
+  // frame's fingerprint is close to the reference, as on busy scenes. Of the others, the
+  // closest wins, and the nearest to the expected frame breaks a tie.
+  for (j = first; j <= last; j++) {
+    distance = fingerprint_distance(reference_print, alignment->prints + (j % ring) * ALIGN_GRID * ALIGN_GRID);
+    if (j == expected) {
+      expected_distance = distance;
+    } else if (best < 0 || distance < best_distance || (distance == best_distance && labs(j - expected) < labs(best - expected))) {
+      best = j;
+      best_distance = distance;
+    }
+  }
+  if (expected <= last && (best < 0 || best_distance >= ALIGN_SWITCH_RATIO * expected_distance)) {
+    best = expected;
+  }
+  if (best < 0) return 0;
+
+  alignment->repeats = best == alignment->last ? alignment->repeats + 1 : 0;
+  alignment->last = best;
+  if (best - (long)position != alignment->offset) {
+    alignment->offset = best - (long)position;
+    fprintf(report, "Alignment: %s frame %ld paired with reference frame %lu (offset %+ld)\n",
+            degraded_names[c], (long)start_frame + best, start_frame + position, alignment->offset);
   }
 
+  // Ring entries are reused as the stream is read, so unmapped frames are copied into the slot.
+  k = best % ring;
+  if (frame->degraded_frame_buffer[c] != NULL) {
+    memcpy(frame->degraded_frame_buffer[c], alignment->frames[k], frame_size);
+    frame->degraded_frame[c] = frame->degraded_frame_buffer[c];
+  } else {
+    frame->degraded_frame[c] = alignment->frames[k];
+  }
   return 1;
 }
 
+// Reads the next frame of the reference and every degraded stream, or with --align the
+// degraded frames that best match it. Returns 0 when any of them ends.
+int read_frame_set(struct frameinfo* frame) {
+  int c;
+
+  if (!y4m_read_stream_frame(&reference_input, "reference stream", report, frame->reference_frame_buffer, &frame->reference_frame)) {
+    return 0;
+  }
+  if (align_window > 0) {
+    fingerprint(frame->reference_frame, reference_print);
+  }
+  for (c = 0; c < candidate_count; c++) {
+    if (align_window > 0) {
+      if (!read_aligned_frame(frame, c, frame->frame_number - start_frame)) {
+        return 0;
+      }
+    } else if (!y4m_read_stream_frame(&degraded_inputs[c], degraded_names[c], report, frame->degraded_frame_buffer[c], &frame->degraded_frame[c])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void add_sample(struct sample_stats* stats, int metric, double luma, double yuv) {
+  stats->sum[metric][0] += luma;
+  stats->sum_squares[metric][0] += luma * luma;
+  stats->sum[metric][1] += yuv;
+  stats->sum_squares[metric][1] += yuv * yuv;
+}
+
+// What the gate adds up for a frame's value. PSNR goes in as MSE, so that a frame identical
+// to the reference (infinite PSNR) can't make the mean infinite whatever the other frames
+// score; the mean PSNR is then that of the mean MSE, as in weighted_psnr_yuv().
+double gate_sample(double value) {
+  return gate_metric == 0 ? 255.0 * 255.0 / pow(10.0, value / 10.0) : value;
+}
+
+// The gate's mean from a sum of gate_sample()s over 'count' frames.
+double gate_mean_value(double sum, double count) {
+  return gate_metric == 0 ? 10.0 * log10(255.0 * 255.0 / (sum / count)) : sum / count;
+}
+
+// Adds a frame to the quality gate. Returns 1 once the outcome is certain: a frame is below
+// the floor, the mean can't reach its threshold even if every remaining frame is perfect,
+// or (with no floor) it can't miss even if every remaining frame is as bad as possible.
+// Both mean checks need the number of frames in advance.
+int check_gate(struct frameinfo* frame) {
+  static const char* metric_names[3] = { "PSNR", "SSIM", "MS-SSIM" };
+  static const double best_sample[3] = { 0, 1, 1 };               // As gate_sample()s: PSNR as MSE
+  static const double worst_sample[3] = { 255.0 * 255.0, -1, -1 };
+  float* results[3] = { frame->scores[0].psnr_results, frame->scores[0].ssim_results, frame->scores[0].ms_ssim_results };
+  double value = results[gate_metric][0], remaining;
+
+  gate.scored++;
+  gate.sum += gate_sample(value);
+
+  if (have_gate_floor && value < gate_floor) {
+    gate.result = -1;
+    snprintf(gate.reason, sizeof(gate.reason), "frame %lu %s %.5f is below the floor of %.5f",
+      frame->frame_number, metric_names[gate_metric], value, gate_floor);
+    return 1;
+  }
+
+  if (have_gate_mean && gate.frames != 0) {
+    remaining = gate.frames - gate.scored;
+    if (gate_mean_value(gate.sum + remaining * best_sample[gate_metric], gate.frames) < gate_mean) {
+      gate.result = -1;
+      snprintf(gate.reason, sizeof(gate.reason), "mean %s can't reach %.5f after frame %lu",
+        metric_names[gate_metric], gate_mean, frame->frame_number);
+      return 1;
+    }
+    if (!have_gate_floor && gate_mean_value(gate.sum + remaining * worst_sample[gate_metric], gate.frames) >= gate_mean) {
+      gate.result = 1;
+      snprintf(gate.reason, sizeof(gate.reason), "mean %s is at least %.5f after frame %lu",
+        metric_names[gate_metric], gate_mean, frame->frame_number);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Settles the gate once every frame has been scored without an early decision.
+void finish_gate() {
+  static const char* metric_names[3] = { "PSNR", "SSIM", "MS-SSIM" };
+  double mean = gate.scored ? gate_mean_value(gate.sum, gate.scored) : 0;
+
+  if (gate.result != 0) return;
+  if (gate.scored == 0) {
+    gate.result = -1;
+    snprintf(gate.reason, sizeof(gate.reason), "no frames were compared");
+  } else if (have_gate_mean && mean < gate_mean) {
+    gate.result = -1;
+    snprintf(gate.reason, sizeof(gate.reason), "mean %s %.5f is below %.5f", metric_names[gate_metric], mean, gate_mean);
+  } else {
+    gate.result = 1;
+    snprintf(gate.reason, sizeof(gate.reason), "mean %s %.5f over %lu frames", metric_names[gate_metric], mean, gate.scored);
+  }
+}
+
+// Writes a candidate's results for a frame: each metric's Y, Cb and Cr values, then the
+// combined score.
+void output_frame(struct frameinfo* frame, int candidate) {
+  struct scores* scores = &frame->scores[candidate];
+  float* results[RESULT_METRICS] = { scores->psnr_results, scores->ssim_results, scores->ms_ssim_results };
+  float values[RESULT_VALUES];
+  int metric, plane;
+
+  for (metric = 0; metric < RESULT_METRICS; metric++) {
+    for (plane = 0; plane < PLANE_COUNT; plane++) {
+      values[metric * RESULT_PLANES + plane] = results[metric][plane];
+    }
+    values[metric * RESULT_PLANES + PLANE_COUNT] = metric == 0 ? weighted_psnr_yuv(results[metric]) : weighted_yuv(results[metric]);
+  }
+  results_frame(frame->frame_number, candidate, values);
+}
+
+// Prints results in frame order, as each next frame finishes, then frees its slot.
 void* collect_results(void* t) {
-  unsigned long frame_number = 0;
-  int thread_number = 0;
-  void* status;
-  int result_code;
   struct frameinfo* frame;
+  struct scores* scores;
+  double before;
+  int c;
 
-  while (frame_number < frame_count || !all_frames_read) {
-    if (frames_info[thread_number].active == 1) {
-      result_code = pthread_join(threads[thread_number], &status);
+  pthread_mutex_lock(&queue_lock);
+  for (;;) {
+    frame = &frames_info[next_output % slot_count];
+    while (!(next_output < frame_count && frame->planes_done == PLANE_COUNT) && !(all_frames_read && next_output == frame_count)) {
+      pthread_cond_wait(&result_ready, &queue_lock);
+    }
+    if (next_output == frame_count) break;   // All frames read and printed.
+    pthread_mutex_unlock(&queue_lock);
 
-      frame = &frames_info[thread_number];
-      // printf("Frame %lu PSNR (%04dms):    luma = %7.5f, chroma_cb = %7.5f, chroma_cr = %7.5f\n", frame->frame_number, (int)(frame->psnr_results[3] * 1000), frame->psnr_results[0], frame->psnr_results[1], frame->psnr_results[2]);
-      // printf("Frame %lu SSIM (%04dms):    luma = %7.5f, chroma_cb = %7.5f, chroma_cr = %7.5f\n", frame->frame_number, (int)(frame->ssim_results[3] * 1000), frame->ssim_results[0], frame->ssim_results[1], frame->ssim_results[2]);
-      // printf("Frame %lu MS-SSIM (%04dms): luma = %7.5f, chroma_cb = %7.5f, chroma_cr = %7.5f\n", frame->frame_number, (int)(frame->ms_ssim_results[3] * 1000), frame->ms_ssim_results[0], frame->ms_ssim_results[1], frame->ms_ssim_results[2]);
-      printf("Frame %lu PSNR:    luma = %8.5f, chroma_cb = %8.5f, chroma_cr = %8.5f\n", frame->frame_number, frame->psnr_results[0], frame->psnr_results[1], frame->psnr_results[2]);
-      printf("Frame %lu SSIM:    luma = %8.5f, chroma_cb = %8.5f, chroma_cr = %8.5f\n", frame->frame_number, frame->ssim_results[0], frame->ssim_results[1], frame->ssim_results[2]);
-      printf("Frame %lu MS-SSIM: luma = %8.5f, chroma_cb = %8.5f, chroma_cr = %8.5f\n", frame->frame_number, frame->ms_ssim_results[0], frame->ms_ssim_results[1], frame->ms_ssim_results[2]);      
+    before = stats_now();
+    for (c = 0; c < candidate_count; c++) {
+      output_frame(frame, c);
+      if (sample_mode != SAMPLE_ALL) {
+        scores = &frame->scores[c];
+        add_sample(&sample_stats[c], 0, scores->psnr_results[0], weighted_psnr_yuv(scores->psnr_results));
+        add_sample(&sample_stats[c], 1, scores->ssim_results[0], weighted_yuv(scores->ssim_results));
+        add_sample(&sample_stats[c], 2, scores->ms_ssim_results[0], weighted_yuv(scores->ms_ssim_results));
+      }
+    }
+    stats_record(STAGE_OUTPUT, stats_now() - before);
+    if (gate_metric >= 0 && check_gate(frame)) {
+      // Decided: stop reading and scoring, so main can close the inputs right away. If
+      // main is waiting on a fifo or pipe that has stalled, this also makes it give up.
+      pthread_mutex_lock(&queue_lock);
+      stop_requested = 1;
+      pthread_cond_broadcast(&work_ready);
+      pthread_cond_signal(&slot_free);
+      close(gate_stop_pipe[1]);
+      break;
+    }
 
-      frame->active = 0;
+    pthread_mutex_lock(&queue_lock);
+    frame->planes_done = 0;
+    next_output++;
+    pthread_cond_signal(&slot_free);
+  }
+  pthread_mutex_unlock(&queue_lock);
 
-      frame_number++;
-      thread_number = frame_number % THREAD_COUNT;
-    } else {
-      usleep(100);
+  return t;
+}
+
+// Waits until the slot for the next frame to read has been printed and freed. Returns
+// NULL if the gate has been decided and there's no point reading any more.
+struct frameinfo* wait_for_free_slot() {
+  struct frameinfo* frame;
+  double before = stats_now();
+
+  pthread_mutex_lock(&queue_lock);
+  while (frame_count - next_output >= slot_count && !stop_requested) {
+    pthread_cond_wait(&slot_free, &queue_lock);
+  }
+  stats_record(STAGE_BLOCKED, stats_now() - before);
+  frame = stop_requested ? NULL : &frames_info[frame_count % slot_count];
+  pthread_mutex_unlock(&queue_lock);
+  return frame;
+}
+
+// Hands the frame just read to the workers.
+void queue_frame() {
+  pthread_mutex_lock(&queue_lock);
+  frame_count++;
+  stats_count(STAGE_QUEUE, frame_count - next_output);
+  pthread_cond_broadcast(&work_ready);   // One task per plane (or, pinned, only the owning worker can take it).
+  pthread_mutex_unlock(&queue_lock);
+}
+
+// Lets the workers and the collector finish once the queue drains.
+void finish_reading() {
+  pthread_mutex_lock(&queue_lock);
+  all_frames_read = 1;
+  pthread_cond_broadcast(&work_ready);
+  pthread_cond_broadcast(&result_ready);
+  pthread_mutex_unlock(&queue_lock);
+}
+
+
+void usage(char* program) {
+  fprintf(stderr, "Usage: %s [options] <reference_file.y4m> <degraded_file.y4m> [<degraded_file.y4m> ...]\n", program);
+  fprintf(stderr, "Several degraded streams are read in lockstep and numbered from 0 in the results.\n");
+  fprintf(stderr, "  -t, --threads <n>       Worker threads (default: CPUs available, %d here)\n", available_cpu_count());
+  fprintf(stderr, "  -p, --pin               Pin each worker to a CPU and keep its frame buffers in local memory\n");
+  fprintf(stderr, "  -d, --decode            Decode the inputs in-process, in any format FFmpeg reads, instead of\n");
+  fprintf(stderr, "                          reading Y4M (needs a 'make WITH_LIBAV=1' build)\n");
+  fprintf(stderr, "  -f, --format <f>        Results as text (default), csv, ndjson or binary. Warnings and\n");
+  fprintf(stderr, "                          summaries go to stderr with the structured formats.\n");
+  fprintf(stderr, "      --stats <file>      Dump per-stage timing histograms to file ('-' for stderr) at exit and\n");
+  fprintf(stderr, "                          on SIGUSR1\n");
+  fprintf(stderr, "      --stats-format <f>  Timing dumps as json (default) or csv\n");
+  fprintf(stderr, "      --integer-ssim      Fixed-point SSIM: identical on every machine and thread count, a little\n");
+  fprintf(stderr, "                          different from the default floating point scores\n");
+  fprintf(stderr, "      --start-frame <n>   Skip to frame n (counting from 0)\n");
+  fprintf(stderr, "      --frame-count <n>   Score at most n frames\n");
+  fprintf(stderr, "      --start-time <t>    Skip to time t, in seconds or [hh:]mm:ss[.fff], at the stream's frame rate\n");
+  fprintf(stderr, "      --duration <t>      Score at most t worth of frames\n");
+  fprintf(stderr, "      --sample-every <n>  Score only every nth frame and estimate the mean\n");
+  fprintf(stderr, "      --sample-random <n> Score each frame with probability 1/n and estimate the mean\n");
+  fprintf(stderr, "      --sample-gop <n>    Score one random frame from each n-frame GOP and estimate the mean\n");
+  fprintf(stderr, "      --seed <n>          Seed for the random sampling modes (default: 1)\n");
+  fprintf(stderr, "      --align <n>         Pair each reference frame with the closest-looking degraded frame, up to\n");
+  fprintf(stderr, "                          n frames from the expected one, to follow dropped or duplicated frames\n");
+  fprintf(stderr, "      --gate-mean <x>     Pass only if the mean is at least x; stop as soon as it can't be\n");
+  fprintf(stderr, "      --gate-floor <y>    Pass only if no frame scores below y; stop at the first that does\n");
+  fprintf(stderr, "      --gate-metric <m>   Luma metric the gate checks: psnr, ssim (default) or ms-ssim\n");
+  fprintf(stderr, "                          A failed gate exits with status %d\n", GATE_FAIL_EXIT);
+  exit(1);
+}
+
+// Parses a frame number option.
+unsigned long parse_frames(const char* text, const char* option) {
+  char* end;
+  unsigned long frames = strtoul(text, &end, 10);
+  if (end == text || *end != '\0' || text[0] == '-') {
+    error_exit("Invalid frame number for --%s: %s", option, text);
+  }
+  return frames;
+}
+
+// Parses a time option: seconds, or [hh:]mm:ss with optional fractional seconds.
+double parse_time(const char* text, const char* option) {
+  double seconds = 0, field;
+  const char* position = text;
+  char* end;
+  int fields = 0;
+
+  for (;;) {
+    field = strtod(position, &end);
+    if (end == position || field < 0 || ++fields > 3) {
+      error_exit("Invalid time for --%s: %s", option, text);
+    }
+    seconds = seconds * 60 + field;
+    if (*end == '\0') break;
+    if (*end != ':' || memchr(position, '.', end - position) != NULL) {
+      error_exit("Invalid time for --%s: %s", option, text);
+    }
+    position = end + 1;
+  }
+  return seconds;
+}
+
+void parse_options(int argc, char* argv[]) {
+  enum { STATS = 256, STATS_FORMAT, START_FRAME, FRAME_COUNT, START_TIME, DURATION, SAMPLE_EVERY_OPT, SAMPLE_RANDOM_OPT, SAMPLE_GOP_OPT, SEED, ALIGN, GATE_MEAN, GATE_FLOOR, GATE_METRIC, INTEGER_SSIM };
+  static struct option options[] = {
+    { "threads",     required_argument, NULL, 't' },
+    { "pin",         no_argument,       NULL, 'p' },
+    { "format",      required_argument, NULL, 'f' },
+    { "decode",      no_argument,       NULL, 'd' },
+    { "stats",       required_argument, NULL, STATS },
+    { "stats-format",  required_argument, NULL, STATS_FORMAT },
+    { "start-frame", required_argument, NULL, START_FRAME },
+    { "frame-count", required_argument, NULL, FRAME_COUNT },
+    { "start-time",  required_argument, NULL, START_TIME },
+    { "duration",    required_argument, NULL, DURATION },
+    { "sample-every",  required_argument, NULL, SAMPLE_EVERY_OPT },
+    { "sample-random", required_argument, NULL, SAMPLE_RANDOM_OPT },
+    { "sample-gop",    required_argument, NULL, SAMPLE_GOP_OPT },
+    { "seed",          required_argument, NULL, SEED },
+    { "align",         required_argument, NULL, ALIGN },
+    { "gate-mean",     required_argument, NULL, GATE_MEAN },
+    { "gate-floor",    required_argument, NULL, GATE_FLOOR },
+    { "gate-metric",   required_argument, NULL, GATE_METRIC },
+    { "integer-ssim",  no_argument,       NULL, INTEGER_SSIM },
+    { "help",        no_argument,       NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+  int have_start_frame = 0, have_frame_count = 0, metric = 1;
+  char* end;
+  int option;
+
+  while ((option = getopt_long(argc, argv, "t:pf:dh", options, NULL)) != -1) {
+    switch (option) {
+      case 't':
+        thread_count = atoi(optarg);
+        if (thread_count < 1) {
+          error_exit("Thread count must be at least 1!");
+        }
+        break;
+      case 'p':
+        pin_threads = 1;
+        break;
+      case 'd':
+#ifdef HAVE_LIBAV
+        decode_inputs = 1;
+#else
+        error_exit("This build can't decode in-process; rebuild with 'make WITH_LIBAV=1'.");
+#endif
+        break;
+      case 'f':
+        output_format = results_format(optarg);
+        if (output_format < 0) {
+          error_exit("Unknown output format: %s", optarg);
+        }
+        break;
+      case STATS:
+        stats_path = optarg;
+        break;
+      case STATS_FORMAT:
+        stats_output_format = stats_format(optarg);
+        if (stats_output_format < 0) {
+          error_exit("Unknown stats format: %s", optarg);
+        }
+        break;
+      case START_FRAME:
+        start_frame = parse_frames(optarg, "start-frame");
+        have_start_frame = 1;
+        break;
+      case FRAME_COUNT:
+        frame_limit = parse_frames(optarg, "frame-count");
+        if (frame_limit == 0) {
+          error_exit("Frame count must be at least 1!");
+        }
+        have_frame_count = 1;
+        break;
+      case START_TIME:
+        start_time = parse_time(optarg, "start-time");
+        break;
+      case DURATION:
+        duration = parse_time(optarg, "duration");
+        if (duration == 0) {
+          error_exit("Duration must be more than 0!");
+        }
+        break;
+      case SAMPLE_EVERY_OPT:
+      case SAMPLE_RANDOM_OPT:
+      case SAMPLE_GOP_OPT:
+        if (sample_mode != SAMPLE_ALL) {
+          error_exit("Use only one sampling mode!");
+        }
+        sample_mode = option == SAMPLE_EVERY_OPT ? SAMPLE_EVERY : option == SAMPLE_RANDOM_OPT ? SAMPLE_RANDOM : SAMPLE_GOP;
+        sample_interval = parse_frames(optarg, sample_mode == SAMPLE_EVERY ? "sample-every" : sample_mode == SAMPLE_RANDOM ? "sample-random" : "sample-gop");
+        if (sample_interval == 0) {
+          error_exit("Sampling interval must be at least 1!");
+        }
+        break;
+      case SEED:
+        sample_seed = parse_frames(optarg, "seed");
+        break;
+      case ALIGN:
+        align_window = parse_frames(optarg, "align");
+        if (align_window == 0) {
+          error_exit("Alignment window must be at least 1 frame!");
+        }
+        break;
+      case GATE_MEAN:
+      case GATE_FLOOR:
+        *(option == GATE_MEAN ? &gate_mean : &gate_floor) = strtod(optarg, &end);
+        if (end == optarg || *end != '\0') {
+          error_exit("Invalid threshold for --%s: %s", option == GATE_MEAN ? "gate-mean" : "gate-floor", optarg);
+        }
+        *(option == GATE_MEAN ? &have_gate_mean : &have_gate_floor) = 1;
+        break;
+      case GATE_METRIC:
+        if (strcmp(optarg, "psnr") == 0) metric = 0;
+        else if (strcmp(optarg, "ssim") == 0) metric = 1;
+        else if (strcmp(optarg, "ms-ssim") == 0) metric = 2;
+        else {
+          error_exit("Unknown gate metric: %s", optarg);
+        }
+        break;
+      case INTEGER_SSIM:
+        integer_ssim = 1;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+
+  if (argc - optind < 2) {
+    usage(argv[0]);
+  }
+  if (have_start_frame && start_time >= 0) {
+    error_exit("Use only one of --start-frame and --start-time!");
+  }
+  if (have_frame_count && duration >= 0) {
+    error_exit("Use only one of --frame-count and --duration!");
+  }
+  if (align_window > 0 && sample_mode != SAMPLE_ALL) {
+    error_exit("Alignment follows the streams frame by frame, so it can't be used with sampling!");
+  }
+  if (have_gate_mean || have_gate_floor) {
+    if (sample_mode != SAMPLE_ALL) {
+      error_exit("The quality gate needs every frame, so it can't be used with sampling!");
     }
+    if (argc - optind > 2) {
+      error_exit("The quality gate checks a single degraded stream!");
+    }
+    gate_metric = metric;
   }
 
-  pthread_exit(t);
+  if (thread_count == 0) {
+    thread_count = available_cpu_count();
+  }
+  slot_count = 2 * thread_count;
 }
 
+// Converts --start-time and --duration to frames, using the reference stream's frame rate.
+// A time inside a frame's display interval selects that frame, and a duration covers
+// every frame that starts before it ends.
+void resolve_time_range() {
+  double fps;
 
-// ffmpeg -i input.mp4 -pix_fmt yuv444p -f yuv4mpegpipe - | comparison_tool
-int main(int argc,char* argv[]){
-  int i, result_code;
+  if (start_time < 0 && duration < 0) return;
+  if (frame_format.fps_num == 0) {
+    error_exit("--start-time and --duration need the frame rate (F) in the reference stream header!");
+  }
+  fps = (double)frame_format.fps_num / frame_format.fps_den;
+  if (start_time >= 0) {
+    start_frame = (unsigned long)floor(start_time * fps + 1e-6);
+  }
+  if (duration >= 0) {
+    frame_limit = (unsigned long)ceil(duration * fps - 1e-6);
+    if (frame_limit == 0) frame_limit = 1;
+  }
+}
 
-  if ((argc != 3)) {
-    fprintf(stderr, "Usage: %s <reference_file.y4m> <degraded_file.y4m>\n", argv[0]);
-    exit(1);
+// Skips up to 'count' frames in every stream without scoring them. Files jump ahead;
+// pipes read and drop the frames. Returns the number skipped in all of them.
+unsigned long skip_frame_set(unsigned long count) {
+  unsigned long skipped;
+  int c;
+
+  if (skip_buffer == NULL) {
+    skip_buffer = malloc(frame_size);   // Only used by streams that aren't mapped
+    if (skip_buffer == NULL) {
+      error_exit("Out of memory allocating frame buffers!");
+    }
+  }
+  skipped = y4m_skip_frames(&reference_input, count, skip_buffer);
+  for (c = 0; c < candidate_count; c++) {
+    skipped = y4m_skip_frames(&degraded_inputs[c], skipped, skip_buffer);
   }
+  return skipped;
+}
 
-  reference_file = fopen(argv[1], "r");
-  if (reference_file < 0) {
-    fprintf(stderr, "ERROR: Could not open reference file: %s\n", argv[1]);
-    exit(2);
+// Returns how many frames are left to compare, or 0 if that isn't known until the end
+// (an input that isn't mapped, or aligned streams).
+unsigned long frames_left() {
+  unsigned long left;
+  int c;
+
+  if (reference_input.map == NULL || align_window > 0) return 0;
+  left = reference_input.frame_total - reference_input.next_frame;
+  for (c = 0; c < candidate_count; c++) {
+    if (degraded_inputs[c].map == NULL) return 0;
+    if (degraded_inputs[c].frame_total - degraded_inputs[c].next_frame < left) {
+      left = degraded_inputs[c].frame_total - degraded_inputs[c].next_frame;
+    }
+  }
+  if (frame_limit != 0 && frame_limit < left) left = frame_limit;
+  return left;
+}
+
+// Moves both streams to start_frame.
+void skip_to_start_frame() {
+  unsigned long skipped;
+
+  if (start_frame == 0) return;
+  skipped = skip_frame_set(start_frame);
+  if (skipped < start_frame) {
+    fprintf(report, "Warning: input ends after %lu frames, before the start frame.\n", skipped);
+  }
+}
+
+// xorshift64*, so sampled runs pick the same frames on every platform.
+unsigned long long next_random() {
+  static unsigned long long state = 0;
+
+  if (state == 0) state = sample_seed * 0x9E3779B97F4A7C15ULL + 1;
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return (state * 0x2545F4914F6CDD1DULL) >> 11;   // 53 bits
+}
+
+// Returns the first frame at or after 'position' (counted from the start of the range)
+// that the sampling mode scores. Asking again with the same position gives the same
+// answer, so random picks are drawn once and remembered.
+unsigned long next_sample(unsigned long position) {
+  static unsigned long picked = 0, gop = 0;
+  static int have_pick = 0;
+
+  switch (sample_mode) {
+    case SAMPLE_EVERY:
+      return (position + sample_interval - 1) / sample_interval * sample_interval;
+
+    case SAMPLE_RANDOM:
+      if (!have_pick || picked < position) {
+        picked = position;
+        while (next_random() % sample_interval != 0) picked++;
+        have_pick = 1;
+      }
+      return picked;
+
+    case SAMPLE_GOP:
+      // One frame from each stratum of sample_interval frames, offset at random within it.
+      for (;;) {
+        if (!have_pick || gop != position / sample_interval) {
+          gop = position / sample_interval;
+          picked = gop * sample_interval + next_random() % sample_interval;
+          have_pick = 1;
+        }
+        if (picked >= position) return picked;
+        position = (gop + 1) * sample_interval;
+      }
   }
+  return position;
+}
+
+// Prints the sampled estimate of each mean: the mean of the scored frames, with a 95%
+// confidence interval from their spread. The samples are treated as a simple random
+// sample of the frames in range (with the finite population correction), which is
+// conservative for the GOP-stratified mode. The speedup compares the run time with an
+// estimate of scoring every frame: the time not spent skipping, scaled up by the
+// fraction of frames scored.
+void print_sample_summary(unsigned long frames_in_range, double elapsed, double skip_time) {
+  static const char* metric_names[3] = { "PSNR", "SSIM", "MS-SSIM" };
+  static const char* value_names[2] = { "luma", "yuv" };
+  double n = frame_count, mean, variance, margin, full_time;
+  int metric, value, c;
+  struct sample_stats* stats;
+  char prefix[32] = "";
 
-  degraded_file = fopen(argv[2], "r");
-  if (degraded_file < 0) {
-    fprintf(stderr, "ERROR: Could not open degraded file: %s\n", argv[2]);
+  fprintf(report, "Sampled %lu of %lu frames\n", frame_count, frames_in_range);
+  if (frame_count == 0) return;
+
+  for (c = 0; c < candidate_count; c++) {
+    stats = &sample_stats[c];
+    if (candidate_count > 1) {
+      snprintf(prefix, sizeof(prefix), "Candidate %d ", c);
+    }
+    for (metric = 0; metric < 3; metric++) {
+      fprintf(report, "%sSampled %s:", prefix, metric_names[metric]);
+      for (value = 0; value < 2; value++) {
+        mean = stats->sum[metric][value] / n;
+        margin = 0;
+        if (frame_count > 1 && isfinite(mean)) {
+          variance = (stats->sum_squares[metric][value] - n * mean * mean) / (n - 1);
+          if (variance < 0) variance = 0;
+          margin = CONFIDENCE_Z * sqrt(variance / n * (1 - n / frames_in_range));
+        }
+        fprintf(report, "%s %s = %8.5f +/- %.5f", value ? "," : "", value_names[value], mean, margin);
+      }
+      fprintf(report, "\n");
+    }
+  }
+
+  full_time = (elapsed - skip_time) * frames_in_range / n;
+  fprintf(report, "Sampled speedup: %.1fx (%.3fs, estimated %.3fs for every frame)\n", full_time / elapsed, elapsed, full_time);
+}
+
+// Opens an input, exiting if it can't be. Regular Y4M files are mapped and used in place;
+// fifos and pipes are read into the slots, as are decoded inputs.
+void open_input(struct y4m_input* input, const char* path, const char* description) {
+#ifdef HAVE_LIBAV
+  const char* problem;
+
+  if (decode_inputs) {
+    problem = av_input_open(input, path);
+    if (problem != NULL) {
+      fprintf(stderr, "ERROR: Could not decode %s: %s - %s\n", description, path, problem);
+      exit(2);
+    }
+    return;
+  }
+#endif
+  if (y4m_open(input, path) != 0) {
+    fprintf(stderr, "ERROR: Could not open %s: %s\n", description, path);
     exit(2);
   }
+}
+
+// Makes reads of the inputs give up once the collector decides the gate, rather than
+// waiting for the upstream of a stalled fifo or pipe to write more or close it.
+void cancel_reads_on_gate() {
+  int c;
+
+  if (pipe(gate_stop_pipe) != 0) {
+    error_exit("Could not create the gate's stop pipe!");
+  }
+  y4m_set_cancel(&reference_input, gate_stop_pipe[0]);
+  for (c = 0; c < candidate_count; c++) {
+    y4m_set_cancel(&degraded_inputs[c], gate_stop_pipe[0]);
+  }
+}
+
+// Opens the --stats file and starts timing, before any thread (decoders included) starts.
+void open_stats() {
+  FILE* out = stderr;
+
+  if (strcmp(stats_path, "-") != 0) {
+    out = fopen(stats_path, "w");
+    if (out == NULL) {
+      fprintf(stderr, "ERROR: Could not open stats file: %s\n", stats_path);
+      exit(2);
+    }
+  }
+  stats_open(out, stats_output_format);
+}
+
+// Sets up the read-ahead ring and fingerprints of each degraded stream for --align.
+void allocate_alignments() {
+  struct alignment* alignment;
+  unsigned long ring = align_window + 1, i;
+  int c;
+
+  alignments = calloc(candidate_count, sizeof(struct alignment));
+  if (alignments == NULL) {
+    error_exit("Out of memory allocating alignment state!");
+  }
+  for (c = 0; c < candidate_count; c++) {
+    alignment = &alignments[c];
+    alignment->buffers = calloc(ring, sizeof(unsigned char*));
+    alignment->frames = calloc(ring, sizeof(unsigned char*));
+    alignment->prints = malloc(ring * ALIGN_GRID * ALIGN_GRID * sizeof(float));
+    if (alignment->buffers == NULL || alignment->frames == NULL || alignment->prints == NULL) {
+      error_exit("Out of memory allocating alignment state!");
+    }
+    for (i = 0; i < ring; i++) {
+      alignment->buffers[i] = y4m_frame_buffer(&degraded_inputs[c], 0);
+    }
+    alignment->last = -1;
+  }
+}
+
+// Sets up worker i's SSIM workspaces and, when pinned, its two frame slots. With pinning
+// the allocating thread runs on the worker's CPU and touches every page, so the kernel's
+// first-touch policy puts the memory on that CPU's NUMA node.
+void allocate_worker(int i) {
+  struct workerinfo* worker = &workers[i];
+  struct frameinfo* frame;
+  int slot, ws, c;
+
+  worker->cpu = pin_threads ? nth_allowed_cpu(i) : -1;
+  worker->next_frame = i;
+  if (worker->cpu >= 0) {
+    pin_thread_to_cpu(pthread_self(), worker->cpu);
+  }
 
-  validate_headers(reference_file, "reference stream");
-  validate_headers(degraded_file, "degraded stream");
+  for (ws = 0; ws < 2; ws++) {
+    // Plane 1 has the chroma size.
+    worker->ssim_ws[ws] = iqa_ssim_ws_create(frame_format.plane_width[ws], frame_format.plane_height[ws], 0, 0);
+    worker->ms_ssim_ws[ws] = DO_MS_SSIM ? iqa_ms_ssim_ws_create(frame_format.plane_width[ws], frame_format.plane_height[ws], 0) : NULL;
+    if (worker->ssim_ws[ws] == NULL || (DO_MS_SSIM && worker->ms_ssim_ws[ws] == NULL)) {
+      error_exit("Out of memory allocating SSIM workspaces!");
+    }
+    iqa_ssim_ws_set_timing(worker->ssim_ws[ws], stats_enabled);
+    if (integer_ssim && !iqa_ssim_ws_set_integer(worker->ssim_ws[ws], 1)) {
+      error_exit("Fixed-point SSIM isn't available for %ux%u planes!", frame_format.plane_width[ws], frame_format.plane_height[ws]);
+    }
+    // Allocated here rather than on the worker's first frame, where running out of memory
+    // would exit while the other threads are still using the slots.
+    if (candidate_count > 1 && iqa_ssim_ws_reserve_multi(worker->ssim_ws[ws], candidate_count) != 0) {
+      error_exit("Out of memory allocating SSIM workspaces!");
+    }
+  }
 
-  frame_size = (unsigned int)(3 * width * height);
-  DEBUG1("Frame size: %ux%u (%u bytes)", width, height, frame_size);
+  worker->deg_planes = calloc(candidate_count, sizeof(unsigned char*));
+  worker->ssim_values = calloc(candidate_count, sizeof(float));
+  if (worker->deg_planes == NULL || worker->ssim_values == NULL) {
+    error_exit("Out of memory allocating worker state!");
+  }
 
-  for (i = 0; i < THREAD_COUNT; i++) {
-    frames_info[i].active = 0;
-    frames_info[i].reference_frame_buffer = malloc(frame_size);
-    frames_info[i].degraded_frame_buffer = malloc(frame_size);
-    if (frames_info[i].reference_frame_buffer == NULL || frames_info[i].degraded_frame_buffer == NULL) {
+  // Unpinned, slots aren't tied to workers, so each worker just allocates two of them.
+  for (slot = i; slot < slot_count; slot += thread_count) {
+    frame = &frames_info[slot];
+    frame->planes_done = 0;
+    frame->reference_frame_buffer = y4m_frame_buffer(&reference_input, worker->cpu >= 0);
+    frame->degraded_frame_buffer = calloc(candidate_count, sizeof(unsigned char*));
+    frame->degraded_frame = calloc(candidate_count, sizeof(unsigned char*));
+    frame->scores = calloc(candidate_count, sizeof(struct scores));
+    if (frame->degraded_frame_buffer == NULL || frame->degraded_frame == NULL || frame->scores == NULL) {
       error_exit("Out of memory allocating frame buffers!");
     }
+    for (c = 0; c < candidate_count; c++) {
+      frame->degraded_frame_buffer[c] = y4m_frame_buffer(&degraded_inputs[c], worker->cpu >= 0);
+    }
+  }
+}
+
+
+// ffmpeg -i input.mp4 -pix_fmt yuv420p -f yuv4mpegpipe - | comparison_tool
+int main(int argc,char* argv[]){
+  int i, result_code;
+
+  parse_options(argc, argv);
+  candidate_count = argc - optind - 1;
+  results_open(stdout, output_format, candidate_count);
+  report = output_format == RESULTS_TEXT ? stdout : stderr;
+  if (stats_path != NULL) {
+    open_stats();
+  }
+
+  degraded_inputs = calloc(candidate_count, sizeof(struct y4m_input));
+  degraded_names = calloc(candidate_count, sizeof(char*));
+  sample_stats = calloc(candidate_count, sizeof(struct sample_stats));
+  if (degraded_inputs == NULL || degraded_names == NULL || sample_stats == NULL) {
+    error_exit("Out of memory allocating stream state!");
+  }
+
+  open_input(&reference_input, argv[optind], "reference file");
+  for (i = 0; i < candidate_count; i++) {
+    open_input(&degraded_inputs[i], argv[optind + 1 + i], "degraded file");
+    degraded_names[i] = malloc(32);
+    if (candidate_count == 1) {
+      strcpy(degraded_names[i], "degraded stream");
+    } else {
+      snprintf(degraded_names[i], 32, "degraded stream %d", i);
+    }
+  }
+
+  validate_headers(&reference_input, "reference stream");
+  for (i = 0; i < candidate_count; i++) {
+    validate_headers(&degraded_inputs[i], degraded_names[i]);
+  }
+  if (gate_metric >= 0) {
+    cancel_reads_on_gate();
+  }
+
+  frame_size = frame_format.frame_size;
+  resolve_time_range();
+  if (align_window > 0) {
+    allocate_alignments();
+  }
+  DEBUG1("Frame size: %ux%u C%s (%u bytes)", width, height, frame_format.chroma, frame_size);
+  DEBUG1("Threads: %d%s", thread_count, pin_threads ? " (pinned)" : "");
+  DEBUG1("Frames: from %lu, %lu max (0 = all)", start_frame, frame_limit);
+
+  workers = calloc(thread_count, sizeof(struct workerinfo));
+  frames_info = calloc(slot_count, sizeof(struct frameinfo));
+  if (workers == NULL || frames_info == NULL) {
+    error_exit("Out of memory allocating worker state!");
+  }
+  for (i = 0; i < thread_count; i++) {
+    allocate_worker(i);
+  }
+  if (pin_threads) {
+    unpin_thread(pthread_self());   // The reader and collector can run anywhere.
   }
 
   pthread_attr_t attr;
@@ -304,34 +1150,74 @@ int main(int argc,char* argv[]){
     error_exit("Error creating result collector thread: %d!", result_code);
   }
 
-  int valid_stream = 1;
-  int thread_number = 0;
+  // The workers live for the whole run and take frames from the queue as they're read.
+  for (i = 0; i < thread_count; i++) {
+    result_code = pthread_create(&workers[i].thread, &attr, analyze_frames, &workers[i]);
+    if (result_code) {
+      error_exit("Error creating thread: %d!", result_code);
+    }
+    if (workers[i].cpu >= 0) {
+      pin_thread_to_cpu(workers[i].thread, workers[i].cpu);
+    }
+  }
+
+  struct frameinfo* frame;
+  unsigned long position = 0, sample, skipped;
+  double started = stats_now(), skip_time = 0, before;
 
-  while (valid_stream && !feof(reference_file) && !feof(degraded_file)) {   // && frame_count < 50) {
-    if (frames_info[thread_number].active == 1) {
-      usleep(100);
-    } else {
-      frames_info[thread_number].frame_number = frame_count;
-      result_code = read_frame_pair(reference_file, degraded_file, &frames_info[thread_number]);
-      if (result_code == 0) {
-        valid_stream = 0;
-        break;
-      } else {
-        result_code = pthread_create(&threads[thread_number], &attr, analyze_frame_pair, &frames_info[thread_number]);
-        if (result_code) {
-          error_exit("Error creating thread: %d!", result_code);
-        }
-      }
+  // 'position' counts the frames of the range passed so far, scored or not.
+  skip_to_start_frame();
+  if (gate_metric >= 0) {
+    gate.frames = frames_left();
+  }
+  while (frame_limit == 0 || position < frame_limit) {
+    sample = next_sample(position);
+    if (frame_limit != 0 && sample > frame_limit) sample = frame_limit;
+    if (sample > position) {
+      before = stats_now();
+      skipped = skip_frame_set(sample - position);
+      skip_time += stats_now() - before;
+      position += skipped;
+      if (position < sample) break;   // End of the input.
+      continue;
+    }
 
-      frame_count++;
-      thread_number = frame_count % THREAD_COUNT;
+    frame = wait_for_free_slot();
+    if (frame == NULL) break;
+    frame->frame_number = start_frame + position;
+    if (read_frame_set(frame) == 0) {
+      break;
     }
+    position++;
+    queue_frame();
   }
 
-  all_frames_read = 1;
+  finish_reading();
 
   // printf("Finished reading frames!\n");
 
-  pthread_exit(NULL);
+  for (i = 0; i < thread_count; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  pthread_join(collect_results_thread, NULL);
+  results_close();
+
+  if (sample_mode != SAMPLE_ALL) {
+    print_sample_summary(position, stats_now() - started, skip_time);
+  }
+  free(skip_buffer);
+
+  // Closing a piped input lets the decoder feeding it exit, which matters when the gate
+  // stops early.
+  y4m_close(&reference_input);
+  for (i = 0; i < candidate_count; i++) {
+    y4m_close(&degraded_inputs[i]);
+  }
+
+  if (gate_metric >= 0) {
+    finish_gate();
+    fprintf(report, "Gate: %s - %s\n", gate.result > 0 ? "PASS" : "FAIL", gate.reason);
+    return gate.result > 0 ? 0 : GATE_FAIL_EXIT;
+  }
   return 0;
 }
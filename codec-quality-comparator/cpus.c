@@ -0,0 +1,81 @@
+#define _GNU_SOURCE
+#include "cpus.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sched.h>
+
+static cpu_set_t initial_cpus;
+static int have_initial_cpus = -1;   // -1 until the mask has been read
+
+static int read_initial_cpus() {
+  if (have_initial_cpus < 0) {
+    CPU_ZERO(&initial_cpus);
+    have_initial_cpus = (sched_getaffinity(0, sizeof(initial_cpus), &initial_cpus) == 0 && CPU_COUNT(&initial_cpus) > 0);
+  }
+  return have_initial_cpus;
+}
+
+// CPUs' worth of quota from cgroup v2 (cpu.max) or v1 (cfs_quota_us/cfs_period_us), or 0 if unlimited/unknown.
+static int cgroup_cpu_limit() {
+  FILE* file;
+  long long quota = -1, period = 0;
+  char buf[64];
+
+  if ((file = fopen("/sys/fs/cgroup/cpu.max", "r")) != NULL) {
+    if (fscanf(file, "%63s %lld", buf, &period) == 2 && sscanf(buf, "%lld", &quota) != 1) {
+      quota = -1;   // "max"
+    }
+    fclose(file);
+  } else if ((file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r")) != NULL) {
+    if (fscanf(file, "%lld", &quota) != 1) quota = -1;
+    fclose(file);
+    if ((file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r")) != NULL) {
+      if (fscanf(file, "%lld", &period) != 1) period = 0;
+      fclose(file);
+    }
+  }
+
+  if (quota <= 0 || period <= 0) return 0;
+  return (int)((quota + period - 1) / period);   // A partial CPU still deserves a thread.
+}
+
+int available_cpu_count() {
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  int count = online > 0 ? (int)online : 1;
+  int limit;
+
+  if (read_initial_cpus() && CPU_COUNT(&initial_cpus) < count) {
+    count = CPU_COUNT(&initial_cpus);
+  }
+  limit = cgroup_cpu_limit();
+  if (limit > 0 && limit < count) {
+    count = limit;
+  }
+  return count > 0 ? count : 1;
+}
+
+int nth_allowed_cpu(int index) {
+  int cpu, seen = 0, total;
+
+  if (!read_initial_cpus()) return -1;
+  total = CPU_COUNT(&initial_cpus);
+  index %= total;
+  for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &initial_cpus) && seen++ == index) return cpu;
+  }
+  return -1;
+}
+
+int pin_thread_to_cpu(pthread_t thread, int cpu) {
+  cpu_set_t cpus;
+
+  if (cpu < 0 || cpu >= CPU_SETSIZE) return -1;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  return pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+}
+
+int unpin_thread(pthread_t thread) {
+  if (!read_initial_cpus()) return -1;
+  return pthread_setaffinity_np(thread, sizeof(initial_cpus), &initial_cpus);
+}
@@ -0,0 +1,23 @@
+#ifndef CPUS_H
+#define CPUS_H
+
+#include <pthread.h>
+
+// CPU discovery and thread pinning for the comparators' worker threads.
+
+// Number of CPUs this process can actually use: the online CPUs, limited by the
+// affinity mask it was started with (taskset, cpusets) and by any cgroup CPU quota
+// (containers). Always at least 1.
+int available_cpu_count();
+
+// The index'th CPU (wrapping around) in the affinity mask the process was started
+// with, or -1 if it can't be determined.
+int nth_allowed_cpu(int index);
+
+// Pins a thread to a single CPU. Returns 0 on success.
+int pin_thread_to_cpu(pthread_t thread, int cpu);
+
+// Lets a thread run on any CPU the process was started with again. Returns 0 on success.
+int unpin_thread(pthread_t thread);
+
+#endif
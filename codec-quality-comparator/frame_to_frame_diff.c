@@ -1,4 +1,8 @@
 #include "iqa.h"
+#include "cpus.h"
+#include "y4m.h"
+#include "stats.h"
+#include "results.h"
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
@@ -6,9 +10,11 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <getopt.h>
+#include <math.h>
 
 #define DO_MS_SSIM 0
-#define THREAD_COUNT 8
+#define PLANE_COUNT 3
 
 int DEBUG = 0;
 #define DEBUG1(fmt, ...) if (DEBUG >= 1) { printf("DEBUG1: "); printf(fmt, ##__VA_ARGS__); printf("\n"); }
@@ -17,266 +23,362 @@ int DEBUG = 0;
 #define HEADER_BUFFER_SIZE 256
 
 
-#if defined CLOCK_MONOTONIC_COARSE
-#define XCLOCK_MONOTONIC CLOCK_MONOTONIC_COARSE
-#else
-#define XCLOCK_MONOTONIC CLOCK_MONOTONIC
-#endif
+// A frame of the input, read once and shared by the tasks that compare it.
+struct ring_frame {
+  unsigned char* buffer;             // Storage, for a stream that isn't mapped
+  unsigned char* data;               // The frame: in the buffer, or in place in a mapped file
+  int refs;                          // The reader and the tasks holding it. Guarded by ring_lock.
+};
 
 struct frameinfo {
-  int active;
+  int active;                        // A task is running or waiting to print. Guarded by ring_lock.
+  int cpu;                           // CPU this slot's thread is pinned to, or -1
   unsigned long frame_number;
-  unsigned char* reference_frame_buffer;
-  unsigned char* degraded_frame_buffer;
-  float psnr_results[4];
-  float ssim_results[4];
-  float ms_ssim_results[4];
+  struct ring_frame* previous;       // Borrowed from the ring while the task runs
+  struct ring_frame* current;
+  unsigned char* reference_frame;    // Their data: the previous frame (or the current one, for
+  unsigned char* degraded_frame;     // the first frame) is compared with the current one
+  struct iqa_ssim_ws* ssim_ws[2];    // Luma and chroma sized, reused for every frame handled by this slot
+  struct iqa_ms_ssim_ws* ms_ssim_ws[2];
+  float psnr_results[PLANE_COUNT];   // Y, Cb, Cr
+  float ssim_results[PLANE_COUNT];
+  float ms_ssim_results[PLANE_COUNT];
 };
 
-pthread_t threads[THREAD_COUNT];
-struct frameinfo frames_info[THREAD_COUNT];
-
-FILE* reference_file;
-FILE* degraded_file;
-
+int thread_count = 0;                // Frame slots, each analyzed by its own thread. Defaults to the CPUs available to us.
+int pin_threads = 0;                 // Pin each slot's thread to a CPU, with the slot's workspaces in local memory
+const char* stats_path = NULL;       // --stats: where to dump the stage timing, or NULL for none
+int stats_output_format = STATS_JSON;
+int integer_ssim = 0;                // --integer-ssim: fixed-point SSIM, the same on every machine
+pthread_t* threads;
+struct frameinfo* frames_info;
+
+// Frame N is read once into the ring and compared in place by two tasks: as the current
+// frame of task N and as the previous frame of task N+1. Each task borrows both of its
+// frames, and the reader keeps its own hold on the latest frame until it has handed it to
+// the next task, so an entry is only refilled once nothing refers to it. The running
+// tasks hold at most thread_count + 1 consecutive frames, so with two more entries the
+// reader always has one to read into.
+#define RING_EXTRA 2
+struct ring_frame* ring;
+int ring_size;
+pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t ring_changed = PTHREAD_COND_INITIALIZER;  // Signalled when a frame or slot is freed, a task starts, or reading ends
+
+struct y4m_input reference_input;
+
+struct y4m_format frame_format;     // Plane layout, from the reference stream header
 unsigned int width = 0;
 unsigned int height = 0;
 unsigned int frame_size = 0;
 unsigned long frame_count = 0;
 int all_frames_read = 0;
 
-double timespec_to_double(struct timespec *the_time) {
-  double decimal_time = (double)(the_time->tv_sec);
-  decimal_time += (double)(the_time->tv_nsec) / 1e9;
-  return decimal_time;
-}
-
-double get_current_time() {
-  struct timespec now;
-  clock_gettime(XCLOCK_MONOTONIC, &now);
-  return timespec_to_double(&now);
-}
-
-void* analyze_frame_pair(void* thread_data) {
-  struct frameinfo *frame = (struct frameinfo*)thread_data;
-  double before,after;
-  unsigned char* ref_plane_buf;
-  unsigned char* deg_plane_buf;
-  float luma_result, chroma_cb_result, chroma_cr_result;
-
-  frame->active = 1;
-
-  chroma_cb_result = 0.0;
-  chroma_cr_result = 0.0;
-
-  ref_plane_buf = frame->reference_frame_buffer;
-  deg_plane_buf = frame->degraded_frame_buffer;
-  before = get_current_time();
-  luma_result =      iqa_psnr(ref_plane_buf, deg_plane_buf, width, height, width);
-  // ref_plane_buf += (width*height);
-  // deg_plane_buf += (width*height);
-  // chroma_cb_result = iqa_psnr(ref_plane_buf, deg_plane_buf, width, height, width);
-  // ref_plane_buf += (width*height);
-  // deg_plane_buf += (width*height);
-  // chroma_cr_result = iqa_psnr(ref_plane_buf, deg_plane_buf, width, height, width);
-  after = get_current_time();
-
-  frame->psnr_results[0] = luma_result;
-  frame->psnr_results[1] = chroma_cb_result;
-  frame->psnr_results[2] = chroma_cr_result;
-  frame->psnr_results[3] = after-before;
-
-  ref_plane_buf = frame->reference_frame_buffer;
-  deg_plane_buf = frame->degraded_frame_buffer;
-  before = get_current_time();
-  luma_result =      iqa_ssim(ref_plane_buf, deg_plane_buf, width, height, width, 0, 0);
-  // ref_plane_buf += (width*height);
-  // deg_plane_buf += (width*height);
-  // chroma_cb_result = iqa_ssim(ref_plane_buf, deg_plane_buf, width, height, width, 0, 0);
-  // ref_plane_buf += (width*height);
-  // deg_plane_buf += (width*height);
-  // chroma_cr_result = iqa_ssim(ref_plane_buf, deg_plane_buf, width, height, width, 0, 0);
-  after = get_current_time();
-
-  frame->ssim_results[0] = luma_result;
-  frame->ssim_results[1] = chroma_cb_result;
-  frame->ssim_results[2] = chroma_cr_result;
-  frame->ssim_results[3] = after-before;
+// Scores one plane of a frame pair, in place in the frame buffers.
+void analyze_plane(struct frameinfo *frame, int plane) {
+  double before;
+  struct iqa_ssim_timing timing;
+  unsigned char* ref_plane_buf = frame->reference_frame + frame_format.plane_offset[plane];
+  unsigned char* deg_plane_buf = frame->degraded_frame + frame_format.plane_offset[plane];
+  unsigned int plane_width = frame_format.plane_width[plane];
+  unsigned int plane_height = frame_format.plane_height[plane];
+  int ws = plane ? 1 : 0;
+
+  before = stats_now();
+  frame->psnr_results[plane] = iqa_psnr(ref_plane_buf, deg_plane_buf, plane_width, plane_height, plane_width);
+  stats_record(STAGE_PSNR, stats_now() - before);
+
+  frame->ssim_results[plane] = iqa_ssim_ws_run(frame->ssim_ws[ws], ref_plane_buf, deg_plane_buf, plane_width);
+  if (stats_enabled) {
+    iqa_ssim_ws_take_timing(frame->ssim_ws[ws], &timing);
+    stats_record(STAGE_CONVERT, timing.convert);
+    stats_record(STAGE_FILTER, timing.filter);
+    stats_record(STAGE_COMBINE, timing.combine);
+  }
 
   if (DO_MS_SSIM) {
-    ref_plane_buf = frame->reference_frame_buffer;
-    deg_plane_buf = frame->degraded_frame_buffer;
-    before = get_current_time();
-    luma_result =      iqa_ms_ssim(ref_plane_buf, deg_plane_buf, width, height, width, 0);
-    // ref_plane_buf += (width*height);
-    // deg_plane_buf += (width*height);
-    // chroma_cb_result = iqa_ms_ssim(ref_plane_buf, deg_plane_buf, width, height, width, 0);
-    // ref_plane_buf += (width*height);
-    // deg_plane_buf += (width*height);
-    // chroma_cr_result = iqa_ms_ssim(ref_plane_buf, deg_plane_buf, width, height, width, 0);
-    after = get_current_time();
+    frame->ms_ssim_results[plane] = iqa_ms_ssim_ws_run(frame->ms_ssim_ws[ws], ref_plane_buf, deg_plane_buf, plane_width);
+  } else {
+    frame->ms_ssim_results[plane] = frame->ssim_results[plane];
   }
-
-  frame->ms_ssim_results[0] = luma_result;
-  frame->ms_ssim_results[1] = chroma_cb_result;
-  frame->ms_ssim_results[2] = chroma_cr_result;
-  frame->ms_ssim_results[3] = after-before;
-
-  pthread_exit(thread_data);
 }
 
-void validate_headers(FILE* stream, char* stream_name) {
-  char buf[HEADER_BUFFER_SIZE];
-  char* tag;
-  unsigned int stream_width;
-  unsigned int stream_height;
+// Takes another hold on a frame.
+void borrow_frame(struct ring_frame* entry) {
+  pthread_mutex_lock(&ring_lock);
+  entry->refs++;
+  pthread_mutex_unlock(&ring_lock);
+}
 
-  // Running on the assumption that a STREAM or FRAME header line is never more than BUFFER_SIZE long.
-  //   -- generally safe, especially with controlled streams, but not literally guaranteed.
-  if (fgets(buf, HEADER_BUFFER_SIZE, stream) != NULL) {
-    // printf("Header line: %s", buf);
+// Gives up a hold on a frame, and frees its entry for reading if it was the last.
+void release_frame(struct ring_frame* entry) {
+  pthread_mutex_lock(&ring_lock);
+  if (--entry->refs == 0) {
+    pthread_cond_broadcast(&ring_changed);
+  }
+  pthread_mutex_unlock(&ring_lock);
+}
 
-    if (strstr(buf, "YUV4MPEG2") != buf) {
-      error_exit("Unsupported file: %s is not YUV4MPEG formatted!", stream_name);
-    }
+// Waits for a ring entry nothing refers to, and takes the reader's hold on it.
+struct ring_frame* acquire_free_frame() {
+  struct ring_frame* entry = NULL;
+  double before = stats_now();
+  int i;
 
-    if (strstr(buf, "C444 ") == NULL) { // Note: 10-bit would be C444p10, for example.
-      error_exit("Unsupported file: %s must be in 8-bit 4:4:4 format!", stream_name);
+  pthread_mutex_lock(&ring_lock);
+  while (entry == NULL) {
+    for (i = 0; i < ring_size && entry == NULL; i++) {
+      if (ring[i].refs == 0) entry = &ring[i];
     }
-
-    if ((tag = strstr(buf, " W")) != NULL) {
-      sscanf(tag + 2, "%u", &stream_width);
-      if (stream_width == 0) {
-        error_exit("Couldn't determine %s frame width!", stream_name);
-      }
-    } else {
-      error_exit("Couldn't determine %s frame width!", stream_name);
+    if (entry == NULL) {
+      pthread_cond_wait(&ring_changed, &ring_lock);
     }
+  }
+  entry->refs = 1;
+  pthread_mutex_unlock(&ring_lock);
+  stats_record(STAGE_BLOCKED, stats_now() - before);
+  return entry;
+}
 
-    if ((tag = strstr(buf, " H")) != NULL) {
-      sscanf(tag + 2, "%u", &stream_height);
-      if (stream_height == 0) {
-        error_exit("Couldn't determine %s frame height!", stream_name);
-      }
-    } else {
-      error_exit("Couldn't determine %s frame height!", stream_name);
-    }
+// Frame thread. Frames already run in parallel, so the planes are scored one after another.
+void* analyze_frame_pair(void* thread_data) {
+  struct frameinfo *frame = (struct frameinfo*)thread_data;
+  int plane;
 
-  } else {
-    error_exit("No %s input!", stream_name);
+  for (plane = 0; plane < PLANE_COUNT; plane++) {
+    analyze_plane(frame, plane);
   }
+  release_frame(frame->previous);
+  release_frame(frame->current);
 
-  // Make sure we read the whole header before we go on.
-  while (!feof(stream) && !strchr(buf, '\n')) {
-    if (fgets(buf, HEADER_BUFFER_SIZE, stream) == NULL) {
-      error_exit("Invalid %s input - no newline after header.", stream_name);
-    }
-  }
-  if (feof(reference_file)) {
-    error_exit("Invalid %s input - no newline after header.", stream_name);
+  pthread_exit(thread_data);
+}
+
+void validate_headers(struct y4m_input* input, char* stream_name) {
+  struct y4m_format stream_format;
+  const char* problem;
+  double before = stats_now();
+
+  problem = y4m_read_header(input);
+  stats_record(STAGE_HEADER, stats_now() - before);
+  if (problem != NULL) {
+    error_exit("Unsupported or invalid file: %s - %s!", stream_name, problem);
   }
+  stream_format = input->format;
 
-  if (stream_width < 32 || stream_height < 32) {
+  if (stream_format.width < 32 || stream_format.height < 32) {
     error_exit("Invalid dimensions -- %s width and height must both be 16 or greater.", stream_name);
   }
 
   if (width == 0) {
     // First stream we're checking - just set the reference values.
-    width = stream_width;
-    height = stream_height;
+    frame_format = stream_format;
+    width = stream_format.width;
+    height = stream_format.height;
   } else {
     // All other streams -- compare to reference values.
-    if (stream_width != width || stream_height != height) {
+    if (!y4m_same_layout(&stream_format, &frame_format)) {
       error_exit("Dimensions for %s do not match reference stream!", stream_name);
     }
   }
 }
 
-void read_frame_header(FILE* file, char* stream_name) {
-  char buf[HEADER_BUFFER_SIZE];
-  if (fgets(buf, HEADER_BUFFER_SIZE, file) != NULL) {
-    if (strstr(buf, "FRAME") != buf) {
-      error_exit("Frame header not found in %s!", stream_name);
-    } else if (!strchr(buf, '\n')) {
-      error_exit("Frame header in %s too long - aborting!", stream_name);
+int read_next_frame(struct y4m_input* input, struct ring_frame* entry) {
+  return y4m_read_stream_frame(input, "reference stream", stdout, entry->buffer, &entry->data);
+}
+
+void* collect_results(void* t) {
+  unsigned long frame_number = 0;
+  int thread_number = 0;
+  void* status;
+  int result_code, active;
+  struct frameinfo* frame;
+  double before;
+
+  for (;;) {
+    // Slots are filled in frame order, so once reading has ended the next one in turn is
+    // either active or there are no frames left.
+    pthread_mutex_lock(&ring_lock);
+    while (!frames_info[thread_number].active && !all_frames_read) {
+      pthread_cond_wait(&ring_changed, &ring_lock);
     }
+    active = frames_info[thread_number].active;
+    pthread_mutex_unlock(&ring_lock);
+    if (!active) break;
+
+    result_code = pthread_join(threads[thread_number], &status);
+
+    frame = &frames_info[thread_number];
+    before = stats_now();
+    printf("Frame %lu PSNR:    luma = %8.5f, chroma_cb = %8.5f, chroma_cr = %8.5f, yuv = %8.5f\n", frame->frame_number, frame->psnr_results[0], frame->psnr_results[1], frame->psnr_results[2], weighted_psnr_yuv(frame->psnr_results));
+    printf("Frame %lu SSIM:    luma = %8.5f, chroma_cb = %8.5f, chroma_cr = %8.5f, yuv = %8.5f\n", frame->frame_number, frame->ssim_results[0], frame->ssim_results[1], frame->ssim_results[2], weighted_yuv(frame->ssim_results));
+    printf("Frame %lu MS-SSIM: luma = %8.5f, chroma_cb = %8.5f, chroma_cr = %8.5f, yuv = %8.5f\n", frame->frame_number, frame->ms_ssim_results[0], frame->ms_ssim_results[1], frame->ms_ssim_results[2], weighted_yuv(frame->ms_ssim_results));
+    stats_record(STAGE_OUTPUT, stats_now() - before);
+
+    pthread_mutex_lock(&ring_lock);
+    frame->active = 0;
+    pthread_cond_broadcast(&ring_changed);
+    pthread_mutex_unlock(&ring_lock);
+
+    frame_number++;
+    thread_number = frame_number % thread_count;
   }
+
+  pthread_exit(t);
 }
 
-int read_next_frame(FILE* ref_file, struct frameinfo* frame) {
-  unsigned int bytes_read;
 
-  read_frame_header(ref_file, "reference stream");
+void usage(char* program) {
+  fprintf(stderr, "Usage: %s [options] <reference_file.y4m>\n", program);
+  fprintf(stderr, "  -t, --threads <n>  Worker threads (default: CPUs available, %d here)\n", available_cpu_count());
+  fprintf(stderr, "  -p, --pin          Pin each worker to a CPU and keep its SSIM workspaces in local memory\n");
+  fprintf(stderr, "      --stats <file> Dump per-stage timing histograms to file ('-' for stderr) at exit and on SIGUSR1\n");
+  fprintf(stderr, "      --stats-format <f>\n");
+  fprintf(stderr, "                     Timing dumps as json (default) or csv\n");
+  fprintf(stderr, "      --integer-ssim Fixed-point SSIM: identical on every machine and thread count, a little\n");
+  fprintf(stderr, "                     different from the default floating point scores\n");
+  exit(1);
+}
 
-  bytes_read = fread(frame->degraded_frame_buffer, 1, frame_size, ref_file);
-  if (bytes_read < frame_size) {
-    // All done.
-    if (bytes_read > 0) printf("Warning: Final frame of reference stream was incomplete.\n");
-    return 0;
+void parse_options(int argc, char* argv[]) {
+  enum { STATS = 256, STATS_FORMAT, INTEGER_SSIM };
+  static struct option options[] = {
+    { "threads", required_argument, NULL, 't' },
+    { "pin",     no_argument,       NULL, 'p' },
+    { "stats",   required_argument, NULL, STATS },
+    { "stats-format", required_argument, NULL, STATS_FORMAT },
+    { "integer-ssim", no_argument,       NULL, INTEGER_SSIM },
+    { "help",    no_argument,       NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+  int option;
+
+  while ((option = getopt_long(argc, argv, "t:ph", options, NULL)) != -1) {
+    switch (option) {
+      case 't':
+        thread_count = atoi(optarg);
+        if (thread_count < 1) {
+          error_exit("Thread count must be at least 1!");
+        }
+        break;
+      case 'p':
+        pin_threads = 1;
+        break;
+      case STATS:
+        stats_path = optarg;
+        break;
+      case STATS_FORMAT:
+        stats_output_format = stats_format(optarg);
+        if (stats_output_format < 0) {
+          error_exit("Unknown stats format: %s", optarg);
+        }
+        break;
+      case INTEGER_SSIM:
+        integer_ssim = 1;
+        break;
+      default:
+        usage(argv[0]);
+    }
   }
 
-  return 1;
+  if (argc - optind != 1) {
+    usage(argv[0]);
+  }
+
+  if (thread_count == 0) {
+    thread_count = available_cpu_count();
+  }
 }
 
-void* collect_results(void* t) {
-  unsigned long frame_number = 0;
-  int thread_number = 0;
-  void* status;
-  int result_code;
-  struct frameinfo* frame;
+// Opens the --stats file and starts timing, before any thread starts.
+void open_stats() {
+  FILE* out = stderr;
+
+  if (strcmp(stats_path, "-") != 0) {
+    out = fopen(stats_path, "w");
+    if (out == NULL) {
+      fprintf(stderr, "ERROR: Could not open stats file: %s\n", stats_path);
+      exit(2);
+    }
+  }
+  stats_open(out, stats_output_format);
+}
 
-  while (frame_number < frame_count || !all_frames_read) {
-    if (frames_info[thread_number].active == 1) {
-      result_code = pthread_join(threads[thread_number], &status);
+// Sets up the frame ring. Each frame is read by one thread and used by two, so the
+// buffers aren't placed on any particular NUMA node.
+void allocate_ring() {
+  int i;
 
-      frame = &frames_info[thread_number];
-      // printf("Frame %lu PSNR (%04dms):    luma = %7.5f, chroma_cb = %7.5f, chroma_cr = %7.5f\n", frame->frame_number, (int)(frame->psnr_results[3] * 1000), frame->psnr_results[0], frame->psnr_results[1], frame->psnr_results[2]);
-      // printf("Frame %lu SSIM (%04dms):    luma = %7.5f, chroma_cb = %7.5f, chroma_cr = %7.5f\n", frame->frame_number, (int)(frame->ssim_results[3] * 1000), frame->ssim_results[0], frame->ssim_results[1], frame->ssim_results[2]);
-      // printf("Frame %lu MS-SSIM (%04dms): luma = %7.5f, chroma_cb = %7.5f, chroma_cr = %7.5f\n", frame->frame_number, (int)(frame->ms_ssim_results[3] * 1000), frame->ms_ssim_results[0], frame->ms_ssim_results[1], frame->ms_ssim_results[2]);
-      printf("Frame %lu PSNR:    luma = %8.5f, chroma_cb = %8.5f, chroma_cr = %8.5f\n", frame->frame_number, frame->psnr_results[0], frame->psnr_results[1], frame->psnr_results[2]);
-      printf("Frame %lu SSIM:    luma = %8.5f, chroma_cb = %8.5f, chroma_cr = %8.5f\n", frame->frame_number, frame->ssim_results[0], frame->ssim_results[1], frame->ssim_results[2]);
-      printf("Frame %lu MS-SSIM: luma = %8.5f, chroma_cb = %8.5f, chroma_cr = %8.5f\n", frame->frame_number, frame->ms_ssim_results[0], frame->ms_ssim_results[1], frame->ms_ssim_results[2]);      
+  ring_size = thread_count + RING_EXTRA;
+  ring = calloc(ring_size, sizeof(struct ring_frame));
+  if (ring == NULL) {
+    error_exit("Out of memory allocating frame buffers!");
+  }
+  for (i = 0; i < ring_size; i++) {
+    ring[i].buffer = y4m_frame_buffer(&reference_input, 0);
+  }
+}
 
-      frame->active = 0;
+// Sets up frame slot i. With pinning the allocating thread runs on the CPU that will
+// analyze the slot, so the kernel's first-touch policy puts its SSIM workspaces on that
+// CPU's NUMA node.
+void allocate_slot(int i) {
+  struct frameinfo* frame = &frames_info[i];
+  int ws;
+
+  frame->active = 0;
+  frame->cpu = pin_threads ? nth_allowed_cpu(i) : -1;
+  if (frame->cpu >= 0) {
+    pin_thread_to_cpu(pthread_self(), frame->cpu);
+  }
 
-      frame_number++;
-      thread_number = frame_number % THREAD_COUNT;
-    } else {
-      usleep(100);
+  for (ws = 0; ws < 2; ws++) {
+    // Plane 1 has the chroma size.
+    frame->ssim_ws[ws] = iqa_ssim_ws_create(frame_format.plane_width[ws], frame_format.plane_height[ws], 0, 0);
+    frame->ms_ssim_ws[ws] = DO_MS_SSIM ? iqa_ms_ssim_ws_create(frame_format.plane_width[ws], frame_format.plane_height[ws], 0) : NULL;
+    if (frame->ssim_ws[ws] == NULL || (DO_MS_SSIM && frame->ms_ssim_ws[ws] == NULL)) {
+      error_exit("Out of memory allocating SSIM workspaces!");
+    }
+    iqa_ssim_ws_set_timing(frame->ssim_ws[ws], stats_enabled);
+    if (integer_ssim && !iqa_ssim_ws_set_integer(frame->ssim_ws[ws], 1)) {
+      error_exit("Fixed-point SSIM isn't available for %ux%u planes!", frame_format.plane_width[ws], frame_format.plane_height[ws]);
     }
   }
-
-  pthread_exit(t);
 }
 
 
-// ffmpeg -i input.mp4 -pix_fmt yuv444p -f yuv4mpegpipe - | comparison_tool
+// ffmpeg -i input.mp4 -pix_fmt yuv420p -f yuv4mpegpipe - | comparison_tool
 int main(int argc,char* argv[]){
   int i, result_code;
 
-  if ((argc != 2)) {
-    fprintf(stderr, "Usage: %s <reference_file.y4m>\n", argv[0]);
-    exit(1);
+  parse_options(argc, argv);
+  if (stats_path != NULL) {
+    open_stats();
   }
 
-  reference_file = fopen(argv[1], "r");
-  if (reference_file < 0) {
-    fprintf(stderr, "ERROR: Could not open reference file: %s\n", argv[1]);
+  // A regular file is mapped and its frames used in place; fifos and pipes are read into the slots.
+  if (y4m_open(&reference_input, argv[optind]) != 0) {
+    fprintf(stderr, "ERROR: Could not open reference file: %s\n", argv[optind]);
     exit(2);
   }
 
-  validate_headers(reference_file, "reference stream");
+  validate_headers(&reference_input, "reference stream");
 
-  frame_size = (unsigned int)(3 * width * height);
-  DEBUG1("Frame size: %ux%u (%u bytes)", width, height, frame_size);
+  frame_size = frame_format.frame_size;
+  DEBUG1("Frame size: %ux%u C%s (%u bytes)", width, height, frame_format.chroma, frame_size);
+  DEBUG1("Threads: %d%s", thread_count, pin_threads ? " (pinned)" : "");
 
-  for (i = 0; i < THREAD_COUNT; i++) {
-    frames_info[i].active = 0;
-    frames_info[i].reference_frame_buffer = malloc(frame_size);
-    frames_info[i].degraded_frame_buffer = malloc(frame_size);
-    if (frames_info[i].reference_frame_buffer == NULL || frames_info[i].degraded_frame_buffer == NULL) {
-      error_exit("Out of memory allocating frame buffers!");
-    }
+  threads = calloc(thread_count, sizeof(pthread_t));
+  frames_info = calloc(thread_count, sizeof(struct frameinfo));
+  if (threads == NULL || frames_info == NULL) {
+    error_exit("Out of memory allocating worker state!");
+  }
+  allocate_ring();
+  for (i = 0; i < thread_count; i++) {
+    allocate_slot(i);
+  }
+  if (pin_threads) {
+    unpin_thread(pthread_self());   // The reader and collector can run anywhere.
   }
 
   pthread_attr_t attr;
@@ -289,41 +391,68 @@ int main(int argc,char* argv[]){
     error_exit("Error creating result collector thread: %d!", result_code);
   }
 
-  int valid_stream = 1;
   int thread_number = 0;
-  unsigned char* prev_frame_buffer = NULL;
-
-  while (valid_stream && !feof(reference_file)) {   // && frame_count < 50) {
-    if (frames_info[thread_number].active == 1) {
-      usleep(100);
-    } else {
-      frames_info[thread_number].frame_number = frame_count;
-      result_code = read_next_frame(reference_file, &frames_info[thread_number]);
-      if (result_code == 0) {
-        valid_stream = 0;
-        break;
-      }
+  struct ring_frame* previous = NULL;
+  struct ring_frame* current;
+  struct frameinfo* frame;
 
-      // For the first frame, we just compare to itself.
-      if (prev_frame_buffer == NULL) prev_frame_buffer = frames_info[thread_number].degraded_frame_buffer;
+  for (;;) {
+    frame = &frames_info[thread_number];
+    pthread_mutex_lock(&ring_lock);
+    while (frame->active) {
+      pthread_cond_wait(&ring_changed, &ring_lock);
+    }
+    pthread_mutex_unlock(&ring_lock);
 
-      memcpy(frames_info[thread_number].reference_frame_buffer, prev_frame_buffer, frame_size);
-      prev_frame_buffer = frames_info[thread_number].degraded_frame_buffer;
+    current = acquire_free_frame();
+    if (read_next_frame(&reference_input, current) == 0) {
+      release_frame(current);
+      break;
+    }
 
-      result_code = pthread_create(&threads[thread_number], &attr, analyze_frame_pair, &frames_info[thread_number]);
-      if (result_code) {
-        error_exit("Error creating thread: %d!", result_code);
-      }
+    // For the first frame, we just compare to itself. The task borrows both frames; the
+    // reader's hold on the previous one is no longer needed, and it keeps one on this one.
+    frame->frame_number = frame_count;
+    frame->previous = previous != NULL ? previous : current;
+    frame->current = current;
+    borrow_frame(frame->previous);
+    borrow_frame(frame->current);
+    if (previous != NULL) {
+      release_frame(previous);
+    }
+    previous = current;
+    frame->reference_frame = frame->previous->data;
+    frame->degraded_frame = frame->current->data;
 
-      frame_count++;
-      thread_number = frame_count % THREAD_COUNT;
+    result_code = pthread_create(&threads[thread_number], &attr, analyze_frame_pair, frame);
+    if (result_code) {
+      error_exit("Error creating thread: %d!", result_code);
     }
+    if (frame->cpu >= 0) {
+      pin_thread_to_cpu(threads[thread_number], frame->cpu);
+    }
+    // Only now is the thread there for the collector to join.
+    pthread_mutex_lock(&ring_lock);
+    frame->active = 1;
+    pthread_cond_broadcast(&ring_changed);
+    pthread_mutex_unlock(&ring_lock);
+
+    frame_count++;
+    thread_number = frame_count % thread_count;
+  }
+  if (previous != NULL) {
+    release_frame(previous);
   }
 
+  pthread_mutex_lock(&ring_lock);
   all_frames_read = 1;
+  pthread_cond_broadcast(&ring_changed);
+  pthread_mutex_unlock(&ring_lock);
 
   // printf("Finished reading frames!\n");
 
-  pthread_exit(NULL);
+  // Returning (rather than exiting the thread) ends the process, --stats' dumping thread
+  // included, and dumps the timing, so wait for the results first.
+  pthread_join(collect_results_thread, NULL);
   return 0;
 }
@@ -45,6 +45,11 @@
  * @li Type `make test` (or `make test RELEASE=1`) to build the unit tests.
  * @li Type `make clean` (or `make clean RELEASE=1`) to delete all build artifacts.
  * @li To run the tests, `cd` to the build/&lt;configuration&gt; directory and type `./test`.
+ * @li `./test accuracy [cases]` runs only the accuracy harness, with 200 random cases by default and every BMP fixture. It compares each SIMD level against a plain reference implementation and prints the largest deviation of each kernel against its tolerance. Run it before turning on a new fast path.
+ * @li Type `make bench` to build the throughput benchmark, and run `./bench` from the same directory. It times the metrics, convolution and decimation on 480p to 4320p planes and reports ns/pixel, MPix/s, GB/s and SSIM thread scaling. `./bench --csv base.csv` saves the results; a later `./bench --baseline base.csv` flags anything slower by more than `--tolerance` percent and exits with 1. `./bench --help` lists the options.
+ *
+ * @section simd SIMD
+ * On x86 with GCC or Clang the convolution, MSE and SSIM inner loops have SSE4.1, AVX2 and AVX-512 versions. The best one the CPU supports is picked when the library loads; everything else falls back to plain C. Set the environment variable IQA_SIMD to 'scalar', 'sse4', 'avx2' or 'avx512' to cap the level (e.g. `IQA_SIMD=scalar ./test`); any other value warns and uses plain C. All levels produce the same convolution results; the SSIM sum may differ in the last bits of a double.
  *
  * @code
  * > make clean
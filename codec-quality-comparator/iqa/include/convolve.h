@@ -52,6 +52,8 @@ struct _kernel {
     int normalized;         /**< 1 if the kernel values add up to 1. 0 otherwise */
     _iqa_get_pixel bnd_opt; /**< Defines how out-of-bounds image values are handled */
     float bnd_const;        /**< If 'bnd_opt' is KBND_CONSTANT, this specifies the out-of-bounds value */
+    float *kernel_h;        /**< Optional. Horizontal 1-D factor of a separable kernel (w values). 0 if not separable */
+    float *kernel_v;        /**< Optional. Vertical 1-D factor of a separable kernel (h values). 0 if not separable */
 };
 
 /**
@@ -60,6 +62,11 @@ struct _kernel {
  * the image. The resulting image will be smaller by half the kernel width 
  * and height (w - kw/2 and h - kh/2).
  *
+ * If the kernel carries a 1-D decomposition ('kernel_h' and 'kernel_v'), the
+ * convolution is done as a horizontal pass followed by a vertical pass
+ * (kw+kh taps per pixel instead of kw*kh). 'kernel' must still hold the full
+ * 2-D kernel, which is used if the temporary buffer can't be allocated.
+ *
  * @param img Image to modify
  * @param w Image width
  * @param h Image height
@@ -108,6 +108,126 @@ float iqa_psnr(const unsigned char *ref, const unsigned char *cmp, int w, int h,
 float iqa_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride, 
     int gaussian, const struct iqa_ssim_args *args);
 
+/**
+ * Reusable SSIM state for a fixed image size and configuration. Holds all the
+ * working buffers (64-byte aligned, allocated up front), so scoring a stream
+ * of frames doesn't allocate per frame. A workspace may only be used by one
+ * thread at a time; create one per thread.
+ */
+struct iqa_ssim_ws;
+
+/**
+ * Creates an SSIM workspace. The parameters have the same meaning as for
+ * iqa_ssim(). 'args' is copied.
+ * @return The workspace, or 0 if out of memory.
+ */
+struct iqa_ssim_ws *iqa_ssim_ws_create(int w, int h, int gaussian, const struct iqa_ssim_args *args);
+
+/**
+ * Calculates SSIM using a workspace. Gives the same result as iqa_ssim()
+ * with the parameters the workspace was created with.
+ * @param ws Workspace from iqa_ssim_ws_create()
+ * @param ref Original reference image
+ * @param cmp Distorted image
+ * @param stride The length (in bytes) of each horizontal line in the image.
+ * @return The mean SSIM over the entire image (MSSIM), or INFINITY if error.
+ */
+float iqa_ssim_ws_run(struct iqa_ssim_ws *ws, const unsigned char *ref, const unsigned char *cmp, int stride);
+
+/**
+ * Splits each frame into horizontal tiles scored in parallel by 'threads'
+ * threads (the thread calling iqa_ssim_ws_run() is one of them). Lowers the
+ * latency of a single frame. Each tile reads the extra rows its window needs
+ * from the source images, and the per-row sums are added in order, so the
+ * result is identical to the serial one. Only the default algorithm (no
+ * 'args') is split; other workspaces and WIN32 builds stay serial.
+ * @param ws Workspace from iqa_ssim_ws_create()
+ * @param threads Number of threads. 1 (or less) returns to serial operation.
+ * @return The number of threads that will be used.
+ */
+int iqa_ssim_ws_set_threads(struct iqa_ssim_ws *ws, int threads);
+
+/**
+ * Calculates SSIM of several distorted images against one reference. Gives
+ * the same results as calling iqa_ssim_ws_run() for each of them, but the
+ * reference is converted and its window statistics are computed only once.
+ * The buffers for each distorted image are allocated on the first call with
+ * that many (and kept), unless iqa_ssim_ws_reserve_multi() has already made
+ * room for them. Only the default algorithm, run serially, shares the
+ * reference; otherwise the images are scored one after the other.
+ * @param ws Workspace from iqa_ssim_ws_create()
+ * @param ref Original reference image
+ * @param cmp Array of 'n' distorted images
+ * @param n Number of distorted images
+ * @param stride The length (in bytes) of each horizontal line in the images.
+ * @param results Receives the mean SSIM of each distorted image (or INFINITY
+ * if error).
+ * @return 0 on success. Non-zero if out of memory.
+ */
+int iqa_ssim_ws_run_multi(struct iqa_ssim_ws *ws, const unsigned char *ref, const unsigned char *const *cmp, int n,
+    int stride, float *results);
+
+/**
+ * Allocates the buffers iqa_ssim_ws_run_multi() needs for up to 'n' distorted
+ * images now, rather than on its first call. It then can't run out of memory
+ * for that many, so a caller can report the failure before any scoring starts.
+ * @param ws Workspace from iqa_ssim_ws_create()
+ * @param n Number of distorted images
+ * @return 0 on success. Non-zero if out of memory.
+ */
+int iqa_ssim_ws_reserve_multi(struct iqa_ssim_ws *ws, int n);
+
+/**
+ * Switches a workspace to fixed-point arithmetic. The window sums are
+ * computed exactly, in 32- and 64-bit integers, straight from the 8-bit
+ * images, and only the final ratio of each window is computed in floating
+ * point, in a fixed order. The result is then the same at every SIMD level,
+ * with any number of threads, and on any host with IEEE doubles. It differs
+ * slightly from the floating-point result: the Gaussian window has integer
+ * weights (in 1024ths), and when scaling, the averaged pixels are rounded to
+ * 8 bits. Only the default algorithm (no 'args') has a fixed-point version,
+ * and iqa_ssim_ws_run_multi() scores the images one after the other. Off by
+ * default.
+ * @param ws Workspace from iqa_ssim_ws_create()
+ * @param enable 1 for fixed-point, 0 to return to floating point
+ * @return 1 if the workspace now uses fixed-point arithmetic. 0 if it was
+ * turned off, or can't be used ('args' were given, the images are smaller
+ * than the window or out of memory).
+ */
+int iqa_ssim_ws_set_integer(struct iqa_ssim_ws *ws, int enable);
+
+/**
+ * Seconds an SSIM workspace has spent in each stage. The stages are
+ * interleaved a row at a time, so they are timed per row. Tiles running in
+ * parallel (iqa_ssim_ws_set_threads()) add their times together.
+ */
+struct iqa_ssim_timing {
+    double convert;     /**< 8-bit to float conversion (and scaling) of the input rows */
+    double filter;      /**< Window convolution: the means, variances and covariance */
+    double combine;     /**< Combining the window statistics into SSIM values */
+};
+
+/**
+ * Turns stage timing of a workspace on or off. It is off by default, as
+ * timing every row costs a little. Clears the times.
+ * @param ws Workspace from iqa_ssim_ws_create()
+ * @param enable 1 to time the stages, 0 to stop
+ */
+void iqa_ssim_ws_set_timing(struct iqa_ssim_ws *ws, int enable);
+
+/**
+ * Reads the stage times accumulated since timing was turned on or last read,
+ * and clears them. All zero if timing is off.
+ * @param ws Workspace from iqa_ssim_ws_create()
+ * @param timing Receives the times
+ */
+void iqa_ssim_ws_take_timing(struct iqa_ssim_ws *ws, struct iqa_ssim_timing *timing);
+
+/**
+ * Releases an SSIM workspace. 0 is ignored.
+ */
+void iqa_ssim_ws_destroy(struct iqa_ssim_ws *ws);
+
 /**
  * Calculates the Multi-Scale Structural SIMilarity between 2 equal-sized 8-bit
  * images. The default algorithm is MS-SSIM* proposed by Rouse/Hemami 2008.
@@ -131,4 +251,34 @@ float iqa_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int h,
 float iqa_ms_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride, 
     const struct iqa_ms_ssim_args *args);
 
+/**
+ * Reusable MS-SSIM state for a fixed image size and configuration. Holds the
+ * scaled image pyramid and the SSIM working buffers (64-byte aligned,
+ * allocated up front). A workspace may only be used by one thread at a time.
+ */
+struct iqa_ms_ssim_ws;
+
+/**
+ * Creates an MS-SSIM workspace. The parameters have the same meaning as for
+ * iqa_ms_ssim(). 'args', including the exponent arrays, is copied.
+ * @return The workspace, or 0 if out of memory or the images are too small.
+ */
+struct iqa_ms_ssim_ws *iqa_ms_ssim_ws_create(int w, int h, const struct iqa_ms_ssim_args *args);
+
+/**
+ * Calculates MS-SSIM using a workspace. Gives the same result as
+ * iqa_ms_ssim() with the parameters the workspace was created with.
+ * @param ws Workspace from iqa_ms_ssim_ws_create()
+ * @param ref Original reference image
+ * @param cmp Distorted image
+ * @param stride The length (in bytes) of each horizontal line in the image.
+ * @return The mean MS-SSIM over the entire image, or INFINITY if error.
+ */
+float iqa_ms_ssim_ws_run(struct iqa_ms_ssim_ws *ws, const unsigned char *ref, const unsigned char *cmp, int stride);
+
+/**
+ * Releases an MS-SSIM workspace. 0 is ignored.
+ */
+void iqa_ms_ssim_ws_destroy(struct iqa_ms_ssim_ws *ws);
+
 #endif /*_IQA_H_*/
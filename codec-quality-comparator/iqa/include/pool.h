@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2026, The codec-quality-comparator authors
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the copyright holder nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+/*
+ * Minimal persistent worker pool for splitting one image among threads.
+ * The calling thread takes part in the work, so a pool of N threads starts
+ * N-1 workers. Built on pthreads; on WIN32 no pool is created and callers
+ * fall back to running everything on the calling thread.
+ */
+struct _iqa_pool;
+
+/* Task function. Called once per task index, from any pool thread. */
+typedef void (*_iqa_task)(void *ctx, int task);
+
+/**
+ * Starts a pool of 'threads' threads (including the caller).
+ * @return The pool, or 0 if 'threads' < 2, threading is unavailable or the
+ *         workers couldn't be started.
+ */
+struct _iqa_pool *_iqa_pool_create(int threads);
+
+/**
+ * Runs fn(ctx, 0) .. fn(ctx, tasks-1) on the pool and returns when all of
+ * them have finished. Only one thread may call this at a time.
+ */
+void _iqa_pool_run(struct _iqa_pool *p, _iqa_task fn, void *ctx, int tasks);
+
+/**
+ * Stops the workers and releases the pool. 0 is ignored.
+ */
+void _iqa_pool_destroy(struct _iqa_pool *p);
+
+#endif /*_POOL_H_*/
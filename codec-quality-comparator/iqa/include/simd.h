@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2026, The codec-quality-comparator authors
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the copyright holder nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+/** Instruction set levels, in increasing order of preference */
+#define IQA_SIMD_SCALAR 0
+#define IQA_SIMD_SSE4   1
+#define IQA_SIMD_AVX2   2
+#define IQA_SIMD_AVX512 3
+
+/* The x86 kernels rely on GCC/Clang function target attributes, so they're
+ * only built for those compilers. Other builds always use the scalar code. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IQA_SIMD_X86
+#endif
+
+/**
+ * Table of the inner loops that have vectorized implementations. Every
+ * implementation produces the same result as the scalar one: products are
+ * formed in the precision the scalar code uses and summed in double in the
+ * same order, so the metrics don't depend on the machine they run on. The
+ * only exceptions are 'ssim_row' and 'ssim_parts_row', which may reorder
+ * their (double) sums.
+ * The fixed-point kernels are exact integer arithmetic.
+ */
+struct _iqa_simd {
+    int level;          /**< IQA_SIMD_* level of this table */
+    const char *name;   /**< Printable name of the instruction set */
+
+    /**
+     * Horizontal 1-D convolution of a single row.
+     * dst[x] = SUM(src[x+u]*k[u]) for 0 <= x < n.
+     */
+    void (*conv_h)(const float *src, const float *k, int kw, double *dst, int n);
+
+    /**
+     * Vertical 1-D convolution producing a single row. 'src' points to the
+     * first of 'kh' rows, 'stride' elements apart.
+     * dst[x] = (float)(SUM(src[v*stride+x]*k[v]) * scale) for 0 <= x < n.
+     */
+    void (*conv_v)(const double *src, int stride, const float *k, int kh, float scale, float *dst, int n);
+
+    /**
+     * 2-D convolution producing a single row. 'src' points to the top-left
+     * pixel of the first kernel position in an image 'w' pixels wide.
+     * dst[x] = (float)(SUM(src[v*w+x+u]*k[v*kw+u]) * scale) for 0 <= x < n.
+     * 'dst' may alias 'src' as long as it doesn't start past 'src'.
+     */
+    void (*conv_2d)(const float *src, int w, const float *k, int kw, int kh, float scale, float *dst, int n);
+
+    /**
+     * Sum of squared differences of a single row of 8-bit pixels.
+     */
+    unsigned long long (*sse_row)(const unsigned char *ref, const unsigned char *cmp, int n);
+
+    /**
+     * Default SSIM combination of a single row of local statistics. Returns
+     * 'sum' plus the SSIM of the 'n' pixels.
+     */
+    double (*ssim_row)(const float *ref_mu, const float *cmp_mu, const float *ref_sigma_sqd,
+        const float *cmp_sigma_sqd, const float *sigma_both, int n, float C1, float C2, double sum);
+
+    /**
+     * SSIM luminance, contrast and structure terms of a single row of local
+     * statistics, as _iqa_ssim() computes them with exponents of 1 (negative
+     * variances count as 0). Adds SUM(l), SUM(c), SUM(s) and SUM(l*c*s) to
+     * sums[0..3]. Where a constant is 0 (MS-SSIM*), windows that make its
+     * term 0/0 count as a match.
+     */
+    void (*ssim_parts_row)(const float *ref_mu, const float *cmp_mu, const float *ref_sigma_sqd,
+        const float *cmp_sigma_sqd, const float *sigma_both, int n, float C1, float C2, float C3, double *sums);
+
+    /**
+     * Horizontal pass of fixed-point SSIM over a single row of 8-bit pixels,
+     * with integer weights adding up to at most 1024. Writes five rows,
+     * 'stride' ints apart, of the exact sums over x[i..i+kw-1]:
+     * SUM(k*ref), SUM(k*cmp), SUM(k*ref^2), SUM(k*cmp^2), SUM(k*ref*cmp)
+     * for 0 <= i < n. Each fits in 31 bits.
+     */
+    void (*fixed_h)(const unsigned char *ref, const unsigned char *cmp, const int *k, int kw, int *dst, int stride, int n);
+
+    /**
+     * Vertical pass of fixed-point SSIM. 'src' points to the first of 'kh'
+     * rows, 'stride' elements apart.
+     * dst[x] = SUM(src[v*stride+x]*k[v]), exactly, for 0 <= x < n.
+     */
+    void (*fixed_v)(const int *src, int stride, const int *k, int kh, long long *dst, int n);
+};
+
+/** Scalar implementations (always available) */
+extern const struct _iqa_simd _iqa_simd_scalar;
+#ifdef IQA_SIMD_X86
+/** x86 implementations */
+extern const struct _iqa_simd _iqa_simd_sse4;   /* SSE4.1 */
+extern const struct _iqa_simd _iqa_simd_avx2;   /* AVX2 */
+extern const struct _iqa_simd _iqa_simd_avx512; /* AVX-512 F+BW */
+#endif
+
+/**
+ * Returns the implementation table in use. On first use the best level the
+ * CPU (and compiler) supports is selected. The IQA_SIMD environment variable
+ * ("scalar", "sse4", "avx2" or "avx512") caps the selected level; any other
+ * value gives a warning on stderr and selects scalar.
+ */
+const struct _iqa_simd *_iqa_simd(void);
+
+/**
+ * Forces the implementation table to the highest supported level that does
+ * not exceed 'level'. Mostly useful for testing.
+ *
+ * @param level An IQA_SIMD_* level
+ * @return The level actually selected.
+ */
+int _iqa_simd_select(int level);
+
+#endif /*_SIMD_H_*/
@@ -56,6 +56,19 @@ static const float g_gaussian_window[GAUSSIAN_LEN][GAUSSIAN_LEN] = {
     {0.000001f, 0.000008f, 0.000037f, 0.000112f, 0.000219f, 0.000274f, 0.000219f, 0.000112f, 0.000037f, 0.000008f, 0.000001f},
 };
 
+/*
+ * 1-D factor of the Gaussian window above, for separable convolution.
+ * g_gaussian_window[y][x] ~= g_gaussian_1d[y] * g_gaussian_1d[x]
+ * Taken from the row sums of the 2-D window (rather than recomputed from
+ * sigma) and scaled so the outer product has the same sum as the rounded
+ * 2-D values. Otherwise the variance terms drift enough to show up in the
+ * 5th digit of SSIM.
+ */
+static const float g_gaussian_1d[GAUSSIAN_LEN] = {
+    0.001028001f, 0.007601008f, 0.036001034f, 0.109359100f, 0.213004217f, 0.266012281f,
+    0.213004217f, 0.109359100f, 0.036001034f, 0.007601008f, 0.001028001f
+};
+
 /*
  * Equal weight square window.
  * Each pixel is equally weighted (1/64) so that SUM(x) = 1.0
@@ -72,34 +85,138 @@ static const float g_square_window[SQUARE_LEN][SQUARE_LEN] = {
     {0.015625f, 0.015625f, 0.015625f, 0.015625f, 0.015625f, 0.015625f, 0.015625f, 0.015625f},
 };
 
-/* Holds intermediate SSIM values for map-reduce operation. */
+/*
+ * Integer 1-D windows for fixed-point SSIM (iqa_ssim_ws_set_integer()). The
+ * Gaussian weights are g_gaussian_1d in 1024ths, rounded, and add up to
+ * exactly 1024. The square window weighs every pixel 1.
+ */
+static const int g_gaussian_1d_fixed[GAUSSIAN_LEN] = {
+    1, 8, 37, 112, 218, 272, 218, 112, 37, 8, 1
+};
+static const int g_square_1d_fixed[SQUARE_LEN] = {
+    1, 1, 1, 1, 1, 1, 1, 1
+};
+
+/* Holds intermediate SSIM values for map-reduce operation: the terms of one
+ * pixel, or their sums over the image. */
 struct _ssim_int {
     double l;
     double c;
     double s;
+    double lcs;     /* SUM(l*c*s). Only set in sums. */
 };
 
 /* Defines the pointers to the map-reduce functions. */
 typedef int (*_map)(const struct _ssim_int *, void *);
 typedef float (*_reduce)(int, int, void *);
 
-/* Arguments for map-reduce. The 'context' is user-defined. */
+/*
+ * Arguments for map-reduce. The 'context' is user-defined, except that with
+ * no 'map' it must start with a struct _ssim_int: the terms are then summed
+ * into it without a call per pixel (through the vectorized ssim_parts_row()
+ * when the exponents are all 1) before 'reduce' is called.
+ */
 struct _map_reduce {
-    _map map;
+    _map map;       /* Optional. Called for every pixel. */
     _reduce reduce;
     void *context;
 };
 
+/*
+ * Row-by-row SSIM statistics.
+ *
+ * Produces the five local statistics of one output row at a time (the means,
+ * variances and covariance under the window), touching each input row only
+ * while the window covers it. How the window sums are formed depends on the
+ * kernel:
+ *  - box: running column sums of x, y, x^2, y^2 and x*y. The cost per pixel
+ *    doesn't depend on the window size.
+ *  - separable: each input row is filtered horizontally into a ring of kh
+ *    rows, and the vertical pass runs over the ring.
+ *  - anything else: a ring of kh rows of x^2, y^2 and x*y is convolved with
+ *    the 2-D kernel (the means come straight from the input).
+ * Rings hold every row twice (slots i and i+kh) so the kh rows under the
+ * window are always contiguous.
+ *
+ * The arithmetic is the same as running _iqa_convolve on full planes of x,
+ * y, x^2, y^2 and x*y, so results are unchanged.
+ *
+ * The buffers are allocated once for a given width and window (see
+ * _iqa_ssim_rows_alloc()) and can be reused for any number of images that
+ * are no wider.
+ */
+#define _SSIM_BOX       0
+#define _SSIM_SEPARABLE 1
+#define _SSIM_2D        2
+
+/*
+ * Statistics a set of row buffers computes, one bit per statistic (mu1, mu2,
+ * s1, s2, s12). Several distorted images can share one reference: a _SSIM_REF
+ * set computes mu1 and s1 once, and a _SSIM_CMP set per image ('lead' pointing
+ * at the _SSIM_REF one) computes the rest. Each statistic is computed exactly
+ * as in a _SSIM_ALL set.
+ */
+#define _SSIM_ALL 0x1f
+#define _SSIM_REF 0x05
+#define _SSIM_CMP 0x1a
+
+/*
+ * Optional source of input rows, used instead of full images. Returns row 'y'
+ * of the reference (img=0) or distorted (img=1) image. Rows are requested in
+ * increasing order, apart from re-reading the kh-1 rows before the newest
+ * one, and the kh rows ending at the newest must be contiguous in memory.
+ */
+typedef const float *(*_ssim_get_row)(void *ctx, int img, int y);
+
+struct _ssim_rows {
+    const float *ref, *cmp;     /* Input images (stride == w) */
+    _ssim_get_row get;          /* Optional. Supplies the input rows instead of 'ref' and 'cmp' */
+    void *ctx;                  /* Context for 'get' */
+    int w, h;                   /* Input size */
+    const struct _kernel *k;    /* Window */
+    const struct _iqa_simd *simd;
+    int mode;                   /* _SSIM_BOX, _SSIM_SEPARABLE or _SSIM_2D */
+    int streams;                /* _SSIM_ALL (the default), _SSIM_REF or _SSIM_CMP */
+    const struct _ssim_rows *lead; /* _SSIM_CMP: the _SSIM_REF rows supplying mu1 and s1 */
+    double *times;              /* Optional stage timing (see ssim.c), or 0 */
+    int ow, oh;                 /* Output size */
+    int y;                      /* Next output row */
+    double weight;              /* Box window weight */
+    float scale;                /* Convolution scale */
+    double *cols;               /* Box: 5 sums per input column */
+    double *hring;              /* Separable: 5 rings of 2*kh filtered rows (ow wide) */
+    float *fring;               /* 2-D: 3 rings of 2*kh product rows (w wide) */
+    float *prod;                /* Separable: one row of products (w wide) */
+    float *stats;               /* Storage for the five rows below */
+    float *mu1, *mu2;           /* Current output row: means */
+    float *s1, *s2, *s12;       /* Current output row: variances and covariance */
+};
+
+/**
+ * Allocates the row buffers for images up to 'w' pixels wide, using window
+ * 'k'. The kernel must stay valid until the buffers are released.
+ * @return 0 on success. Non-zero if out of memory.
+ */
+int _iqa_ssim_rows_alloc(struct _ssim_rows *sr, int w, int h, const struct _kernel *k);
+
+/**
+ * Releases the row buffers.
+ */
+void _iqa_ssim_rows_free(struct _ssim_rows *sr);
+
 /**
  * Private method that calculates the SSIM value on a pre-processed image.
  *
  * The input images must have stride==width. This method does not scale.
  *
- * @note Image buffers are modified.
+ * The window statistics are computed a row at a time, so memory use is
+ * proportional to the image width times the window height.
  *
  * Map-reduce is used for doing the final SSIM calculation. The map function is
  * called for every pixel, and the reduce is called at the end. The context is
- * caller-defined and *not* modified by this method.
+ * caller-defined and *not* modified by this method, unless there is no map
+ * function: then the sums of the terms are added to the struct _ssim_int it
+ * starts with.
  *
  * @param ref Original reference image
  * @param cmp Distorted image
@@ -114,4 +231,12 @@ struct _map_reduce {
  */
 float _iqa_ssim(float *ref, float *cmp, int w, int h, const struct _kernel *k, const struct _map_reduce *mr, const struct iqa_ssim_args *args);
 
+/**
+ * The same as _iqa_ssim(), but uses row buffers from _iqa_ssim_rows_alloc()
+ * (which determine the window) rather than allocating its own. 'w' must not
+ * exceed the width the buffers were allocated for.
+ */
+float _iqa_ssim_rows(struct _ssim_rows *sr, const float *ref, const float *cmp, int w, int h,
+    const struct _map_reduce *mr, const struct iqa_ssim_args *args);
+
 #endif /* _SSIM_H_ */
@@ -32,6 +32,7 @@
  */
 
 #include "convolve.h"
+#include "simd.h"
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -79,18 +80,40 @@ static float _calc_scale(const struct _kernel *k)
     }
 }
 
+/*
+ * Two-pass convolution using the 1-D factors of a separable kernel. The
+ * horizontal pass runs over the full image height into a temporary buffer,
+ * the vertical pass then produces the (dst_w x dst_h) result. The
+ * intermediate is kept in double so it doesn't add a rounding step.
+ * Returns non-zero if the temporary buffer couldn't be allocated.
+ */
+static int _convolve_separable(const float *img, int w, int h, const struct _kernel *k, float scale, float *dst, int dst_w, int dst_h)
+{
+    int y;
+    double *tmp;
+    const struct _iqa_simd *simd = _iqa_simd();
+
+    tmp = (double*)malloc(dst_w*h*sizeof(double));
+    if (!tmp)
+        return 1;
+
+    for (y=0; y < h; ++y)
+        simd->conv_h(img + y*w, k->kernel_h, k->w, tmp + y*dst_w, dst_w);
+
+    for (y=0; y < dst_h; ++y)
+        simd->conv_v(tmp + y*dst_w, dst_w, k->kernel_v, k->h, scale, dst + y*dst_w, dst_w);
+
+    free(tmp);
+    return 0;
+}
+
 void _iqa_convolve(float *img, int w, int h, const struct _kernel *k, float *result, int *rw, int *rh)
 {
-    int x,y,kx,ky,u,v;
-    int uc = k->w/2;
-    int vc = k->h/2;
-    int kw_even = (k->w&1)?0:1;
-    int kh_even = (k->h&1)?0:1;
+    int y;
     int dst_w = w - k->w + 1;
     int dst_h = h - k->h + 1;
-    int img_offset,k_offset;
-    double sum;
     float scale, *dst=result;
+    const struct _iqa_simd *simd;
 
     if (!dst)
         dst = img; /* Convolve in-place */
@@ -99,22 +122,17 @@ void _iqa_convolve(float *img, int w, int h, const struct _kernel *k, float *res
      * in the image */
     scale = _calc_scale(k);
 
-    for (y=0; y < dst_h; ++y) {
-        for (x=0; x < dst_w; ++x) {
-            sum = 0.0;
-            k_offset = 0;
-            ky = y+vc;
-            kx = x+uc;
-            for (v=-vc; v <= vc-kh_even; ++v) {
-                img_offset = (ky+v)*w + kx;
-                for (u=-uc; u <= uc-kw_even; ++u, ++k_offset) {
-                    sum += img[img_offset+u] * k->kernel[k_offset];
-                }
-            }
-            dst[y*dst_w + x] = (float)(sum * scale);
-        }
+    if (k->kernel_h && k->kernel_v &&
+        !_convolve_separable(img, w, h, k, scale, dst, dst_w, dst_h)) {
+        if (rw) *rw = dst_w;
+        if (rh) *rh = dst_h;
+        return;
     }
 
+    simd = _iqa_simd();
+    for (y=0; y < dst_h; ++y)
+        simd->conv_2d(img + y*w, w, k->kernel, k->w, k->h, scale, dst + y*dst_w, dst_w);
+
     if (rw) *rw = dst_w;
     if (rh) *rh = dst_h;
 }
@@ -34,6 +34,7 @@
 #include "iqa.h"
 #include "ssim.h"
 #include "decimate.h"
+#include "alloc.h"
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -61,34 +62,35 @@ static float g_betas[]  = { 0.0448f, 0.2856f, 0.3001f, 0.2363f, 0.1333f };
 static float g_gammas[] = { 0.0448f, 0.2856f, 0.3001f, 0.2363f, 0.1333f };
 
 
+/* MS-SSIM workspace. See iqa_ms_ssim_ws_create(). */
+struct iqa_ms_ssim_ws {
+    int w, h;                       /* Frame size */
+    int wang;                       /* 1=Wang, 0=MS-SSIM* */
+    int scales;                     /* Number of scales */
+    float *alphas, *betas, *gammas; /* Exponents for each scale */
+    struct _kernel lpf, window;
+    float **ref_imgs, **cmp_imgs;   /* Scaled images */
+    struct _ssim_rows rows;         /* SSIM row buffers, sized for the first scale */
+};
+
+/* Has no map function, so _iqa_ssim_rows() sums the luminance, contrast and
+ * structure terms straight into 'sums' */
 struct _context {
-    double l;  /* Luminance */
-    double c;  /* Contrast */
-    double s;  /* Structure */
+    struct _ssim_int sums;  /* Must come first */
     float alpha;
     float beta;
     float gamma;
 };
 
-/* Called for each pixel */
-int _ms_ssim_map(const struct _ssim_int *si, void *ctx)
-{
-    struct _context *ms_ctx = (struct _context*)ctx;
-    ms_ctx->l += si->l;
-    ms_ctx->c += si->c;
-    ms_ctx->s += si->s;
-    return 0;
-}
-
 /* Called to calculate the final result */
 float _ms_ssim_reduce(int w, int h, void *ctx)
 {
     double size = (double)(w*h);
     struct _context *ms_ctx = (struct _context*)ctx;
-    ms_ctx->l = pow(ms_ctx->l / size, (double)ms_ctx->alpha);
-    ms_ctx->c = pow(ms_ctx->c / size, (double)ms_ctx->beta);
-    ms_ctx->s = pow(fabs(ms_ctx->s / size), (double)ms_ctx->gamma);
-    return (float)(ms_ctx->l * ms_ctx->c * ms_ctx->s);
+    double l = pow(ms_ctx->sums.l / size, (double)ms_ctx->alpha);
+    double c = pow(ms_ctx->sums.c / size, (double)ms_ctx->beta);
+    double s = pow(fabs(ms_ctx->sums.s / size), (double)ms_ctx->gamma);
+    return (float)(l * c * s);
 }
 
 /* Releases the scaled buffers */
@@ -96,7 +98,7 @@ void _free_buffers(float **buf, int scales)
 {
     int idx;
     for (idx=0; idx<scales; ++idx)
-        free(buf[idx]);
+        _iqa_free(buf[idx]);
 }
 
 /* Allocates the scaled buffers. If error, all buffers are free'd */
@@ -106,7 +108,7 @@ int _alloc_buffers(float **buf, int w, int h, int scales)
     int cur_w = w;
     int cur_h = h;
     for (idx=0; idx<scales; ++idx) {
-        buf[idx] = (float*)malloc(cur_w*cur_h*sizeof(float));
+        buf[idx] = (float*)_iqa_alloc(cur_w*cur_h*sizeof(float));
         if (!buf[idx]) {
             _free_buffers(buf, idx);
             return 1;
@@ -128,19 +130,27 @@ int _alloc_buffers(float **buf, int w, int h, int scales)
  */
 float iqa_ms_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int h, 
     int stride, const struct iqa_ms_ssim_args *args)
+{
+    float msssim;
+    struct iqa_ms_ssim_ws *ws;
+
+    ws = iqa_ms_ssim_ws_create(w, h, args);
+    if (!ws)
+        return INFINITY;
+    msssim = iqa_ms_ssim_ws_run(ws, ref, cmp, stride);
+    iqa_ms_ssim_ws_destroy(ws);
+    return msssim;
+}
+
+/* iqa_ms_ssim_ws_create */
+struct iqa_ms_ssim_ws *iqa_ms_ssim_ws_create(int w, int h, const struct iqa_ms_ssim_args *args)
 {
     int wang=0;
     int scales=SCALES;
     int gauss=1;
     const float *alphas=g_alphas, *betas=g_betas, *gammas=g_gammas;
-    int idx,x,y,cur_w,cur_h;
-    int offset,src_offset;
-    float **ref_imgs, **cmp_imgs; /* Array of pointers to scaled images */
-    float msssim;
-    struct _kernel lpf, window;
-    struct iqa_ssim_args s_args;
-    struct _map_reduce mr;
-    struct _context ms_ctx;
+    int idx,cur_w,cur_h;
+    struct iqa_ms_ssim_ws *ws;
 
     if (args) {
         wang   = args->wang;
@@ -159,42 +169,115 @@ float iqa_ms_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int
     cur_h = h;
     for (idx=0; idx<scales; ++idx) {
         if ( gauss ? cur_w<GAUSSIAN_LEN || cur_h<GAUSSIAN_LEN : cur_w<LPF_LEN || cur_h<LPF_LEN )
-            return INFINITY;
+            return 0;
         cur_w /= 2;
         cur_h /= 2;
     }
 
-    window.kernel = (float*)g_square_window;
-    window.w = window.h = SQUARE_LEN;
-    window.normalized = 1;
-    window.bnd_opt = KBND_SYMMETRIC;
+    ws = (struct iqa_ms_ssim_ws*)calloc(1, sizeof(struct iqa_ms_ssim_ws));
+    if (!ws)
+        return 0;
+    ws->w = w;
+    ws->h = h;
+    ws->wang = wang;
+    ws->scales = scales;
+
+    ws->window.kernel = (float*)g_square_window;
+    ws->window.w = ws->window.h = SQUARE_LEN;
+    ws->window.normalized = 1;
+    ws->window.bnd_opt = KBND_SYMMETRIC;
+    ws->window.kernel_h = ws->window.kernel_v = 0;
     if (gauss) {
-        window.kernel = (float*)g_gaussian_window;
-        window.w = window.h = GAUSSIAN_LEN;
+        ws->window.kernel = (float*)g_gaussian_window;
+        ws->window.w = ws->window.h = GAUSSIAN_LEN;
+        ws->window.kernel_h = ws->window.kernel_v = (float*)g_gaussian_1d;
     }
 
-    mr.map     = _ms_ssim_map;
-    mr.reduce  = _ms_ssim_reduce;
+    ws->lpf.kernel = (float*)g_lpf;
+    ws->lpf.w = ws->lpf.h = LPF_LEN;
+    ws->lpf.normalized = 1;
+    ws->lpf.bnd_opt = KBND_SYMMETRIC;
+    ws->lpf.kernel_h = ws->lpf.kernel_v = 0;
+
+    /* Keep our own copy of the exponents */
+    ws->alphas = (float*)malloc(3*scales*sizeof(float));
+    if (!ws->alphas) {
+        free(ws);
+        return 0;
+    }
+    ws->betas  = ws->alphas + scales;
+    ws->gammas = ws->betas + scales;
+    memcpy(ws->alphas, alphas, scales*sizeof(float));
+    memcpy(ws->betas, betas, scales*sizeof(float));
+    memcpy(ws->gammas, gammas, scales*sizeof(float));
 
     /* Allocate the scaled image buffers */
-    ref_imgs = (float**)malloc(scales*sizeof(float*));
-    cmp_imgs = (float**)malloc(scales*sizeof(float*));
-    if (!ref_imgs || !cmp_imgs) {
-        if (ref_imgs) free(ref_imgs);
-        if (cmp_imgs) free(cmp_imgs);
-        return INFINITY;
+    ws->ref_imgs = (float**)malloc(scales*sizeof(float*));
+    ws->cmp_imgs = (float**)malloc(scales*sizeof(float*));
+    if (!ws->ref_imgs || !ws->cmp_imgs) {
+        if (ws->ref_imgs) free(ws->ref_imgs);
+        if (ws->cmp_imgs) free(ws->cmp_imgs);
+        free(ws->alphas);
+        free(ws);
+        return 0;
     }
-    if (_alloc_buffers(ref_imgs, w, h, scales)) {
-        free(ref_imgs);
-        free(cmp_imgs);
-        return INFINITY;
+    if (_alloc_buffers(ws->ref_imgs, w, h, scales)) {
+        free(ws->ref_imgs);
+        free(ws->cmp_imgs);
+        free(ws->alphas);
+        free(ws);
+        return 0;
     }
-    if (_alloc_buffers(cmp_imgs, w, h, scales)) {
-        _free_buffers(ref_imgs, scales);
-        free(ref_imgs);
-        free(cmp_imgs);
-        return INFINITY;
+    if (_alloc_buffers(ws->cmp_imgs, w, h, scales)) {
+        _free_buffers(ws->ref_imgs, scales);
+        free(ws->ref_imgs);
+        free(ws->cmp_imgs);
+        free(ws->alphas);
+        free(ws);
+        return 0;
+    }
+
+    /* The first scale is the largest, so its buffers fit all the others */
+    if (_iqa_ssim_rows_alloc(&ws->rows, w, h, &ws->window)) {
+        _free_buffers(ws->ref_imgs, scales);
+        _free_buffers(ws->cmp_imgs, scales);
+        free(ws->ref_imgs);
+        free(ws->cmp_imgs);
+        free(ws->alphas);
+        free(ws);
+        return 0;
     }
+    return ws;
+}
+
+/* iqa_ms_ssim_ws_destroy */
+void iqa_ms_ssim_ws_destroy(struct iqa_ms_ssim_ws *ws)
+{
+    if (!ws)
+        return;
+    _iqa_ssim_rows_free(&ws->rows);
+    _free_buffers(ws->ref_imgs, ws->scales);
+    _free_buffers(ws->cmp_imgs, ws->scales);
+    free(ws->ref_imgs);
+    free(ws->cmp_imgs);
+    free(ws->alphas);
+    free(ws);
+}
+
+/* iqa_ms_ssim_ws_run */
+float iqa_ms_ssim_ws_run(struct iqa_ms_ssim_ws *ws, const unsigned char *ref, const unsigned char *cmp, int stride)
+{
+    int idx,x,y,cur_w,cur_h;
+    int offset,src_offset;
+    int w = ws->w, h = ws->h;
+    float **ref_imgs = ws->ref_imgs, **cmp_imgs = ws->cmp_imgs;
+    float msssim;
+    struct iqa_ssim_args s_args;
+    struct _map_reduce mr;
+    struct _context ms_ctx;
+
+    mr.map     = 0;
+    mr.reduce  = _ms_ssim_reduce;
 
     /* Copy original images into first scale buffer, forcing stride = width. */
     for (y=0; y<h; ++y) {
@@ -209,35 +292,23 @@ float iqa_ms_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int
     /* Create scaled versions of the images */
     cur_w=w;
     cur_h=h;
-    lpf.kernel = (float*)g_lpf;
-    lpf.w = lpf.h = LPF_LEN;
-    lpf.normalized = 1;
-    lpf.bnd_opt = KBND_SYMMETRIC;
-    for (idx=1; idx<scales; ++idx) {
-        if (_iqa_decimate(ref_imgs[idx-1], cur_w, cur_h, 2, &lpf, ref_imgs[idx], 0, 0) ||
-            _iqa_decimate(cmp_imgs[idx-1], cur_w, cur_h, 2, &lpf, cmp_imgs[idx], &cur_w, &cur_h))
-        {
-            _free_buffers(ref_imgs, scales);
-            _free_buffers(cmp_imgs, scales);
-            free(ref_imgs);
-            free(cmp_imgs);
+    for (idx=1; idx<ws->scales; ++idx) {
+        if (_iqa_decimate(ref_imgs[idx-1], cur_w, cur_h, 2, &ws->lpf, ref_imgs[idx], 0, 0) ||
+            _iqa_decimate(cmp_imgs[idx-1], cur_w, cur_h, 2, &ws->lpf, cmp_imgs[idx], &cur_w, &cur_h))
             return INFINITY;
-        }
     }
 
     cur_w=w;
     cur_h=h;
     msssim = 1.0;
-    for (idx=0; idx<scales; ++idx) {
+    for (idx=0; idx<ws->scales; ++idx) {
 
-        ms_ctx.l = 0;
-        ms_ctx.c = 0;
-        ms_ctx.s = 0;
-        ms_ctx.alpha = alphas[idx];
-        ms_ctx.beta  = betas[idx];
-        ms_ctx.gamma = gammas[idx];
+        memset(&ms_ctx.sums, 0, sizeof(ms_ctx.sums));
+        ms_ctx.alpha = ws->alphas[idx];
+        ms_ctx.beta  = ws->betas[idx];
+        ms_ctx.gamma = ws->gammas[idx];
 
-        if (!wang) {
+        if (!ws->wang) {
             /* MS-SSIM* (Rouse/Hemami) */
             s_args.alpha = 1.0f;
             s_args.beta  = 1.0f;
@@ -247,7 +318,7 @@ float iqa_ms_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int
             s_args.L  = 255;
             s_args.f  = 1; /* Don't resize */
             mr.context = &ms_ctx;
-            msssim *= _iqa_ssim(ref_imgs[idx], cmp_imgs[idx], cur_w, cur_h, &window, &mr, &s_args);
+            msssim *= _iqa_ssim_rows(&ws->rows, ref_imgs[idx], cmp_imgs[idx], cur_w, cur_h, &mr, &s_args);
         }
         else {
             /* MS-SSIM (Wang) */
@@ -259,7 +330,7 @@ float iqa_ms_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int
             s_args.L  = 255;
             s_args.f  = 1; /* Don't resize */
             mr.context = &ms_ctx;
-            msssim *= _iqa_ssim(ref_imgs[idx], cmp_imgs[idx], cur_w, cur_h, &window, &mr, &s_args);
+            msssim *= _iqa_ssim_rows(&ws->rows, ref_imgs[idx], cmp_imgs[idx], cur_w, cur_h, &mr, &s_args);
         }
 
         if (msssim == INFINITY)
@@ -268,10 +339,5 @@ float iqa_ms_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int
         cur_h = cur_h/2 + (cur_h&1);
     }
 
-    _free_buffers(ref_imgs, scales);
-    _free_buffers(cmp_imgs, scales);
-    free(ref_imgs);
-    free(cmp_imgs);
-
     return msssim;
 }
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2026, The codec-quality-comparator authors
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the copyright holder nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pool.h"
+#include <stdlib.h>
+
+#ifndef WIN32
+
+#include <pthread.h>
+
+struct _iqa_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* Signalled when a job is posted or on shutdown */
+    pthread_cond_t done;        /* Signalled when the last task of a job finishes */
+    pthread_t *workers;
+    int nworkers;
+    _iqa_task fn;               /* Current job */
+    void *ctx;
+    int tasks;                  /* Tasks in the current job */
+    int next;                   /* Next task to hand out */
+    int finished;               /* Tasks completed */
+    unsigned long gen;          /* Job counter, so workers don't rerun a job */
+    int quit;
+};
+
+/* Claims and runs tasks of the current job until none are left. Called with
+ * the lock held, and returns with it held. */
+static void _pool_drain(struct _iqa_pool *p)
+{
+    int task;
+    while (p->next < p->tasks) {
+        task = p->next++;
+        pthread_mutex_unlock(&p->lock);
+        p->fn(p->ctx, task);
+        pthread_mutex_lock(&p->lock);
+        if (++p->finished == p->tasks)
+            pthread_cond_signal(&p->done);
+    }
+}
+
+static void *_pool_worker(void *arg)
+{
+    struct _iqa_pool *p = (struct _iqa_pool*)arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->quit && p->gen == seen)
+            pthread_cond_wait(&p->work, &p->lock);
+        if (p->quit)
+            break;
+        seen = p->gen;
+        _pool_drain(p);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+struct _iqa_pool *_iqa_pool_create(int threads)
+{
+    int ii;
+    struct _iqa_pool *p;
+
+    if (threads < 2)
+        return 0;
+    p = (struct _iqa_pool*)calloc(1, sizeof(struct _iqa_pool));
+    if (!p)
+        return 0;
+    p->workers = (pthread_t*)malloc((threads-1)*sizeof(pthread_t));
+    if (!p->workers) {
+        free(p);
+        return 0;
+    }
+    pthread_mutex_init(&p->lock, 0);
+    pthread_cond_init(&p->work, 0);
+    pthread_cond_init(&p->done, 0);
+    for (ii=0; ii<threads-1; ++ii) {
+        if (pthread_create(&p->workers[ii], 0, _pool_worker, p))
+            break;
+        p->nworkers++;
+    }
+    if (!p->nworkers) {
+        _iqa_pool_destroy(p);
+        return 0;
+    }
+    return p;
+}
+
+void _iqa_pool_run(struct _iqa_pool *p, _iqa_task fn, void *ctx, int tasks)
+{
+    pthread_mutex_lock(&p->lock);
+    p->fn = fn;
+    p->ctx = ctx;
+    p->tasks = tasks;
+    p->next = 0;
+    p->finished = 0;
+    p->gen++;
+    pthread_cond_broadcast(&p->work);
+    _pool_drain(p);
+    while (p->finished < p->tasks)
+        pthread_cond_wait(&p->done, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void _iqa_pool_destroy(struct _iqa_pool *p)
+{
+    int ii;
+    if (!p)
+        return;
+    pthread_mutex_lock(&p->lock);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+    for (ii=0; ii<p->nworkers; ++ii)
+        pthread_join(p->workers[ii], 0);
+    pthread_cond_destroy(&p->done);
+    pthread_cond_destroy(&p->work);
+    pthread_mutex_destroy(&p->lock);
+    free(p->workers);
+    free(p);
+}
+
+#else /* WIN32 */
+
+struct _iqa_pool *_iqa_pool_create(int threads)
+{
+    (void)threads;
+    return 0;
+}
+
+void _iqa_pool_run(struct _iqa_pool *p, _iqa_task fn, void *ctx, int tasks)
+{
+    int ii;
+    (void)p;
+    for (ii=0; ii<tasks; ++ii)
+        fn(ctx, ii);
+}
+
+void _iqa_pool_destroy(struct _iqa_pool *p)
+{
+    (void)p;
+}
+
+#endif
@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2026, The codec-quality-comparator authors
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the copyright holder nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "simd.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct _iqa_simd *g_simd = 0;
+
+
+/* Scalar implementations. These are the reference the vectorized versions
+ * have to match. */
+
+static void _conv_h(const float *src, const float *k, int kw, double *dst, int n)
+{
+    int x,u;
+    double sum;
+
+    for (x=0; x < n; ++x, ++src) {
+        sum = 0.0;
+        for (u=0; u < kw; ++u)
+            sum += src[u] * k[u];
+        dst[x] = sum;
+    }
+}
+
+static void _conv_v(const double *src, int stride, const float *k, int kh, float scale, float *dst, int n)
+{
+    int x,v,offset;
+    double sum;
+
+    for (x=0; x < n; ++x) {
+        sum = 0.0;
+        offset = x;
+        for (v=0; v < kh; ++v, offset += stride)
+            sum += src[offset] * k[v];
+        dst[x] = (float)(sum * scale);
+    }
+}
+
+static void _conv_2d(const float *src, int w, const float *k, int kw, int kh, float scale, float *dst, int n)
+{
+    int x,u,v,offset,k_offset;
+    double sum;
+
+    for (x=0; x < n; ++x) {
+        sum = 0.0;
+        k_offset = 0;
+        for (v=0; v < kh; ++v) {
+            offset = v*w + x;
+            for (u=0; u < kw; ++u, ++k_offset)
+                sum += src[offset+u] * k[k_offset];
+        }
+        dst[x] = (float)(sum * scale);
+    }
+}
+
+static unsigned long long _sse_row(const unsigned char *ref, const unsigned char *cmp, int n)
+{
+    int x,error;
+    unsigned long long sum=0;
+
+    for (x=0; x < n; ++x) {
+        error = ref[x] - cmp[x];
+        sum += error * error;
+    }
+    return sum;
+}
+
+static double _ssim_row(const float *ref_mu, const float *cmp_mu, const float *ref_sigma_sqd,
+    const float *cmp_sigma_sqd, const float *sigma_both, int n, float C1, float C2, double sum)
+{
+    int x;
+    double numerator, denominator;
+
+    for (x=0; x < n; ++x) {
+        numerator   = (2.0 * ref_mu[x] * cmp_mu[x] + C1) * (2.0 * sigma_both[x] + C2);
+        denominator = (ref_mu[x]*ref_mu[x] + cmp_mu[x]*cmp_mu[x] + C1) * 
+            (ref_sigma_sqd[x] + cmp_sigma_sqd[x] + C2);
+        sum += numerator / denominator;
+    }
+    return sum;
+}
+
+/*
+ * ssim_parts_row(), specialized on whether the constants may be 0. Only the
+ * MS-SSIM* variant needs the 0/0 cases of _calc_luminance() and co. The sums
+ * are kept in the order the per-pixel map used to add them.
+ */
+#define _SSIM_PARTS_ROW(name, ZERO) \
+static void name(const float *ref_mu, const float *cmp_mu, const float *ref_sigma_sqd, \
+    const float *cmp_sigma_sqd, const float *sigma_both, int n, float C1, float C2, float C3, double *sums) \
+{ \
+    int x; \
+    float s1, s2; \
+    double root, l, c, s; \
+    double sl=sums[0], sc=sums[1], ss=sums[2], slcs=sums[3]; \
+ \
+    for (x=0; x < n; ++x) { \
+        s1 = ref_sigma_sqd[x] < 0.0f ? 0.0f : ref_sigma_sqd[x]; \
+        s2 = cmp_sigma_sqd[x] < 0.0f ? 0.0f : cmp_sigma_sqd[x]; \
+        root = sqrt(s1 * s2); \
+        l = (2.0 * ref_mu[x] * cmp_mu[x] + C1) / (ref_mu[x]*ref_mu[x] + cmp_mu[x]*cmp_mu[x] + C1); \
+        c = (2.0 * root + C2) / (s1 + s2 + C2); \
+        s = (sigma_both[x] + C3) / (root + C3); \
+        if (ZERO) { \
+            if (C1 == 0 && ref_mu[x]*ref_mu[x] == 0 && cmp_mu[x]*cmp_mu[x] == 0) \
+                l = 1.0; \
+            if (C2 == 0 && s1 + s2 == 0) \
+                c = 1.0; \
+            if (C3 == 0 && root == 0) { \
+                if (s1 == 0 && s2 == 0) \
+                    s = 1.0; \
+                else if (s1 == 0 || s2 == 0) \
+                    s = 0.0; \
+            } \
+        } \
+        sl += l; \
+        sc += c; \
+        ss += s; \
+        slcs += l * c * s; \
+    } \
+    sums[0] = sl; \
+    sums[1] = sc; \
+    sums[2] = ss; \
+    sums[3] = slcs; \
+}
+
+_SSIM_PARTS_ROW(_ssim_parts_row_k, 0)
+_SSIM_PARTS_ROW(_ssim_parts_row_zero, 1)
+
+static void _ssim_parts_row(const float *ref_mu, const float *cmp_mu, const float *ref_sigma_sqd,
+    const float *cmp_sigma_sqd, const float *sigma_both, int n, float C1, float C2, float C3, double *sums)
+{
+    if (C1 == 0 || C2 == 0 || C3 == 0)
+        _ssim_parts_row_zero(ref_mu, cmp_mu, ref_sigma_sqd, cmp_sigma_sqd, sigma_both, n, C1, C2, C3, sums);
+    else
+        _ssim_parts_row_k(ref_mu, cmp_mu, ref_sigma_sqd, cmp_sigma_sqd, sigma_both, n, C1, C2, C3, sums);
+}
+
+static void _fixed_h(const unsigned char *ref, const unsigned char *cmp, const int *k, int kw, int *dst, int stride, int n)
+{
+    int x,u,r,d,kr,kd;
+    int sx,sy,sxx,syy,sxy;
+
+    for (x=0; x < n; ++x) {
+        sx = sy = sxx = syy = sxy = 0;
+        for (u=0; u < kw; ++u) {
+            r = ref[x+u];
+            d = cmp[x+u];
+            kr = k[u] * r;
+            kd = k[u] * d;
+            sx  += kr;
+            sy  += kd;
+            sxx += kr * r;
+            syy += kd * d;
+            sxy += kr * d;
+        }
+        dst[x] = sx;
+        dst[stride+x] = sy;
+        dst[2*stride+x] = sxx;
+        dst[3*stride+x] = syy;
+        dst[4*stride+x] = sxy;
+    }
+}
+
+static void _fixed_v(const int *src, int stride, const int *k, int kh, long long *dst, int n)
+{
+    int x,v,offset;
+    long long sum;
+
+    for (x=0; x < n; ++x) {
+        sum = 0;
+        offset = x;
+        for (v=0; v < kh; ++v, offset += stride)
+            sum += (long long)src[offset] * k[v];
+        dst[x] = sum;
+    }
+}
+
+const struct _iqa_simd _iqa_simd_scalar = {
+    IQA_SIMD_SCALAR,
+    "scalar",
+    _conv_h,
+    _conv_v,
+    _conv_2d,
+    _sse_row,
+    _ssim_row,
+    _ssim_parts_row,
+    _fixed_h,
+    _fixed_v
+};
+
+
+/* Returns the best table supported by the CPU that doesn't exceed 'level' */
+static const struct _iqa_simd *_best(int level)
+{
+#ifdef IQA_SIMD_X86
+    __builtin_cpu_init();
+    if (level >= IQA_SIMD_AVX512 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        return &_iqa_simd_avx512;
+    if (level >= IQA_SIMD_AVX2 && __builtin_cpu_supports("avx2"))
+        return &_iqa_simd_avx2;
+    if (level >= IQA_SIMD_SSE4 && __builtin_cpu_supports("sse4.1"))
+        return &_iqa_simd_sse4;
+#endif
+    return &_iqa_simd_scalar;
+}
+
+/* Maximum level allowed by the IQA_SIMD environment variable. Anything it
+ * doesn't name falls back to scalar, the safe choice when debugging. */
+static int _env_level()
+{
+    const char *env = getenv("IQA_SIMD");
+    if (!env || !*env)
+        return IQA_SIMD_AVX512;
+    if (!strcmp(env, "scalar"))
+        return IQA_SIMD_SCALAR;
+    if (!strcmp(env, "sse4"))
+        return IQA_SIMD_SSE4;
+    if (!strcmp(env, "avx2"))
+        return IQA_SIMD_AVX2;
+    if (!strcmp(env, "avx512"))
+        return IQA_SIMD_AVX512;
+    fprintf(stderr, "iqa: unknown IQA_SIMD '%s' (scalar, sse4, avx2 or avx512), using scalar\n", env);
+    return IQA_SIMD_SCALAR;
+}
+
+/* Select the table when the library is loaded so the hot paths never race on
+ * the first call. _iqa_simd() still handles compilers without constructors. */
+#ifdef __GNUC__
+__attribute__((constructor))
+#endif
+static void _init()
+{
+    if (!g_simd)
+        g_simd = _best(_env_level());
+}
+
+const struct _iqa_simd *_iqa_simd(void)
+{
+    if (!g_simd)
+        _init();
+    return g_simd;
+}
+
+int _iqa_simd_select(int level)
+{
+    g_simd = _best(level);
+    return g_simd->level;
+}
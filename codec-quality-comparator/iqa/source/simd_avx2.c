@@ -0,0 +1,329 @@
+/*
+ * Copyright (c) 2026, The codec-quality-comparator authors
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the copyright holder nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "simd.h"
+
+#ifdef IQA_SIMD_X86
+
+#include <immintrin.h>
+
+/*
+ * AVX2 kernels. Convolutions process 8 outputs per iteration and keep the
+ * scalar summation order, so the results are bit-exact with the scalar code.
+ * Leftover pixels at the end of a row go through the scalar implementation.
+ */
+
+#define TARGET __attribute__((target("avx2")))
+
+TARGET static void _conv_h(const float *src, const float *k, int kw, double *dst, int n)
+{
+    int x,u;
+    __m256 p;
+    __m256d lo,hi;
+
+    for (x=0; x+8 <= n; x+=8) {
+        lo = hi = _mm256_setzero_pd();
+        for (u=0; u < kw; ++u) {
+            p = _mm256_mul_ps(_mm256_loadu_ps(src+x+u), _mm256_set1_ps(k[u]));
+            lo = _mm256_add_pd(lo, _mm256_cvtps_pd(_mm256_castps256_ps128(p)));
+            hi = _mm256_add_pd(hi, _mm256_cvtps_pd(_mm256_extractf128_ps(p, 1)));
+        }
+        _mm256_storeu_pd(dst+x, lo);
+        _mm256_storeu_pd(dst+x+4, hi);
+    }
+    if (x < n)
+        _iqa_simd_scalar.conv_h(src+x, k, kw, dst+x, n-x);
+}
+
+TARGET static void _conv_v(const double *src, int stride, const float *k, int kh, float scale, float *dst, int n)
+{
+    int x,v;
+    const double *row;
+    __m256d kv,lo,hi;
+    __m256d s = _mm256_set1_pd(scale);
+
+    for (x=0; x+8 <= n; x+=8) {
+        lo = hi = _mm256_setzero_pd();
+        row = src + x;
+        for (v=0; v < kh; ++v, row += stride) {
+            kv = _mm256_set1_pd(k[v]);
+            lo = _mm256_add_pd(lo, _mm256_mul_pd(_mm256_loadu_pd(row), kv));
+            hi = _mm256_add_pd(hi, _mm256_mul_pd(_mm256_loadu_pd(row+4), kv));
+        }
+        _mm_storeu_ps(dst+x, _mm256_cvtpd_ps(_mm256_mul_pd(lo, s)));
+        _mm_storeu_ps(dst+x+4, _mm256_cvtpd_ps(_mm256_mul_pd(hi, s)));
+    }
+    if (x < n)
+        _iqa_simd_scalar.conv_v(src+x, stride, k, kh, scale, dst+x, n-x);
+}
+
+TARGET static void _conv_2d(const float *src, int w, const float *k, int kw, int kh, float scale, float *dst, int n)
+{
+    int x,u,v;
+    const float *row, *kr;
+    __m256 p;
+    __m256d lo,hi;
+    __m256d s = _mm256_set1_pd(scale);
+
+    for (x=0; x+8 <= n; x+=8) {
+        lo = hi = _mm256_setzero_pd();
+        row = src + x;
+        kr = k;
+        for (v=0; v < kh; ++v, row += w, kr += kw) {
+            for (u=0; u < kw; ++u) {
+                p = _mm256_mul_ps(_mm256_loadu_ps(row+u), _mm256_set1_ps(kr[u]));
+                lo = _mm256_add_pd(lo, _mm256_cvtps_pd(_mm256_castps256_ps128(p)));
+                hi = _mm256_add_pd(hi, _mm256_cvtps_pd(_mm256_extractf128_ps(p, 1)));
+            }
+        }
+        _mm_storeu_ps(dst+x, _mm256_cvtpd_ps(_mm256_mul_pd(lo, s)));
+        _mm_storeu_ps(dst+x+4, _mm256_cvtpd_ps(_mm256_mul_pd(hi, s)));
+    }
+    if (x < n)
+        _iqa_simd_scalar.conv_2d(src+x, w, k, kw, kh, scale, dst+x, n-x);
+}
+
+TARGET static unsigned long long _sse_row(const unsigned char *ref, const unsigned char *cmp, int n)
+{
+    int x,i,run;
+    unsigned int lanes[8];
+    unsigned long long sum=0;
+    __m256i a,b,acc;
+
+    /* Each 32-bit lane gains at most 2*255^2 per step. Flush them to the
+     * 64-bit sum well before they can overflow. */
+    for (x=0; x+16 <= n; ) {
+        acc = _mm256_setzero_si256();
+        for (run=0; run < 4096 && x+16 <= n; ++run, x+=16) {
+            a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(ref+x)));
+            b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(cmp+x)));
+            a = _mm256_sub_epi16(a, b);
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(a, a));
+        }
+        _mm256_storeu_si256((__m256i*)lanes, acc);
+        for (i=0; i < 8; ++i)
+            sum += lanes[i];
+    }
+    if (x < n)
+        sum += _iqa_simd_scalar.sse_row(ref+x, cmp+x, n-x);
+    return sum;
+}
+
+TARGET static double _ssim_row(const float *ref_mu, const float *cmp_mu, const float *ref_sigma_sqd,
+    const float *cmp_sigma_sqd, const float *sigma_both, int n, float C1, float C2, double sum)
+{
+    int x,i;
+    double lanes[4];
+    __m256 m1,m2,den;
+    __m256d num,acc;
+    const __m256 c1f = _mm256_set1_ps(C1);
+    const __m256 c2f = _mm256_set1_ps(C2);
+    const __m256d c1 = _mm256_set1_pd(C1);
+    const __m256d c2 = _mm256_set1_pd(C2);
+    const __m256d two = _mm256_set1_pd(2.0);
+
+    acc = _mm256_setzero_pd();
+    for (x=0; x+8 <= n; x+=8) {
+        m1 = _mm256_loadu_ps(ref_mu+x);
+        m2 = _mm256_loadu_ps(cmp_mu+x);
+
+        /* The denominator is computed in float, like the scalar code */
+        den = _mm256_mul_ps(
+            _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m1, m1), _mm256_mul_ps(m2, m2)), c1f),
+            _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(ref_sigma_sqd+x), _mm256_loadu_ps(cmp_sigma_sqd+x)), c2f));
+
+        for (i=0; i < 8; i+=4) {
+            num = _mm256_mul_pd(
+                _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(two, _mm256_cvtps_pd(_mm_loadu_ps(ref_mu+x+i))),
+                    _mm256_cvtps_pd(_mm_loadu_ps(cmp_mu+x+i))), c1),
+                _mm256_add_pd(_mm256_mul_pd(two, _mm256_cvtps_pd(_mm_loadu_ps(sigma_both+x+i))), c2));
+            acc = _mm256_add_pd(acc, _mm256_div_pd(num,
+                _mm256_cvtps_pd(i ? _mm256_extractf128_ps(den, 1) : _mm256_castps256_ps128(den))));
+        }
+    }
+    _mm256_storeu_pd(lanes, acc);
+    sum += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    if (x < n)
+        sum = _iqa_simd_scalar.ssim_row(ref_mu+x, cmp_mu+x, ref_sigma_sqd+x, cmp_sigma_sqd+x, sigma_both+x, n-x, C1, C2, sum);
+    return sum;
+}
+
+/*
+ * ssim_parts_row() on groups of 4 pixels: the float parts in 128-bit vectors,
+ * the double ones in 256-bit vectors. 'zero' is a constant at both call sites,
+ * so the 0/0 cases are only compiled into the MS-SSIM* variant. Returns the
+ * number of pixels done.
+ */
+TARGET static __inline__ int _parts(const float *ref_mu, const float *cmp_mu, const float *ref_sigma_sqd,
+    const float *cmp_sigma_sqd, const float *sigma_both, int n, float C1, float C2, float C3, double *sums,
+    const int zero)
+{
+    int x,i;
+    double lanes[4];
+    __m128 m1,m2,v1,v2,mm1,mm2,vv;
+    __m256d root,l,c,s,e1,e2,rz,acc[4];
+    const __m128 zf = _mm_setzero_ps();
+    const __m128 c1f = _mm_set1_ps(C1);
+    const __m128 c2f = _mm_set1_ps(C2);
+    const __m128 c3f = _mm_set1_ps(C3);
+    const __m256d zd = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d two = _mm256_set1_pd(2.0);
+    const __m256d c1 = _mm256_set1_pd(C1);
+    const __m256d c2 = _mm256_set1_pd(C2);
+    const __m256d c3 = _mm256_set1_pd(C3);
+
+    for (i=0; i < 4; ++i)
+        acc[i] = _mm256_setzero_pd();
+    for (x=0; x+4 <= n; x+=4) {
+        m1 = _mm_loadu_ps(ref_mu+x);
+        m2 = _mm_loadu_ps(cmp_mu+x);
+        /* max(0,v) keeps NaNs, like the scalar compare */
+        v1 = _mm_max_ps(zf, _mm_loadu_ps(ref_sigma_sqd+x));
+        v2 = _mm_max_ps(zf, _mm_loadu_ps(cmp_sigma_sqd+x));
+        mm1 = _mm_mul_ps(m1, m1);
+        mm2 = _mm_mul_ps(m2, m2);
+        vv = _mm_add_ps(v1, v2);
+        root = _mm256_sqrt_pd(_mm256_cvtps_pd(_mm_mul_ps(v1, v2)));
+
+        l = _mm256_div_pd(
+            _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(two, _mm256_cvtps_pd(m1)), _mm256_cvtps_pd(m2)), c1),
+            _mm256_cvtps_pd(_mm_add_ps(_mm_add_ps(mm1, mm2), c1f)));
+        c = _mm256_div_pd(_mm256_add_pd(_mm256_mul_pd(two, root), c2), _mm256_cvtps_pd(_mm_add_ps(vv, c2f)));
+        s = _mm256_div_pd(_mm256_cvtps_pd(_mm_add_ps(_mm_loadu_ps(sigma_both+x), c3f)), _mm256_add_pd(root, c3));
+
+        if (zero) {
+            if (C1 == 0)
+                l = _mm256_blendv_pd(l, one, _mm256_and_pd(_mm256_cmp_pd(_mm256_cvtps_pd(mm1), zd, _CMP_EQ_OQ),
+                    _mm256_cmp_pd(_mm256_cvtps_pd(mm2), zd, _CMP_EQ_OQ)));
+            if (C2 == 0)
+                c = _mm256_blendv_pd(c, one, _mm256_cmp_pd(_mm256_cvtps_pd(vv), zd, _CMP_EQ_OQ));
+            if (C3 == 0) {
+                e1 = _mm256_cmp_pd(_mm256_cvtps_pd(v1), zd, _CMP_EQ_OQ);
+                e2 = _mm256_cmp_pd(_mm256_cvtps_pd(v2), zd, _CMP_EQ_OQ);
+                rz = _mm256_cmp_pd(root, zd, _CMP_EQ_OQ);
+                s = _mm256_blendv_pd(s, zd, _mm256_and_pd(rz, _mm256_or_pd(e1, e2)));
+                s = _mm256_blendv_pd(s, one, _mm256_and_pd(rz, _mm256_and_pd(e1, e2)));
+            }
+        }
+
+        acc[0] = _mm256_add_pd(acc[0], l);
+        acc[1] = _mm256_add_pd(acc[1], c);
+        acc[2] = _mm256_add_pd(acc[2], s);
+        acc[3] = _mm256_add_pd(acc[3], _mm256_mul_pd(_mm256_mul_pd(l, c), s));
+    }
+    for (i=0; i < 4; ++i) {
+        _mm256_storeu_pd(lanes, acc[i]);
+        sums[i] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+    return x;
+}
+
+TARGET static void _ssim_parts_row(const float *ref_mu, const float *cmp_mu, const float *ref_sigma_sqd,
+    const float *cmp_sigma_sqd, const float *sigma_both, int n, float C1, float C2, float C3, double *sums)
+{
+    int x;
+
+    if (C1 == 0 || C2 == 0 || C3 == 0)
+        x = _parts(ref_mu, cmp_mu, ref_sigma_sqd, cmp_sigma_sqd, sigma_both, n, C1, C2, C3, sums, 1);
+    else
+        x = _parts(ref_mu, cmp_mu, ref_sigma_sqd, cmp_sigma_sqd, sigma_both, n, C1, C2, C3, sums, 0);
+    if (x < n)
+        _iqa_simd_scalar.ssim_parts_row(ref_mu+x, cmp_mu+x, ref_sigma_sqd+x, cmp_sigma_sqd+x, sigma_both+x, n-x,
+            C1, C2, C3, sums);
+}
+
+TARGET static void _fixed_h(const unsigned char *ref, const unsigned char *cmp, const int *k, int kw, int *dst, int stride, int n)
+{
+    int x,u;
+    __m256i r,d,kv,kr,kd,sx,sy,sxx,syy,sxy;
+
+    for (x=0; x+8 <= n; x+=8) {
+        sx = sy = sxx = syy = sxy = _mm256_setzero_si256();
+        for (u=0; u < kw; ++u) {
+            r = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(ref+x+u)));
+            d = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(cmp+x+u)));
+            kv = _mm256_set1_epi32(k[u]);
+            kr = _mm256_mullo_epi32(r, kv);
+            kd = _mm256_mullo_epi32(d, kv);
+            sx  = _mm256_add_epi32(sx, kr);
+            sy  = _mm256_add_epi32(sy, kd);
+            sxx = _mm256_add_epi32(sxx, _mm256_mullo_epi32(kr, r));
+            syy = _mm256_add_epi32(syy, _mm256_mullo_epi32(kd, d));
+            sxy = _mm256_add_epi32(sxy, _mm256_mullo_epi32(kr, d));
+        }
+        _mm256_storeu_si256((__m256i*)(dst+x), sx);
+        _mm256_storeu_si256((__m256i*)(dst+stride+x), sy);
+        _mm256_storeu_si256((__m256i*)(dst+2*stride+x), sxx);
+        _mm256_storeu_si256((__m256i*)(dst+3*stride+x), syy);
+        _mm256_storeu_si256((__m256i*)(dst+4*stride+x), sxy);
+    }
+    if (x < n)
+        _iqa_simd_scalar.fixed_h(ref+x, cmp+x, k, kw, dst+x, stride, n-x);
+}
+
+TARGET static void _fixed_v(const int *src, int stride, const int *k, int kh, long long *dst, int n)
+{
+    int x,v;
+    const int *row;
+    __m256i kv,lo,hi;
+
+    for (x=0; x+8 <= n; x+=8) {
+        lo = hi = _mm256_setzero_si256();
+        row = src + x;
+        for (v=0; v < kh; ++v, row += stride) {
+            kv = _mm256_set1_epi32(k[v]);
+            lo = _mm256_add_epi64(lo, _mm256_mul_epi32(_mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)row)), kv));
+            hi = _mm256_add_epi64(hi, _mm256_mul_epi32(_mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(row+4))), kv));
+        }
+        _mm256_storeu_si256((__m256i*)(dst+x), lo);
+        _mm256_storeu_si256((__m256i*)(dst+x+4), hi);
+    }
+    if (x < n)
+        _iqa_simd_scalar.fixed_v(src+x, stride, k, kh, dst+x, n-x);
+}
+
+const struct _iqa_simd _iqa_simd_avx2 = {
+    IQA_SIMD_AVX2,
+    "avx2",
+    _conv_h,
+    _conv_v,
+    _conv_2d,
+    _sse_row,
+    _ssim_row,
+    _ssim_parts_row,
+    _fixed_h,
+    _fixed_v
+};
+
+#endif /* IQA_SIMD_X86 */
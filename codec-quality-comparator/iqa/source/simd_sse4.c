@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2026, The codec-quality-comparator authors
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the copyright holder nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "simd.h"
+
+#ifdef IQA_SIMD_X86
+
+#include <smmintrin.h>
+#include <string.h>
+
+/*
+ * SSE4.1 kernels. Convolutions process 4 outputs per iteration and keep the
+ * scalar summation order, so the results are bit-exact with the scalar code.
+ * Leftover pixels at the end of a row go through the scalar implementation.
+ */
+
+#define TARGET __attribute__((target("sse4.1")))
+
+TARGET static void _conv_h(const float *src, const float *k, int kw, double *dst, int n)
+{
+    int x,u;
+    __m128 p;
+    __m128d lo,hi;
+
+    for (x=0; x+4 <= n; x+=4) {
+        lo = hi = _mm_setzero_pd();
+        for (u=0; u < kw; ++u) {
+            p = _mm_mul_ps(_mm_loadu_ps(src+x+u), _mm_set1_ps(k[u]));
+            lo = _mm_add_pd(lo, _mm_cvtps_pd(p));
+            hi = _mm_add_pd(hi, _mm_cvtps_pd(_mm_movehl_ps(p, p)));
+        }
+        _mm_storeu_pd(dst+x, lo);
+        _mm_storeu_pd(dst+x+2, hi);
+    }
+    if (x < n)
+        _iqa_simd_scalar.conv_h(src+x, k, kw, dst+x, n-x);
+}
+
+TARGET static void _conv_v(const double *src, int stride, const float *k, int kh, float scale, float *dst, int n)
+{
+    int x,v;
+    const double *row;
+    __m128d kv,lo,hi;
+    __m128d s = _mm_set1_pd(scale);
+
+    for (x=0; x+4 <= n; x+=4) {
+        lo = hi = _mm_setzero_pd();
+        row = src + x;
+        for (v=0; v < kh; ++v, row += stride) {
+            kv = _mm_set1_pd(k[v]);
+            lo = _mm_add_pd(lo, _mm_mul_pd(_mm_loadu_pd(row), kv));
+            hi = _mm_add_pd(hi, _mm_mul_pd(_mm_loadu_pd(row+2), kv));
+        }
+        _mm_storeu_ps(dst+x, _mm_movelh_ps(_mm_cvtpd_ps(_mm_mul_pd(lo, s)), _mm_cvtpd_ps(_mm_mul_pd(hi, s))));
+    }
+    if (x < n)
+        _iqa_simd_scalar.conv_v(src+x, stride, k, kh, scale, dst+x, n-x);
+}
+
+TARGET static void _conv_2d(const float *src, int w, const float *k, int kw, int kh, float scale, float *dst, int n)
+{
+    int x,u,v;
+    const float *row, *kr;
+    __m128 p;
+    __m128d lo,hi;
+    __m128d s = _mm_set1_pd(scale);
+
+    for (x=0; x+4 <= n; x+=4) {
+        lo = hi = _mm_setzero_pd();
+        row = src + x;
+        kr = k;
+        for (v=0; v < kh; ++v, row += w, kr += kw) {
+            for (u=0; u < kw; ++u) {
+                p = _mm_mul_ps(_mm_loadu_ps(row+u), _mm_set1_ps(kr[u]));
+                lo = _mm_add_pd(lo, _mm_cvtps_pd(p));
+                hi = _mm_add_pd(hi, _mm_cvtps_pd(_mm_movehl_ps(p, p)));
+            }
+        }
+        _mm_storeu_ps(dst+x, _mm_movelh_ps(_mm_cvtpd_ps(_mm_mul_pd(lo, s)), _mm_cvtpd_ps(_mm_mul_pd(hi, s))));
+    }
+    if (x < n)
+        _iqa_simd_scalar.conv_2d(src+x, w, k, kw, kh, scale, dst+x, n-x);
+}
+
+TARGET static unsigned long long _sse_row(const unsigned char *ref, const unsigned char *cmp, int n)
+{
+    int x,i,run;
+    unsigned int lanes[4];
+    unsigned long long sum=0;
+    __m128i a,b,acc;
+
+    /* Each 32-bit lane gains at most 2*255^2 per step. Flush them to the
+     * 64-bit sum well before they can overflow. */
+    for (x=0; x+8 <= n; ) {
+        acc = _mm_setzero_si128();
+        for (run=0; run < 4096 && x+8 <= n; ++run, x+=8) {
+            a = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(ref+x)));
+            b = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(cmp+x)));
+            a = _mm_sub_epi16(a, b);
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(a, a));
+        }
+        _mm_storeu_si128((__m128i*)lanes, acc);
+        for (i=0; i < 4; ++i)
+            sum += lanes[i];
+    }
+    if (x < n)
+        sum += _iqa_simd_scalar.sse_row(ref+x, cmp+x, n-x);
+    return sum;
+}
+
+TARGET static double _ssim_row(const float *ref_mu, const float *cmp_mu, const float *ref_sigma_sqd,
+    const float *cmp_sigma_sqd, const float *sigma_both, int n, float C1, float C2, double sum)
+{
+    int x;
+    double lanes[2];
+    __m128 m1,m2,s12,den;
+    __m128d num,acc;
+    const __m128 c1f = _mm_set1_ps(C1);
+    const __m128 c2f = _mm_set1_ps(C2);
+    const __m128d c1 = _mm_set1_pd(C1);
+    const __m128d c2 = _mm_set1_pd(C2);
+    const __m128d two = _mm_set1_pd(2.0);
+
+    acc = _mm_setzero_pd();
+    for (x=0; x+4 <= n; x+=4) {
+        m1 = _mm_loadu_ps(ref_mu+x);
+        m2 = _mm_loadu_ps(cmp_mu+x);
+        s12 = _mm_loadu_ps(sigma_both+x);
+
+        /* The denominator is computed in float, like the scalar code */
+        den = _mm_mul_ps(
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(m1, m1), _mm_mul_ps(m2, m2)), c1f),
+            _mm_add_ps(_mm_add_ps(_mm_loadu_ps(ref_sigma_sqd+x), _mm_loadu_ps(cmp_sigma_sqd+x)), c2f));
+
+        num = _mm_mul_pd(
+            _mm_add_pd(_mm_mul_pd(_mm_mul_pd(two, _mm_cvtps_pd(m1)), _mm_cvtps_pd(m2)), c1),
+            _mm_add_pd(_mm_mul_pd(two, _mm_cvtps_pd(s12)), c2));
+        acc = _mm_add_pd(acc, _mm_div_pd(num, _mm_cvtps_pd(den)));
+
+        m1 = _mm_movehl_ps(m1, m1);
+        m2 = _mm_movehl_ps(m2, m2);
+        s12 = _mm_movehl_ps(s12, s12);
+        num = _mm_mul_pd(
+            _mm_add_pd(_mm_mul_pd(_mm_mul_pd(two, _mm_cvtps_pd(m1)), _mm_cvtps_pd(m2)), c1),
+            _mm_add_pd(_mm_mul_pd(two, _mm_cvtps_pd(s12)), c2));
+        acc = _mm_add_pd(acc, _mm_div_pd(num, _mm_cvtps_pd(_mm_movehl_ps(den, den))));
+    }
+    _mm_storeu_pd(lanes, acc);
+    sum += lanes[0] + lanes[1];
+    if (x < n)
+        sum = _iqa_simd_scalar.ssim_row(ref_mu+x, cmp_mu+x, ref_sigma_sqd+x, cmp_sigma_sqd+x, sigma_both+x, n-x, C1, C2, sum);
+    return sum;
+}
+
+/* The lower (0) or upper (1) two floats of 'v', as doubles */
+TARGET static __inline__ __m128d _half_pd(__m128 v, int i)
+{
+    return _mm_cvtps_pd(i ? _mm_movehl_ps(v, v) : v);
+}
+
+/*
+ * ssim_parts_row() on groups of 4 pixels: the float parts in one vector, the
+ * double ones in two halves. 'zero' is a constant at both call sites, so the
+ * 0/0 cases are only compiled into the MS-SSIM* variant. Returns the number
+ * of pixels done.
+ */
+TARGET static __inline__ int _parts(const float *ref_mu, const float *cmp_mu, const float *ref_sigma_sqd,
+    const float *cmp_sigma_sqd, const float *sigma_both, int n, float C1, float C2, float C3, double *sums,
+    const int zero)
+{
+    int x,i;
+    double lanes[2];
+    __m128 m1,m2,v1,v2,mm1,mm2,vv,dl,dc,ns,pv;
+    __m128d root,l,c,s,e1,e2,rz,acc[4];
+    const __m128 zf = _mm_setzero_ps();
+    const __m128 c1f = _mm_set1_ps(C1);
+    const __m128 c2f = _mm_set1_ps(C2);
+    const __m128 c3f = _mm_set1_ps(C3);
+    const __m128d zd = _mm_setzero_pd();
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d two = _mm_set1_pd(2.0);
+    const __m128d c1 = _mm_set1_pd(C1);
+    const __m128d c2 = _mm_set1_pd(C2);
+    const __m128d c3 = _mm_set1_pd(C3);
+
+    for (i=0; i < 4; ++i)
+        acc[i] = _mm_setzero_pd();
+    for (x=0; x+4 <= n; x+=4) {
+        m1 = _mm_loadu_ps(ref_mu+x);
+        m2 = _mm_loadu_ps(cmp_mu+x);
+        /* max(0,v) keeps NaNs, like the scalar compare */
+        v1 = _mm_max_ps(zf, _mm_loadu_ps(ref_sigma_sqd+x));
+        v2 = _mm_max_ps(zf, _mm_loadu_ps(cmp_sigma_sqd+x));
+        mm1 = _mm_mul_ps(m1, m1);
+        mm2 = _mm_mul_ps(m2, m2);
+        vv = _mm_add_ps(v1, v2);
+        dl = _mm_add_ps(_mm_add_ps(mm1, mm2), c1f);
+        dc = _mm_add_ps(vv, c2f);
+        ns = _mm_add_ps(_mm_loadu_ps(sigma_both+x), c3f);
+        pv = _mm_mul_ps(v1, v2);
+
+        for (i=0; i < 2; ++i) {
+            root = _mm_sqrt_pd(_half_pd(pv, i));
+            l = _mm_div_pd(_mm_add_pd(_mm_mul_pd(_mm_mul_pd(two, _half_pd(m1, i)), _half_pd(m2, i)), c1),
+                _half_pd(dl, i));
+            c = _mm_div_pd(_mm_add_pd(_mm_mul_pd(two, root), c2), _half_pd(dc, i));
+            s = _mm_div_pd(_half_pd(ns, i), _mm_add_pd(root, c3));
+
+            if (zero) {
+                if (C1 == 0)
+                    l = _mm_blendv_pd(l, one, _mm_and_pd(_mm_cmpeq_pd(_half_pd(mm1, i), zd),
+                        _mm_cmpeq_pd(_half_pd(mm2, i), zd)));
+                if (C2 == 0)
+                    c = _mm_blendv_pd(c, one, _mm_cmpeq_pd(_half_pd(vv, i), zd));
+                if (C3 == 0) {
+                    e1 = _mm_cmpeq_pd(_half_pd(v1, i), zd);
+                    e2 = _mm_cmpeq_pd(_half_pd(v2, i), zd);
+                    rz = _mm_cmpeq_pd(root, zd);
+                    s = _mm_blendv_pd(s, zd, _mm_and_pd(rz, _mm_or_pd(e1, e2)));
+                    s = _mm_blendv_pd(s, one, _mm_and_pd(rz, _mm_and_pd(e1, e2)));
+                }
+            }
+
+            acc[0] = _mm_add_pd(acc[0], l);
+            acc[1] = _mm_add_pd(acc[1], c);
+            acc[2] = _mm_add_pd(acc[2], s);
+            acc[3] = _mm_add_pd(acc[3], _mm_mul_pd(_mm_mul_pd(l, c), s));
+        }
+    }
+    for (i=0; i < 4; ++i) {
+        _mm_storeu_pd(lanes, acc[i]);
+        sums[i] += lanes[0] + lanes[1];
+    }
+    return x;
+}
+
+TARGET static void _ssim_parts_row(const float *ref_mu, const float *cmp_mu, const float *ref_sigma_sqd,
+    const float *cmp_sigma_sqd, const float *sigma_both, int n, float C1, float C2, float C3, double *sums)
+{
+    int x;
+
+    if (C1 == 0 || C2 == 0 || C3 == 0)
+        x = _parts(ref_mu, cmp_mu, ref_sigma_sqd, cmp_sigma_sqd, sigma_both, n, C1, C2, C3, sums, 1);
+    else
+        x = _parts(ref_mu, cmp_mu, ref_sigma_sqd, cmp_sigma_sqd, sigma_both, n, C1, C2, C3, sums, 0);
+    if (x < n)
+        _iqa_simd_scalar.ssim_parts_row(ref_mu+x, cmp_mu+x, ref_sigma_sqd+x, cmp_sigma_sqd+x, sigma_both+x, n-x,
+            C1, C2, C3, sums);
+}
+
+TARGET static void _fixed_h(const unsigned char *ref, const unsigned char *cmp, const int *k, int kw, int *dst, int stride, int n)
+{
+    int x,u,pr,pd;
+    __m128i r,d,kv,kr,kd,sx,sy,sxx,syy,sxy;
+
+    for (x=0; x+4 <= n; x+=4) {
+        sx = sy = sxx = syy = sxy = _mm_setzero_si128();
+        for (u=0; u < kw; ++u) {
+            memcpy(&pr, ref+x+u, 4);
+            memcpy(&pd, cmp+x+u, 4);
+            r = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(pr));
+            d = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(pd));
+            kv = _mm_set1_epi32(k[u]);
+            kr = _mm_mullo_epi32(r, kv);
+            kd = _mm_mullo_epi32(d, kv);
+            sx  = _mm_add_epi32(sx, kr);
+            sy  = _mm_add_epi32(sy, kd);
+            sxx = _mm_add_epi32(sxx, _mm_mullo_epi32(kr, r));
+            syy = _mm_add_epi32(syy, _mm_mullo_epi32(kd, d));
+            sxy = _mm_add_epi32(sxy, _mm_mullo_epi32(kr, d));
+        }
+        _mm_storeu_si128((__m128i*)(dst+x), sx);
+        _mm_storeu_si128((__m128i*)(dst+stride+x), sy);
+        _mm_storeu_si128((__m128i*)(dst+2*stride+x), sxx);
+        _mm_storeu_si128((__m128i*)(dst+3*stride+x), syy);
+        _mm_storeu_si128((__m128i*)(dst+4*stride+x), sxy);
+    }
+    if (x < n)
+        _iqa_simd_scalar.fixed_h(ref+x, cmp+x, k, kw, dst+x, stride, n-x);
+}
+
+TARGET static void _fixed_v(const int *src, int stride, const int *k, int kh, long long *dst, int n)
+{
+    int x,v;
+    const int *row;
+    __m128i kv,lo,hi;
+
+    for (x=0; x+4 <= n; x+=4) {
+        lo = hi = _mm_setzero_si128();
+        row = src + x;
+        for (v=0; v < kh; ++v, row += stride) {
+            kv = _mm_set1_epi32(k[v]);
+            lo = _mm_add_epi64(lo, _mm_mul_epi32(_mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i*)row)), kv));
+            hi = _mm_add_epi64(hi, _mm_mul_epi32(_mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i*)(row+2))), kv));
+        }
+        _mm_storeu_si128((__m128i*)(dst+x), lo);
+        _mm_storeu_si128((__m128i*)(dst+x+2), hi);
+    }
+    if (x < n)
+        _iqa_simd_scalar.fixed_v(src+x, stride, k, kh, dst+x, n-x);
+}
+
+const struct _iqa_simd _iqa_simd_sse4 = {
+    IQA_SIMD_SSE4,
+    "sse4",
+    _conv_h,
+    _conv_v,
+    _conv_2d,
+    _sse_row,
+    _ssim_row,
+    _ssim_parts_row,
+    _fixed_h,
+    _fixed_v
+};
+
+#endif /* IQA_SIMD_X86 */
@@ -33,19 +33,137 @@
 
 #include "iqa.h"
 #include "convolve.h"
-#include "decimate.h"
 #include "math_utils.h"
 #include "ssim.h"
+#include "simd.h"
+#include "alloc.h"
+#include "pool.h"
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
 
+/*
+ * Stage timing. Converting input rows is timed where the band fills them;
+ * _rows_next() pulls them in, so its time includes theirs and the
+ * convolution alone is the difference.
+ */
+#define _SSIM_CONVERT   0       /* Input row conversion */
+#define _SSIM_NEXT      1       /* _rows_next(), including conversion */
+#define _SSIM_COMBINE   2       /* ssim_row() */
+#define _SSIM_STAGES    3
+
+/*
+ * Banded input for iqa_ssim(). The 8-bit images are converted (and, when
+ * scaling, low-pass filtered and decimated) one row at a time into rings of
+ * 2*kh rows as the window moves down, so no full-frame float copies are
+ * made. The decimation matches _iqa_decimate() with the scale x scale
+ * averaging filter.
+ */
+struct _ssim_band {
+    const unsigned char *img[2]; /* Reference and distorted images */
+    int w, h, stride;           /* Source size */
+    int sw;                     /* Row width after decimation */
+    int scale;                  /* Decimation factor */
+    int kh;                     /* Window height */
+    float lpf;                  /* Low-pass filter weight, 1/(scale*scale) */
+    int first_img, last_img;    /* Images converted: both, or just one when sharing a reference */
+    double *times;              /* Stage timing, or 0 */
+    float *ring[2];             /* 2*kh rows of 'sw' values per image */
+    int last;                   /* Newest row in the rings. -1 if none */
+};
+
+/*
+ * Fixed-point SSIM (iqa_ssim_ws_set_integer()). The 8-bit input rows (or,
+ * when scaling, their block averages rounded to 8 bits) are filtered
+ * horizontally by simd->fixed_h into rings of 2*kh rows of exact integer
+ * sums, as in the separable float path, and simd->fixed_v sums the window
+ * vertically in 64 bits. With integer weights adding up to at most 1024 and
+ * n = SUM(k)^2 <= 2^20:
+ *   SUM(k*x)   < n*2^8  <= 2^28
+ *   SUM(k*x*x) < n*2^16 <= 2^36
+ * so every integer term of the final ratio, such as n*SUM(k*x*x) or
+ * SUM(k*x)^2, is below 2^57. Only that ratio is computed in floating point,
+ * one window after another, so the result doesn't depend on the SIMD level.
+ */
+struct _ssim_fixed {
+    const int *k;               /* Integer 1-D window weights */
+    int kw;                     /* Window width and height */
+    long long n;                /* SUM(k)^2, the weight of the whole window */
+    double c1, c2;              /* C1 and C2 scaled by n^2 */
+    const struct _iqa_simd *simd;
+    double *times;              /* Stage timing, or 0 */
+    int ow;                     /* Output width */
+    int y;                      /* Next output row */
+    int *ring;                  /* 5 rings of 2*kw horizontal sum rows (ow wide) */
+    long long *sums;            /* 5 rows of window sums (ow wide) */
+    unsigned char *dec;         /* 2 decimated input rows (sw wide) when scaling. Else 0 */
+};
+
+/*
+ * A horizontal strip of output rows [y0,y1) scored by one pool task. Each
+ * tile has its own input band and row buffers, and reads the kh-1 input rows
+ * below its last output row (the halo) itself, so tiles are independent.
+ */
+struct _ssim_tile {
+    struct _ssim_band band;
+    struct _ssim_rows rows;
+    struct _ssim_fixed fixed;   /* Allocated while the workspace is fixed-point */
+    int y0, y1;
+    double times[_SSIM_STAGES];
+};
+
+/* SSIM workspace. See iqa_ssim_ws_create(). */
+struct iqa_ssim_ws {
+    int w, h;                   /* Frame size */
+    int sh;                     /* Frame height after scaling */
+    int has_args;               /* 1 if 'args' should be used */
+    struct iqa_ssim_args args;
+    struct _kernel window;
+    struct _ssim_band band;     /* Rows of the current frame pair */
+    struct _ssim_rows rows;
+    struct _iqa_pool *pool;     /* Set by iqa_ssim_ws_set_threads(). 0 if serial */
+    struct _ssim_tile *tiles;
+    int ntiles;
+    double *row_sums;           /* Per output row SSIM sums from the tiles */
+    int ncand;                  /* Distorted images iqa_ssim_ws_run_multi() has buffers for */
+    struct _ssim_band *cand_bands; /* Their bands, sharing ring[0] with 'band' */
+    struct _ssim_rows *cand_rows;  /* Their _SSIM_CMP rows, led by 'rows' */
+    double *cand_sums;
+    int timing;                 /* Set by iqa_ssim_ws_set_timing() */
+    int integer;                /* Set by iqa_ssim_ws_set_integer() */
+    struct _ssim_fixed fixed;   /* Serial fixed-point buffers */
+    double times[_SSIM_STAGES]; /* Serial and iqa_ssim_ws_run_multi() stage times */
+};
+
 /* Forward declarations. */
 IQA_INLINE static double _calc_luminance(float, float, float, float);
 IQA_INLINE static double _calc_contrast(double, float, float, float, float);
 IQA_INLINE static double _calc_structure(float, double, float, float, float, float);
-static int _ssim_map(const struct _ssim_int *, void *);
 static float _ssim_reduce(int, int, void *);
+static int _is_box(const struct _kernel *);
+static float _ssim_run(struct _ssim_rows *, const float *, const float *, _ssim_get_row, void *, int, int, const struct _map_reduce *, const struct iqa_ssim_args *);
+static void _rows_bind(struct _ssim_rows *, const float *, const float *, _ssim_get_row, void *, int, int);
+static void _rows_start(struct _ssim_rows *, int);
+static void _rows_next(struct _ssim_rows *);
+static const float *_band_row(void *, int, int);
+static int _band_alloc(struct _ssim_band *);
+static void _free_tiles(struct iqa_ssim_ws *);
+static int _alloc_cands(struct iqa_ssim_ws *, int);
+static void _free_cands(struct iqa_ssim_ws *);
+static void _ssim_tile_task(void *, int);
+static void _set_times(struct iqa_ssim_ws *);
+static double _rows_score(struct _ssim_rows *, float, float);
+static void _rows_parts(struct _ssim_rows *, float, float, float, double *);
+static void _rows_advance(struct _ssim_rows *);
+static int _fixed_alloc(struct _ssim_fixed *, const struct iqa_ssim_ws *);
+static void _fixed_free(struct _ssim_fixed *);
+static double _fixed_run(struct _ssim_fixed *, struct _ssim_band *, int, int, double *);
 
 /* 
  * SSIM(x,y)=(2*ux*uy + C1)*(2sxy + C2) / (ux^2 + uy^2 + C1)*(sx^2 + sy^2 + C2)
@@ -59,97 +177,501 @@ static float _ssim_reduce(int, int, void *);
 float iqa_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride,
     int gaussian, const struct iqa_ssim_args *args)
 {
-    int scale;
-    int x,y,src_offset,offset;
-    float *ref_f,*cmp_f;
-    struct _kernel low_pass;
-    struct _kernel window;
     float result;
-    double ssim_sum=0.0;
-    struct _map_reduce mr;
+    struct iqa_ssim_ws *ws;
+
+    ws = iqa_ssim_ws_create(w, h, gaussian, args);
+    if (!ws)
+        return INFINITY;
+    result = iqa_ssim_ws_run(ws, ref, cmp, stride);
+    iqa_ssim_ws_destroy(ws);
+    return result;
+}
+
+/* iqa_ssim_ws_create */
+struct iqa_ssim_ws *iqa_ssim_ws_create(int w, int h, int gaussian, const struct iqa_ssim_args *args)
+{
+    int scale;
+    struct iqa_ssim_ws *ws;
+
+    ws = (struct iqa_ssim_ws*)calloc(1, sizeof(struct iqa_ssim_ws));
+    if (!ws)
+        return 0;
+    ws->w = w;
+    ws->h = h;
 
     /* Initialize algorithm parameters */
     scale = _max( 1, _round( (float)_min(w,h) / 256.0f ) );
     if (args) {
         if(args->f)
             scale = args->f;
-        mr.map     = _ssim_map;
-        mr.reduce  = _ssim_reduce;
-        mr.context = (void*)&ssim_sum;
-    }
-    window.kernel = (float*)g_square_window;
-    window.w = window.h = SQUARE_LEN;
-    window.normalized = 1;
-    window.bnd_opt = KBND_SYMMETRIC;
+        ws->args = *args;
+        ws->has_args = 1;
+    }
+    ws->window.kernel = (float*)g_square_window;
+    ws->window.w = ws->window.h = SQUARE_LEN;
+    ws->window.normalized = 1;
+    ws->window.bnd_opt = KBND_SYMMETRIC;
+    ws->window.kernel_h = ws->window.kernel_v = 0;
     if (gaussian) {
-        window.kernel = (float*)g_gaussian_window;
-        window.w = window.h = GAUSSIAN_LEN;
+        ws->window.kernel = (float*)g_gaussian_window;
+        ws->window.w = ws->window.h = GAUSSIAN_LEN;
+        ws->window.kernel_h = ws->window.kernel_v = (float*)g_gaussian_1d;
     }
 
-    /* Convert image values to floats. Forcing stride = width. */
-    ref_f = (float*)malloc(w*h*sizeof(float));
-    cmp_f = (float*)malloc(w*h*sizeof(float));
-    if (!ref_f || !cmp_f) {
-        if (ref_f) free(ref_f);
-        if (cmp_f) free(cmp_f);
-        return INFINITY;
+    /* Only the rows under the window are kept, converted and scaled as needed */
+    ws->band.w = w;
+    ws->band.h = h;
+    ws->band.scale = scale;
+    ws->band.sw = w;
+    ws->sh = h;
+    if (scale > 1) {
+        ws->band.sw = w/scale + (w&1);
+        ws->sh = h/scale + (h&1);
     }
-    for (y=0; y<h; ++y) {
-        src_offset = y*stride;
-        offset = y*w;
-        for (x=0; x<w; ++x, ++offset, ++src_offset) {
-            ref_f[offset] = (float)ref[src_offset];
-            cmp_f[offset] = (float)cmp[src_offset];
+    ws->band.kh = ws->window.h;
+    ws->band.lpf = 1.0f/(scale*scale);
+    ws->band.first_img = 0;
+    ws->band.last_img = 1;
+    if (_band_alloc(&ws->band) ||
+        _iqa_ssim_rows_alloc(&ws->rows, ws->band.sw, ws->sh, &ws->window)) {
+        iqa_ssim_ws_destroy(ws);
+        return 0;
+    }
+    return ws;
+}
+
+/* iqa_ssim_ws_set_threads */
+int iqa_ssim_ws_set_threads(struct iqa_ssim_ws *ws, int threads)
+{
+    int t, oh;
+
+    _free_tiles(ws);
+
+    /* At most one tile per output row. Custom 'args' go through map-reduce,
+     * which accumulates into one shared context, so those stay serial. */
+    oh = ws->sh - ws->window.h + 1;
+    if (threads > oh)
+        threads = oh;
+    if (threads < 2 || ws->has_args || ws->band.sw < ws->window.w)
+        return 1;
+
+    ws->tiles = (struct _ssim_tile*)calloc(threads, sizeof(struct _ssim_tile));
+    ws->row_sums = (double*)_iqa_alloc(oh*sizeof(double));
+    if (!ws->tiles || !ws->row_sums) {
+        _free_tiles(ws);
+        return 1;
+    }
+    ws->ntiles = threads;
+    for (t=0; t<threads; ++t) {
+        ws->tiles[t].band = ws->band;
+        ws->tiles[t].y0 = (int)((long long)oh*t/threads);
+        ws->tiles[t].y1 = (int)((long long)oh*(t+1)/threads);
+        if (_band_alloc(&ws->tiles[t].band) ||
+            _iqa_ssim_rows_alloc(&ws->tiles[t].rows, ws->band.sw, ws->sh, &ws->window) ||
+            (ws->integer && _fixed_alloc(&ws->tiles[t].fixed, ws))) {
+            _free_tiles(ws);
+            return 1;
         }
     }
+    ws->pool = _iqa_pool_create(threads);
+    if (!ws->pool) {
+        _free_tiles(ws);
+        return 1;
+    }
+    _set_times(ws);
+    return threads;
+}
 
-    /* Scale the images down if required */
-    if (scale > 1) {
-        /* Generate simple low-pass filter */
-        low_pass.kernel = (float*)malloc(scale*scale*sizeof(float));
-        if (!low_pass.kernel) {
-            free(ref_f);
-            free(cmp_f);
-            return INFINITY;
+/* iqa_ssim_ws_run */
+float iqa_ssim_ws_run(struct iqa_ssim_ws *ws, const unsigned char *ref, const unsigned char *cmp, int stride)
+{
+    int t, y, oh;
+    double ssim_sum=0.0;
+    struct _map_reduce mr;
+    struct _ssim_int sums;
+
+    if (ws->pool) {
+        for (t=0; t<ws->ntiles; ++t) {
+            ws->tiles[t].band.img[0] = ref;
+            ws->tiles[t].band.img[1] = cmp;
+            ws->tiles[t].band.stride = stride;
+            ws->tiles[t].band.last = ws->tiles[t].y0 - 1;
         }
-        low_pass.w = low_pass.h = scale;
-        low_pass.normalized = 0;
-        low_pass.bnd_opt = KBND_SYMMETRIC;
-        for (offset=0; offset<scale*scale; ++offset)
-            low_pass.kernel[offset] = 1.0f/(scale*scale);
-
-        /* Resample */
-        if (_iqa_decimate(ref_f, w, h, scale, &low_pass, 0, 0, 0) ||
-            _iqa_decimate(cmp_f, w, h, scale, &low_pass, 0, &w, &h)) { /* Update w/h */
-            free(ref_f);
-            free(cmp_f);
-            free(low_pass.kernel);
-            return INFINITY;
+        _iqa_pool_run(ws->pool, _ssim_tile_task, ws, ws->ntiles);
+
+        /* Rows are added in order, so the result doesn't depend on the tiling */
+        oh = ws->tiles[ws->ntiles-1].y1;
+        for (y=0; y<oh; ++y)
+            ssim_sum += ws->row_sums[y];
+        return (float)(ssim_sum / (double)((ws->band.sw - ws->window.w + 1)*oh));
+    }
+
+    ws->band.img[0] = ref;
+    ws->band.img[1] = cmp;
+    ws->band.stride = stride;
+    ws->band.last = -1;
+    if (ws->integer) {
+        oh = ws->sh - ws->window.h + 1;
+        ssim_sum = _fixed_run(&ws->fixed, &ws->band, 0, oh, 0);
+        return (float)(ssim_sum / (double)(ws->fixed.ow*oh));
+    }
+
+    memset(&sums, 0, sizeof(sums));
+    mr.map     = 0;
+    mr.reduce  = _ssim_reduce;
+    mr.context = (void*)&sums;
+    return _ssim_run(&ws->rows, 0, 0, _band_row, &ws->band, ws->band.sw, ws->sh, &mr,
+        ws->has_args ? &ws->args : 0);
+}
+
+/* iqa_ssim_ws_run_multi */
+int iqa_ssim_ws_run_multi(struct iqa_ssim_ws *ws, const unsigned char *ref, const unsigned char *const *cmp, int n,
+    int stride, float *results)
+{
+    int i, y;
+    float C1 = (0.01f*255)*(0.01f*255);
+    float C2 = (0.03f*255)*(0.03f*255);
+    struct _ssim_rows *sr;
+
+    /* Only the serial default algorithm, in floating point, shares the reference */
+    if (ws->has_args || ws->pool || ws->integer || ws->band.sw < ws->window.w || ws->sh < ws->window.h) {
+        for (i=0; i<n; ++i)
+            results[i] = iqa_ssim_ws_run(ws, ref, cmp[i], stride);
+        return 0;
+    }
+    if (n > ws->ncand && _alloc_cands(ws, n))
+        return 1;
+
+    /* The workspace's own band and rows convert the reference and compute
+     * its statistics. They must be bound first, so the candidates can point
+     * at its mu1 and s1. */
+    ws->band.img[0] = ref;
+    ws->band.stride = stride;
+    ws->band.last = -1;
+    ws->band.last_img = 0;
+    ws->rows.streams = _SSIM_REF;
+    _rows_bind(&ws->rows, 0, 0, _band_row, &ws->band, ws->band.sw, ws->sh);
+    for (i=0; i<n; ++i) {
+        ws->cand_bands[i].img[1] = cmp[i];
+        ws->cand_bands[i].stride = stride;
+        ws->cand_bands[i].last = -1;
+        _rows_bind(&ws->cand_rows[i], 0, 0, _band_row, &ws->cand_bands[i], ws->band.sw, ws->sh);
+        ws->cand_sums[i] = 0.0;
+    }
+
+    /* Row by row, the reference first: each new reference row is in the
+     * shared ring before the candidates read it, and stays there until they
+     * have moved past it. */
+    _rows_start(&ws->rows, 0);
+    for (i=0; i<n; ++i)
+        _rows_start(&ws->cand_rows[i], 0);
+    for (y=0; y<ws->rows.oh; ++y) {
+        _rows_advance(&ws->rows);
+        for (i=0; i<n; ++i) {
+            sr = &ws->cand_rows[i];
+            ws->cand_sums[i] += _rows_score(sr, C1, C2);
         }
-        free(low_pass.kernel);
     }
+    for (i=0; i<n; ++i)
+        results[i] = (float)(ws->cand_sums[i] / (double)(ws->rows.ow*ws->rows.oh));
 
-    result = _iqa_ssim(ref_f, cmp_f, w, h, &window, &mr, args);
-    
-    free(ref_f);
-    free(cmp_f);
+    ws->band.last_img = 1;
+    ws->rows.streams = _SSIM_ALL;
+    return 0;
+}
 
-    return result;
+/* iqa_ssim_ws_set_integer */
+int iqa_ssim_ws_set_integer(struct iqa_ssim_ws *ws, int enable)
+{
+    int t;
+
+    _fixed_free(&ws->fixed);
+    for (t=0; t<ws->ntiles; ++t)
+        _fixed_free(&ws->tiles[t].fixed);
+    ws->integer = 0;
+
+    /* Only the default algorithm, with at least one window to score */
+    if (!enable || ws->has_args || ws->band.sw < ws->window.w || ws->sh < ws->window.h)
+        return 0;
+    if (_fixed_alloc(&ws->fixed, ws))
+        return 0;
+    for (t=0; t<ws->ntiles; ++t) {
+        if (_fixed_alloc(&ws->tiles[t].fixed, ws)) {
+            iqa_ssim_ws_set_integer(ws, 0);
+            return 0;
+        }
+    }
+    ws->integer = 1;
+    _set_times(ws);
+    return 1;
+}
+
+/* iqa_ssim_ws_reserve_multi */
+int iqa_ssim_ws_reserve_multi(struct iqa_ssim_ws *ws, int n)
+{
+    if (n > ws->ncand)
+        return _alloc_cands(ws, n);
+    return 0;
+}
+
+/* iqa_ssim_ws_set_timing */
+void iqa_ssim_ws_set_timing(struct iqa_ssim_ws *ws, int enable)
+{
+    struct iqa_ssim_timing discard;
+
+    ws->timing = enable ? 1 : 0;
+    _set_times(ws);
+    iqa_ssim_ws_take_timing(ws, &discard);
+}
+
+/* iqa_ssim_ws_take_timing */
+void iqa_ssim_ws_take_timing(struct iqa_ssim_ws *ws, struct iqa_ssim_timing *timing)
+{
+    double times[_SSIM_STAGES];
+    int s, t;
+
+    for (s=0; s<_SSIM_STAGES; ++s) {
+        times[s] = ws->times[s];
+        ws->times[s] = 0.0;
+        for (t=0; t<ws->ntiles; ++t) {
+            times[s] += ws->tiles[t].times[s];
+            ws->tiles[t].times[s] = 0.0;
+        }
+    }
+    timing->convert = times[_SSIM_CONVERT];
+    timing->filter  = times[_SSIM_NEXT] - times[_SSIM_CONVERT];
+    timing->combine = times[_SSIM_COMBINE];
+}
+
+/* iqa_ssim_ws_destroy */
+void iqa_ssim_ws_destroy(struct iqa_ssim_ws *ws)
+{
+    if (!ws)
+        return;
+    _free_tiles(ws);
+    _free_cands(ws);
+    _fixed_free(&ws->fixed);
+    _iqa_free(ws->band.ring[0]);
+    _iqa_free(ws->band.ring[1]);
+    _iqa_ssim_rows_free(&ws->rows);
+    free(ws);
+}
+
+/* Allocates the input rings of a band */
+static int _band_alloc(struct _ssim_band *b)
+{
+    b->ring[0] = (float*)_iqa_alloc(2*b->kh*b->sw*sizeof(float));
+    b->ring[1] = (float*)_iqa_alloc(2*b->kh*b->sw*sizeof(float));
+    return (!b->ring[0] || !b->ring[1]) ? 1 : 0;
+}
+
+/* Stops the pool and releases the tiles */
+static void _free_tiles(struct iqa_ssim_ws *ws)
+{
+    int t;
+
+    _iqa_pool_destroy(ws->pool);
+    ws->pool = 0;
+    if (ws->tiles) {
+        for (t=0; t<ws->ntiles; ++t) {
+            _iqa_free(ws->tiles[t].band.ring[0]);
+            _iqa_free(ws->tiles[t].band.ring[1]);
+            _iqa_ssim_rows_free(&ws->tiles[t].rows);
+            _fixed_free(&ws->tiles[t].fixed);
+        }
+        free(ws->tiles);
+    }
+    _iqa_free(ws->row_sums);
+    ws->tiles = 0;
+    ws->row_sums = 0;
+    ws->ntiles = 0;
+}
+
+/* Makes room for 'n' distorted images in iqa_ssim_ws_run_multi() */
+static int _alloc_cands(struct iqa_ssim_ws *ws, int n)
+{
+    int i;
+
+    _free_cands(ws);
+    ws->cand_bands = (struct _ssim_band*)calloc(n, sizeof(struct _ssim_band));
+    ws->cand_rows = (struct _ssim_rows*)calloc(n, sizeof(struct _ssim_rows));
+    ws->cand_sums = (double*)calloc(n, sizeof(double));
+    if (!ws->cand_bands || !ws->cand_rows || !ws->cand_sums) {
+        _free_cands(ws);
+        return 1;
+    }
+    ws->ncand = n;
+    for (i=0; i<n; ++i) {
+        ws->cand_bands[i] = ws->band;
+        ws->cand_bands[i].first_img = ws->cand_bands[i].last_img = 1;
+        ws->cand_bands[i].ring[1] = (float*)_iqa_alloc(2*ws->band.kh*ws->band.sw*sizeof(float));
+        if (!ws->cand_bands[i].ring[1] ||
+            _iqa_ssim_rows_alloc(&ws->cand_rows[i], ws->band.sw, ws->sh, &ws->window)) {
+            _free_cands(ws);
+            return 1;
+        }
+        ws->cand_rows[i].streams = _SSIM_CMP;
+        ws->cand_rows[i].lead = &ws->rows;
+    }
+    _set_times(ws);
+    return 0;
+}
+
+/* Releases the buffers of iqa_ssim_ws_run_multi() */
+static void _free_cands(struct iqa_ssim_ws *ws)
+{
+    int i;
+
+    if (ws->cand_bands) {
+        for (i=0; i<ws->ncand; ++i) {
+            _iqa_free(ws->cand_bands[i].ring[1]);   /* ring[0] is the workspace's */
+            _iqa_ssim_rows_free(&ws->cand_rows[i]);
+        }
+    }
+    free(ws->cand_bands);
+    free(ws->cand_rows);
+    free(ws->cand_sums);
+    ws->cand_bands = 0;
+    ws->cand_rows = 0;
+    ws->cand_sums = 0;
+    ws->ncand = 0;
+}
+
+/* Scores the output rows of tile 't' into ws->row_sums (default parameters) */
+static void _ssim_tile_task(void *ctx, int t)
+{
+    struct iqa_ssim_ws *ws = (struct iqa_ssim_ws*)ctx;
+    struct _ssim_tile *tile = &ws->tiles[t];
+    struct _ssim_rows *sr = &tile->rows;
+    float C1 = (0.01f*255)*(0.01f*255);
+    float C2 = (0.03f*255)*(0.03f*255);
+    int y;
+
+    if (ws->integer) {
+        _fixed_run(&tile->fixed, &tile->band, tile->y0, tile->y1, ws->row_sums);
+        return;
+    }
+    _rows_bind(sr, 0, 0, _band_row, &tile->band, ws->band.sw, ws->sh);
+    _rows_start(sr, tile->y0);
+    for (y=tile->y0; y<tile->y1; ++y)
+        ws->row_sums[y] = _rows_score(sr, C1, C2);
+}
+
+/* Points every band and row set of the workspace at its stage times, or at
+ * none when timing is off. Tiles keep their own, as they run in parallel. */
+static void _set_times(struct iqa_ssim_ws *ws)
+{
+    int i;
+
+    ws->band.times = ws->rows.times = ws->fixed.times = ws->timing ? ws->times : 0;
+    for (i=0; i<ws->ntiles; ++i) {
+        ws->tiles[i].band.times = ws->tiles[i].rows.times = ws->tiles[i].fixed.times =
+            ws->timing ? ws->tiles[i].times : 0;
+    }
+    for (i=0; i<ws->ncand; ++i)
+        ws->cand_bands[i].times = ws->cand_rows[i].times = ws->band.times;
+}
+
+/* Monotonic time in seconds, for stage timing */
+static double _seconds(void)
+{
+#ifdef WIN32
+    LARGE_INTEGER now, freq;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+#endif
+}
+
+/* _rows_next(), timed if the rows have stage times */
+static void _rows_advance(struct _ssim_rows *sr)
+{
+    double start;
+
+    if (!sr->times) {
+        _rows_next(sr);
+        return;
+    }
+    start = _seconds();
+    _rows_next(sr);
+    sr->times[_SSIM_NEXT] += _seconds() - start;
+}
+
+/* Moves to the next output row and returns its SSIM sum (default parameters) */
+static double _rows_score(struct _ssim_rows *sr, float C1, float C2)
+{
+    double start, sum;
+
+    _rows_advance(sr);
+    if (!sr->times)
+        return sr->simd->ssim_row(sr->mu1, sr->mu2, sr->s1, sr->s2, sr->s12, sr->ow, C1, C2, 0.0);
+    start = _seconds();
+    sum = sr->simd->ssim_row(sr->mu1, sr->mu2, sr->s1, sr->s2, sr->s12, sr->ow, C1, C2, 0.0);
+    sr->times[_SSIM_COMBINE] += _seconds() - start;
+    return sum;
+}
+
+/* Moves to the next output row and adds its SSIM terms to sums[0..3] (exponents of 1) */
+static void _rows_parts(struct _ssim_rows *sr, float C1, float C2, float C3, double *sums)
+{
+    double start;
+
+    _rows_advance(sr);
+    if (!sr->times) {
+        sr->simd->ssim_parts_row(sr->mu1, sr->mu2, sr->s1, sr->s2, sr->s12, sr->ow, C1, C2, C3, sums);
+        return;
+    }
+    start = _seconds();
+    sr->simd->ssim_parts_row(sr->mu1, sr->mu2, sr->s1, sr->s2, sr->s12, sr->ow, C1, C2, C3, sums);
+    sr->times[_SSIM_COMBINE] += _seconds() - start;
 }
 
 
 /* _iqa_ssim */
 float _iqa_ssim(float *ref, float *cmp, int w, int h, const struct _kernel *k, const struct _map_reduce *mr, const struct iqa_ssim_args *args)
+{
+    float result;
+    struct _ssim_rows sr;
+
+    if (_iqa_ssim_rows_alloc(&sr, w, h, k))
+        return INFINITY;
+    result = _iqa_ssim_rows(&sr, ref, cmp, w, h, mr, args);
+    _iqa_ssim_rows_free(&sr);
+    return result;
+}
+
+/* _iqa_ssim_rows */
+float _iqa_ssim_rows(struct _ssim_rows *sr, const float *ref, const float *cmp, int w, int h,
+    const struct _map_reduce *mr, const struct iqa_ssim_args *args)
+{
+    return _ssim_run(sr, ref, cmp, 0, 0, w, h, mr, args);
+}
+
+
+/*
+ * _ssim_run
+ *
+ * Implements _iqa_ssim() with preallocated row buffers, on either full
+ * images ('ref' and 'cmp') or rows supplied by 'get'.
+ */
+static float _ssim_run(struct _ssim_rows *sr, const float *ref, const float *cmp, _ssim_get_row get, void *ctx,
+    int w, int h, const struct _map_reduce *mr, const struct iqa_ssim_args *args)
 {
     float alpha=1.0f, beta=1.0f, gamma=1.0f;
     int L=255;
     float K1=0.01f, K2=0.03f;
     float C1,C2,C3;
-    int x,y,offset;
-    float *ref_mu,*cmp_mu,*ref_sigma_sqd,*cmp_sigma_sqd,*sigma_both;
-    double ssim_sum, numerator, denominator;
+    int x,y,ones;
+    double ssim_sum;
     double luminance_comp, contrast_comp, structure_comp, sigma_root;
-    struct _ssim_int sint;
+    double parts[4];
+    struct _ssim_int sint, *sums=0;
+    const struct _kernel *k = sr->k;
 
     /* Initialize algorithm parameters */
     if (args) {
@@ -166,109 +688,671 @@ float _iqa_ssim(float *ref, float *cmp, int w, int h, const struct _kernel *k, c
     C2 = (K2*L)*(K2*L);
     C3 = C2 / 2.0f;
 
-    ref_mu = (float*)malloc(w*h*sizeof(float));
-    cmp_mu = (float*)malloc(w*h*sizeof(float));
-    ref_sigma_sqd = (float*)malloc(w*h*sizeof(float));
-    cmp_sigma_sqd = (float*)malloc(w*h*sizeof(float));
-    sigma_both = (float*)malloc(w*h*sizeof(float));
-    if (!ref_mu || !cmp_mu || !ref_sigma_sqd || !cmp_sigma_sqd || !sigma_both) {
-        if (ref_mu) free(ref_mu);
-        if (cmp_mu) free(cmp_mu);
-        if (ref_sigma_sqd) free(ref_sigma_sqd);
-        if (cmp_sigma_sqd) free(cmp_sigma_sqd);
-        if (sigma_both) free(sigma_both);
-        return INFINITY;
+    /* Without a map the terms are summed here, a row at a time if there are
+     * no exponents to apply */
+    if (args && !mr->map)
+        sums = (struct _ssim_int*)mr->context;
+    ones = alpha == 1.0f && beta == 1.0f && gamma == 1.0f;
+    if (sums) {
+        parts[0] = sums->l;
+        parts[1] = sums->c;
+        parts[2] = sums->s;
+        parts[3] = sums->lcs;
     }
 
-    /* Calculate mean */
-    _iqa_convolve(ref, w, h, k, ref_mu, 0, 0);
-    _iqa_convolve(cmp, w, h, k, cmp_mu, 0, 0);
+    if (w < k->w || h < k->h) {
+        /* Window doesn't fit: there are no output pixels */
+        if (!args)
+            return (float)(0.0 / (double)((w - k->w + 1)*(h - k->h + 1)));
+        return mr->reduce(w - k->w + 1, h - k->h + 1, mr->context);
+    }
 
-    for (y=0; y<h; ++y) {
-        offset = y*w;
-        for (x=0; x<w; ++x, ++offset) {
-            ref_sigma_sqd[offset] = ref[offset] * ref[offset];
-            cmp_sigma_sqd[offset] = cmp[offset] * cmp[offset];
-            sigma_both[offset] = ref[offset] * cmp[offset];
+    /* The statistics are produced one row at a time and consumed right away */
+    _rows_bind(sr, ref, cmp, get, ctx, w, h);
+    _rows_start(sr, 0);
+
+    ssim_sum = 0.0;
+    for (y=0; y<sr->oh; ++y) {
+        if (!args) {
+            /* The default case. Summed per row, the same as the tiles of iqa_ssim_ws_set_threads() */
+            ssim_sum += _rows_score(sr, C1, C2);
+            continue;
+        }
+        if (sums && ones) {
+            _rows_parts(sr, C1, C2, C3, parts);
+            continue;
+        }
+        _rows_advance(sr);
+
+        /* User tweaked alpha, beta, or gamma */
+        for (x=0; x<sr->ow; ++x) {
+            /* passing a negative number to sqrt() cause a domain error */
+            if (sr->s1[x] < 0.0f)
+                sr->s1[x] = 0.0f;
+            if (sr->s2[x] < 0.0f)
+                sr->s2[x] = 0.0f;
+            sigma_root = sqrt(sr->s1[x] * sr->s2[x]);
+
+            luminance_comp = _calc_luminance(sr->mu1[x], sr->mu2[x], C1, alpha);
+            contrast_comp  = _calc_contrast(sigma_root, sr->s1[x], sr->s2[x], C2, beta);
+            structure_comp = _calc_structure(sr->s12[x], sigma_root, sr->s1[x], sr->s2[x], C3, gamma);
+
+            if (sums) {
+                parts[0] += luminance_comp;
+                parts[1] += contrast_comp;
+                parts[2] += structure_comp;
+                parts[3] += luminance_comp * contrast_comp * structure_comp;
+                continue;
+            }
+            sint.l = luminance_comp;
+            sint.c = contrast_comp;
+            sint.s = structure_comp;
+            sint.lcs = 0.0;
+
+            if (mr->map(&sint, mr->context))
+                return INFINITY;
         }
     }
+    if (sums) {
+        sums->l = parts[0];
+        sums->c = parts[1];
+        sums->s = parts[2];
+        sums->lcs = parts[3];
+    }
+
+    w = sr->ow; /* The results are smaller by the kernel width and height */
+    h = sr->oh;
+
+    if (!args)
+        return (float)(ssim_sum / (double)(w*h));
+    return mr->reduce(w, h, mr->context);
+}
+
+
+/* _is_box */
+static int _is_box(const struct _kernel *k)
+{
+    int offset, k_len = k->w * k->h;
+    for (offset=1; offset<k_len; ++offset) {
+        if (k->kernel[offset] != k->kernel[0])
+            return 0;
+    }
+    return 1;
+}
+
+/* _iqa_ssim_rows_alloc */
+int _iqa_ssim_rows_alloc(struct _ssim_rows *sr, int w, int h, const struct _kernel *k)
+{
+    int ii, k_len;
+    int ow = _max(w - k->w + 1, 1);
+    double sum;
+
+    memset(sr, 0, sizeof(*sr));
+    sr->k = k;
+    sr->simd = _iqa_simd();
+    sr->streams = _SSIM_ALL;
+
+    /* Same normalization as _iqa_convolve */
+    sr->scale = 1.0f;
+    if (!k->normalized) {
+        k_len = k->w * k->h;
+        for (ii=0, sum=0.0; ii<k_len; ++ii)
+            sum += k->kernel[ii];
+        if (sum != 0.0)
+            sr->scale = (float)(1.0 / sum);
+    }
 
-    /* Calculate sigma */
-    _iqa_convolve(ref_sigma_sqd, w, h, k, 0, 0, 0);
-    _iqa_convolve(cmp_sigma_sqd, w, h, k, 0, 0, 0);
-    _iqa_convolve(sigma_both, w, h, k, 0, &w, &h); /* Update the width and height */
+    if (_is_box(k)) {
+        sr->mode = _SSIM_BOX;
+        sr->weight = k->kernel[0];
+        if (!k->normalized && k->kernel[0] != 0.0f)
+            sr->weight = 1.0 / (k->w * k->h);
+        sr->cols = (double*)_iqa_alloc(5*w*sizeof(double));
+    }
+    else if (k->kernel_h && k->kernel_v) {
+        sr->mode = _SSIM_SEPARABLE;
+        sr->hring = (double*)_iqa_alloc(5*2*k->h*ow*sizeof(double));
+        sr->prod = (float*)_iqa_alloc(w*sizeof(float));
+    }
+    else {
+        sr->mode = _SSIM_2D;
+        sr->fring = (float*)_iqa_alloc(3*2*k->h*w*sizeof(float));
+    }
+    sr->stats = (float*)_iqa_alloc(5*ow*sizeof(float));
 
-    /* The convolution results are smaller by the kernel width and height */
-    for (y=0; y<h; ++y) {
-        offset = y*w;
-        for (x=0; x<w; ++x, ++offset) {
-            ref_sigma_sqd[offset] -= ref_mu[offset] * ref_mu[offset];
-            cmp_sigma_sqd[offset] -= cmp_mu[offset] * cmp_mu[offset];
-            sigma_both[offset] -= ref_mu[offset] * cmp_mu[offset];
+    if (!sr->stats || (sr->mode == _SSIM_BOX && !sr->cols) ||
+        (sr->mode == _SSIM_SEPARABLE && (!sr->hring || !sr->prod)) ||
+        (sr->mode == _SSIM_2D && !sr->fring)) {
+        _iqa_ssim_rows_free(sr);
+        return 1;
+    }
+    return 0;
+}
+
+/* _iqa_ssim_rows_free */
+void _iqa_ssim_rows_free(struct _ssim_rows *sr)
+{
+    _iqa_free(sr->cols);
+    _iqa_free(sr->hring);
+    _iqa_free(sr->fring);
+    _iqa_free(sr->prod);
+    _iqa_free(sr->stats);
+    memset(sr, 0, sizeof(*sr));
+}
+
+/* Points the row buffers at a new pair of images (no wider than allocated) */
+static void _rows_bind(struct _ssim_rows *sr, const float *ref, const float *cmp, _ssim_get_row get, void *ctx,
+    int w, int h)
+{
+    sr->ref = ref;
+    sr->cmp = cmp;
+    sr->get = get;
+    sr->ctx = ctx;
+    sr->w = w;
+    sr->h = h;
+    sr->ow = w - sr->k->w + 1;
+    sr->oh = h - sr->k->h + 1;
+    sr->mu1 = sr->stats;
+    sr->mu2 = sr->mu1 + sr->ow;
+    sr->s1  = sr->mu2 + sr->ow;
+    sr->s2  = sr->s1  + sr->ow;
+    sr->s12 = sr->s2  + sr->ow;
+    if (sr->streams == _SSIM_CMP) {
+        sr->mu1 = sr->lead->mu1;
+        sr->s1 = sr->lead->s1;
+    }
+}
+
+/* Input row 'y' of the reference image */
+IQA_INLINE static const float *_ref_row(const struct _ssim_rows *sr, int y)
+{
+    return sr->get ? sr->get(sr->ctx, 0, y) : sr->ref + y*sr->w;
+}
+
+/* Input row 'y' of the distorted image */
+IQA_INLINE static const float *_cmp_row(const struct _ssim_rows *sr, int y)
+{
+    return sr->get ? sr->get(sr->ctx, 1, y) : sr->cmp + y*sr->w;
+}
+
+/* _box_row for a _SSIM_REF or _SSIM_CMP set: only its own sums */
+static void _box_row_part(struct _ssim_rows *sr, int y, int sign)
+{
+    int x;
+    const float *ref = _ref_row(sr, y);
+    const float *cmp = sr->streams == _SSIM_CMP ? _cmp_row(sr, y) : 0;
+    double *c = sr->cols;
+    float r,d,f = (float)sign;
+
+    for (x=0; x<sr->w; ++x, c+=5) {
+        r = ref[x];
+        if (!cmp) {
+            c[0] += f*r;
+            c[2] += f*(r*r);
+            continue;
         }
+        d = cmp[x];
+        c[1] += f*d;
+        c[3] += f*(d*d);
+        c[4] += f*(r*d);
     }
+}
 
-    ssim_sum = 0.0;
-    for (y=0; y<h; ++y) {
-        offset = y*w;
-        for (x=0; x<w; ++x, ++offset) {
-
-            if (!args) {
-                /* The default case */
-                numerator   = (2.0 * ref_mu[offset] * cmp_mu[offset] + C1) * (2.0 * sigma_both[offset] + C2);
-                denominator = (ref_mu[offset]*ref_mu[offset] + cmp_mu[offset]*cmp_mu[offset] + C1) * 
-                    (ref_sigma_sqd[offset] + cmp_sigma_sqd[offset] + C2);
-                ssim_sum += numerator / denominator;
+/* Adds (sign=1) or removes (sign=-1) input row 'y' from the box column sums */
+static void _box_row(struct _ssim_rows *sr, int y, int sign)
+{
+    int x;
+    const float *ref, *cmp;
+    double *c = sr->cols;
+    float r,d;
+
+    if (sr->streams != _SSIM_ALL) {
+        _box_row_part(sr, y, sign);
+        return;
+    }
+    ref = _ref_row(sr, y);
+    cmp = _cmp_row(sr, y);
+    if (sign > 0) {
+        for (x=0; x<sr->w; ++x, c+=5) {
+            r = ref[x];
+            d = cmp[x];
+            c[0] += r;
+            c[1] += d;
+            c[2] += r*r;
+            c[3] += d*d;
+            c[4] += r*d;
+        }
+    }
+    else {
+        for (x=0; x<sr->w; ++x, c+=5) {
+            r = ref[x];
+            d = cmp[x];
+            c[0] -= r;
+            c[1] -= d;
+            c[2] -= r*r;
+            c[3] -= d*d;
+            c[4] -= r*d;
+        }
+    }
+}
+
+/* Slides the window along the box column sums, producing one output row */
+static void _box_slide(struct _ssim_rows *sr)
+{
+    int x, kw = sr->k->w;
+    const double *c;
+    double sum[5];
+    double weight = sr->weight;
+    float *out[5];
+    double one;
+    int s;
+
+    if (sr->streams != _SSIM_ALL) {
+        /* One statistic at a time, each summed as below */
+        out[0] = sr->mu1; out[1] = sr->mu2; out[2] = sr->s1; out[3] = sr->s2; out[4] = sr->s12;
+        for (s=0; s<5; ++s) {
+            if (!(sr->streams & (1<<s)))
+                continue;
+            one = 0.0;
+            for (x=0, c=sr->cols; x<kw; ++x, c+=5)
+                one += c[s];
+            for (x=0; x<sr->ow; ++x) {
+                if (x) {
+                    c = sr->cols + 5*(x+kw-1);
+                    one += c[s] - c[s-5*kw];
+                }
+                out[s][x] = (float)(one * weight);
             }
-            else {
-                /* User tweaked alpha, beta, or gamma */
-
-                /* passing a negative number to sqrt() cause a domain error */
-                if (ref_sigma_sqd[offset] < 0.0f)
-                    ref_sigma_sqd[offset] = 0.0f;
-                if (cmp_sigma_sqd[offset] < 0.0f)
-                    cmp_sigma_sqd[offset] = 0.0f;
-                sigma_root = sqrt(ref_sigma_sqd[offset] * cmp_sigma_sqd[offset]);
-
-                luminance_comp = _calc_luminance(ref_mu[offset], cmp_mu[offset], C1, alpha);
-                contrast_comp  = _calc_contrast(sigma_root, ref_sigma_sqd[offset], cmp_sigma_sqd[offset], C2, beta);
-                structure_comp = _calc_structure(sigma_both[offset], sigma_root, ref_sigma_sqd[offset], cmp_sigma_sqd[offset], C3, gamma);
-
-                sint.l = luminance_comp;
-                sint.c = contrast_comp;
-                sint.s = structure_comp;
-
-                if (mr->map(&sint, mr->context))
-                    return INFINITY;
+        }
+        return;
+    }
+
+    sum[0] = sum[1] = sum[2] = sum[3] = sum[4] = 0.0;
+    for (x=0, c=sr->cols; x<kw; ++x, c+=5) {
+        sum[0] += c[0];
+        sum[1] += c[1];
+        sum[2] += c[2];
+        sum[3] += c[3];
+        sum[4] += c[4];
+    }
+    for (x=0; x<sr->ow; ++x) {
+        if (x) {
+            c = sr->cols + 5*(x+kw-1);
+            sum[0] += c[0] - c[-5*kw];
+            sum[1] += c[1] - c[1-5*kw];
+            sum[2] += c[2] - c[2-5*kw];
+            sum[3] += c[3] - c[3-5*kw];
+            sum[4] += c[4] - c[4-5*kw];
+        }
+        sr->mu1[x] = (float)(sum[0] * weight);
+        sr->mu2[x] = (float)(sum[1] * weight);
+        sr->s1[x]  = (float)(sum[2] * weight);
+        sr->s2[x]  = (float)(sum[3] * weight);
+        sr->s12[x] = (float)(sum[4] * weight);
+    }
+}
+
+/* Horizontally filters input row 'y' into both of its separable ring slots */
+static void _sep_row(struct _ssim_rows *sr, int y)
+{
+    int x, s, kh = sr->k->h;
+    int ow = sr->ow, w = sr->w;
+    const float *ref = _ref_row(sr, y);
+    const float *cmp = (sr->streams & _SSIM_CMP) ? _cmp_row(sr, y) : 0;
+    const float *src;
+    double *slot;
+
+    for (s=0; s<5; ++s) {
+        if (!(sr->streams & (1<<s)))
+            continue;
+        src = sr->prod;
+        switch (s) {
+            case 0: src = ref; break;
+            case 1: src = cmp; break;
+            case 2: for (x=0; x<w; ++x) sr->prod[x] = ref[x] * ref[x]; break;
+            case 3: for (x=0; x<w; ++x) sr->prod[x] = cmp[x] * cmp[x]; break;
+            case 4: for (x=0; x<w; ++x) sr->prod[x] = ref[x] * cmp[x]; break;
+        }
+        slot = sr->hring + (s*2*kh + y%kh)*ow;
+        sr->simd->conv_h(src, sr->k->kernel_h, sr->k->w, slot, ow);
+        memcpy(slot + kh*ow, slot, ow*sizeof(double));
+    }
+}
+
+/* Stores the products of input row 'y' in both of its 2-D ring slots */
+static void _2d_row(struct _ssim_rows *sr, int y)
+{
+    int x, kh = sr->k->h, w = sr->w;
+    const float *ref = _ref_row(sr, y);
+    const float *cmp;
+    float *sqd1 = sr->fring + (y%kh)*w;
+    float *sqd2 = sqd1 + 2*kh*w;
+    float *both = sqd2 + 2*kh*w;
+
+    if (sr->streams == _SSIM_REF) {
+        for (x=0; x<w; ++x)
+            sqd1[x] = ref[x] * ref[x];
+        memcpy(sqd1 + kh*w, sqd1, w*sizeof(float));
+        return;
+    }
+    cmp = _cmp_row(sr, y);
+    if (sr->streams == _SSIM_CMP) {
+        for (x=0; x<w; ++x) {
+            sqd2[x] = cmp[x] * cmp[x];
+            both[x] = ref[x] * cmp[x];
+        }
+    }
+    else {
+        for (x=0; x<w; ++x) {
+            sqd1[x] = ref[x] * ref[x];
+            sqd2[x] = cmp[x] * cmp[x];
+            both[x] = ref[x] * cmp[x];
+        }
+        memcpy(sqd1 + kh*w, sqd1, w*sizeof(float));
+    }
+    memcpy(sqd2 + kh*w, sqd2, w*sizeof(float));
+    memcpy(both + kh*w, both, w*sizeof(float));
+}
+
+/* Prepares for producing output rows starting at row 'y' */
+static void _rows_start(struct _ssim_rows *sr, int y)
+{
+    int v;
+
+    sr->y = y;
+    if (sr->mode == _SSIM_BOX)
+        memset(sr->cols, 0, 5*sr->w*sizeof(double));
+    for (v=y; v<y+sr->k->h-1; ++v) {
+        switch (sr->mode) {
+            case _SSIM_BOX:       _box_row(sr, v, 1); break;
+            case _SSIM_SEPARABLE: _sep_row(sr, v); break;
+            default:              _2d_row(sr, v); break;
+        }
+    }
+}
+
+/* Produces the statistics of the next output row */
+static void _rows_next(struct _ssim_rows *sr)
+{
+    int x, s, y = sr->y;
+    const struct _kernel *k = sr->k;
+    const struct _iqa_simd *simd = sr->simd;
+    int kh = k->h, w = sr->w, ow = sr->ow;
+    float *out[5];
+    const float *fring;
+
+    out[0] = sr->mu1;
+    out[1] = sr->mu2;
+    out[2] = sr->s1;
+    out[3] = sr->s2;
+    out[4] = sr->s12;
+
+    switch (sr->mode) {
+        case _SSIM_BOX:
+            _box_row(sr, y+kh-1, 1);
+            _box_slide(sr);
+            _box_row(sr, y, -1);
+            break;
+        case _SSIM_SEPARABLE:
+            _sep_row(sr, y+kh-1);
+            for (s=0; s<5; ++s) {
+                if (sr->streams & (1<<s))
+                    simd->conv_v(sr->hring + (s*2*kh + y%kh)*ow, ow, k->kernel_v, kh, sr->scale, out[s], ow);
+            }
+            break;
+        default:
+            _2d_row(sr, y+kh-1);
+            if (sr->streams & 0x01)
+                simd->conv_2d(_ref_row(sr, y), w, k->kernel, k->w, kh, sr->scale, out[0], ow);
+            if (sr->streams & 0x02)
+                simd->conv_2d(_cmp_row(sr, y), w, k->kernel, k->w, kh, sr->scale, out[1], ow);
+            for (s=2; s<5; ++s) {
+                if (!(sr->streams & (1<<s)))
+                    continue;
+                fring = sr->fring + ((s-2)*2*kh + y%kh)*w;
+                simd->conv_2d(fring, w, k->kernel, k->w, kh, sr->scale, out[s], ow);
             }
+            break;
+    }
+
+    if (sr->streams == _SSIM_ALL) {
+        for (x=0; x<ow; ++x) {
+            sr->s1[x]  -= sr->mu1[x] * sr->mu1[x];
+            sr->s2[x]  -= sr->mu2[x] * sr->mu2[x];
+            sr->s12[x] -= sr->mu1[x] * sr->mu2[x];
+        }
+    }
+    else if (sr->streams == _SSIM_REF) {
+        for (x=0; x<ow; ++x)
+            sr->s1[x]  -= sr->mu1[x] * sr->mu1[x];
+    }
+    else {
+        /* mu1 belongs to the lead, which has already produced this row */
+        for (x=0; x<ow; ++x) {
+            sr->s2[x]  -= sr->mu2[x] * sr->mu2[x];
+            sr->s12[x] -= sr->mu1[x] * sr->mu2[x];
         }
     }
+    ++sr->y;
+}
 
-    free(ref_mu);
-    free(cmp_mu);
-    free(ref_sigma_sqd);
-    free(cmp_sigma_sqd);
-    free(sigma_both);
+/* Mirrors out-of-range coordinates, like KBND_SYMMETRIC */
+IQA_INLINE static int _reflect(int x, int len)
+{
+    if (x < 0)
+        return -1-x;
+    if (x >= len)
+        return (len-(x-len))-1;
+    return x;
+}
 
-    if (!args)
-        return (float)(ssim_sum / (double)(w*h));
-    return mr->reduce(w, h, mr->context);
+/* Converts (and decimates) row 'y' of both images into the band rings */
+static void _band_fill(struct _ssim_band *b, int y)
+{
+    int i,x,u,v,uc,even;
+    const unsigned char *src;
+    float *dst;
+    double sum;
+
+    uc = b->scale/2;
+    even = (b->scale&1)?0:1;
+    for (i=b->first_img; i<=b->last_img; ++i) {
+        dst = b->ring[i] + (y%b->kh)*b->sw;
+        if (b->scale == 1) {
+            src = b->img[i] + y*b->stride;
+            for (x=0; x<b->sw; ++x)
+                dst[x] = (float)src[x];
+        }
+        else {
+            /* Same arithmetic as _iqa_filter_pixel() */
+            for (x=0; x<b->sw; ++x) {
+                sum = 0.0;
+                for (v=-uc; v<=uc-even; ++v) {
+                    src = b->img[i] + _reflect(y*b->scale+v, b->h)*b->stride;
+                    for (u=-uc; u<=uc-even; ++u)
+                        sum += (float)src[_reflect(x*b->scale+u, b->w)] * b->lpf;
+                }
+                dst[x] = (float)sum;
+            }
+        }
+        memcpy(dst + b->kh*b->sw, dst, b->sw*sizeof(float));
+    }
 }
 
+/* _ssim_get_row for banded input */
+static const float *_band_row(void *ctx, int img, int y)
+{
+    struct _ssim_band *b = (struct _ssim_band*)ctx;
+    double start;
+
+    if (b->last < y && b->times) {
+        start = _seconds();
+        while (b->last < y)
+            _band_fill(b, ++b->last);
+        b->times[_SSIM_CONVERT] += _seconds() - start;
+    }
+    while (b->last < y)
+        _band_fill(b, ++b->last);
+    return b->ring[img] + (y%b->kh)*b->sw;
+}
 
-/* _ssim_map */
-int _ssim_map(const struct _ssim_int *si, void *ctx)
+/* Allocates fixed-point buffers for the workspace's frame size and window */
+static int _fixed_alloc(struct _ssim_fixed *f, const struct iqa_ssim_ws *ws)
 {
-    double *ssim_sum = (double*)ctx;
-    *ssim_sum += si->l * si->c * si->s;
+    int i, total=0;
+    float C1 = (0.01f*255)*(0.01f*255);
+    float C2 = (0.03f*255)*(0.03f*255);
+
+    memset(f, 0, sizeof(*f));
+    f->kw = ws->window.w;
+    f->k = ws->window.kernel_h ? g_gaussian_1d_fixed : g_square_1d_fixed;
+    for (i=0; i<f->kw; ++i)
+        total += f->k[i];
+    f->n = (long long)total * total;
+    f->c1 = (double)C1 * (double)f->n * (double)f->n;
+    f->c2 = (double)C2 * (double)f->n * (double)f->n;
+    f->simd = _iqa_simd();
+    f->ow = ws->band.sw - f->kw + 1;
+    f->ring = (int*)_iqa_alloc(5*2*f->kw*f->ow*sizeof(int));
+    f->sums = (long long*)_iqa_alloc(5*f->ow*sizeof(long long));
+    if (ws->band.scale > 1)
+        f->dec = (unsigned char*)_iqa_alloc(2*ws->band.sw);
+    if (!f->ring || !f->sums || (ws->band.scale > 1 && !f->dec)) {
+        _fixed_free(f);
+        return 1;
+    }
     return 0;
 }
 
+/* Releases fixed-point buffers. Safe on ones never allocated. */
+static void _fixed_free(struct _ssim_fixed *f)
+{
+    _iqa_free(f->ring);
+    _iqa_free(f->sums);
+    _iqa_free(f->dec);
+    f->ring = 0;
+    f->sums = 0;
+    f->dec = 0;
+}
+
+/* Row 'y' of image 'img' in 8 bits: the source row itself, or when scaling,
+ * the averages of the same blocks _band_fill() filters, rounded, in 'dst' */
+static const unsigned char *_band_fixed_row(const struct _ssim_band *b, int img, int y, unsigned char *dst)
+{
+    int x,u,v,uc,even,sum,count;
+    const unsigned char *src;
+
+    if (b->scale == 1)
+        return b->img[img] + y*b->stride;
+    uc = b->scale/2;
+    even = (b->scale&1)?0:1;
+    count = b->scale*b->scale;
+    for (x=0; x<b->sw; ++x) {
+        sum = 0;
+        for (v=-uc; v<=uc-even; ++v) {
+            src = b->img[img] + _reflect(y*b->scale+v, b->h)*b->stride;
+            for (u=-uc; u<=uc-even; ++u)
+                sum += src[_reflect(x*b->scale+u, b->w)];
+        }
+        dst[x] = (unsigned char)((sum + count/2) / count);
+    }
+    return dst;
+}
+
+/* Filters input row 'y' horizontally into both of its ring slots */
+static void _fixed_h_row(struct _ssim_fixed *f, const struct _ssim_band *b, int y)
+{
+    int s, kw = f->kw, ow = f->ow;
+    const unsigned char *ref, *cmp;
+    int *slot = f->ring + (y%kw)*ow;
+    double start=0.0;
+
+    if (f->dec && f->times)
+        start = _seconds();
+    ref = _band_fixed_row(b, 0, y, f->dec);
+    cmp = _band_fixed_row(b, 1, y, f->dec ? f->dec + b->sw : 0);
+    if (f->dec && f->times)
+        f->times[_SSIM_CONVERT] += _seconds() - start;
+
+    f->simd->fixed_h(ref, cmp, f->k, kw, slot, 2*kw*ow, ow);
+    for (s=0; s<5; ++s)
+        memcpy(slot + s*2*kw*ow + kw*ow, slot + s*2*kw*ow, ow*sizeof(int));
+}
+
+/* Produces the window sums of the next output row */
+static void _fixed_next(struct _ssim_fixed *f, const struct _ssim_band *b)
+{
+    int s, y = f->y, kw = f->kw, ow = f->ow;
+
+    _fixed_h_row(f, b, y+kw-1);
+    for (s=0; s<5; ++s)
+        f->simd->fixed_v(f->ring + (s*2*kw + y%kw)*ow, ow, f->k, kw, f->sums + s*ow, ow);
+    ++f->y;
+}
+
+/* SSIM sum of the current output row. With mu = SUM(k*x)/n and
+ * sigma^2 = SUM(k*x*x)/n - mu^2, every factor of the SSIM ratio is an
+ * integer divided by n^2, which cancels. */
+static double _fixed_combine(const struct _ssim_fixed *f)
+{
+    int x;
+    const long long *sx = f->sums, *sy = sx + f->ow;
+    const long long *sxx = sy + f->ow, *syy = sxx + f->ow, *sxy = syy + f->ow;
+    long long mu12, mu_sqd;
+    double numerator, denominator, sum=0.0;
+
+    for (x=0; x<f->ow; ++x) {
+        mu12 = sx[x] * sy[x];
+        mu_sqd = sx[x]*sx[x] + sy[x]*sy[x];
+        numerator   = ((double)(2*mu12) + f->c1) * ((double)(2*(f->n*sxy[x] - mu12)) + f->c2);
+        denominator = ((double)mu_sqd + f->c1) * ((double)(f->n*(sxx[x] + syy[x]) - mu_sqd) + f->c2);
+        sum += numerator / denominator;
+    }
+    return sum;
+}
+
+/*
+ * Scores output rows [y0,y1) in fixed point and returns the sum of their
+ * SSIM values, added a row at a time. Stores each row's sum in 'row_sums'
+ * (indexed by row) if not 0.
+ */
+static double _fixed_run(struct _ssim_fixed *f, struct _ssim_band *b, int y0, int y1, double *row_sums)
+{
+    int y;
+    double row, sum=0.0, start=0.0;
+
+    f->y = y0;
+    if (f->times)
+        start = _seconds();
+    for (y=y0; y<y0+f->kw-1; ++y)
+        _fixed_h_row(f, b, y);
+    if (f->times)
+        f->times[_SSIM_NEXT] += _seconds() - start;
+    for (y=y0; y<y1; ++y) {
+        if (!f->times) {
+            _fixed_next(f, b);
+            row = _fixed_combine(f);
+        }
+        else {
+            start = _seconds();
+            _fixed_next(f, b);
+            f->times[_SSIM_NEXT] += _seconds() - start;
+            start = _seconds();
+            row = _fixed_combine(f);
+            f->times[_SSIM_COMBINE] += _seconds() - start;
+        }
+        if (row_sums)
+            row_sums[y] = row;
+        sum += row;
+    }
+    return sum;
+}
+
 /* _ssim_reduce */
 float _ssim_reduce(int w, int h, void *ctx)
 {
-    double *ssim_sum = (double*)ctx;
-    return (float)(*ssim_sum / (double)(w*h));
+    const struct _ssim_int *sums = (const struct _ssim_int*)ctx;
+    return (float)(sums->lcs / (double)(w*h));
 }
 
 
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2026, The codec-quality-comparator authors
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the copyright holder nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _EINSTEIN_H_
+#define _EINSTEIN_H_
+
+#include "bmp.h"
+
+/*
+ * The Einstein images shared by the SSIM and MS-SSIM tests, in the order of
+ * their answer keys. Image 0 is the original the others are compared with.
+ */
+#define EINSTEIN_COUNT  7
+extern const char *einstein_files[EINSTEIN_COUNT];
+
+/* A check run on each Einstein image. Returns nonzero if the image failed. */
+typedef int (*einstein_check)(const struct bmp *orig, const struct bmp *cmp, int idx, void *ctx);
+
+/*
+ * Loads image 'idx' of einstein_files[]. Prints why and returns nonzero if it
+ * can't.
+ */
+int load_einstein(int idx, struct bmp *img);
+
+/*
+ * Loads each Einstein image in turn and runs 'check' on it against 'orig'.
+ * Returns the number of images that failed to load or failed the check.
+ */
+int for_each_einstein(const struct bmp *orig, einstein_check check, void *ctx);
+
+#endif /*_EINSTEIN_H_*/
@@ -0,0 +1,628 @@
+/*
+ * Copyright (c) 2026, The codec-quality-comparator authors
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the copyright holder nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Throughput benchmark for the library's kernels at video resolutions.
+ *
+ * Each kernel is timed on 8-bit planes from 480p to 4320p, both synthetic
+ * (a gradient with noise) and real (the skate test image, mirror-tiled up to
+ * size), against a copy with added noise. SSIM is run through a workspace,
+ * as the comparators use it, at each thread count; the other kernels are
+ * serial. Runs are repeated for at least --min-time seconds and the median
+ * is reported as ns/pixel, MPix/s and GB/s (bytes the kernel must read and
+ * write per input pixel), with the speedup over one thread.
+ *
+ * Results can be written as CSV or JSON. A CSV from an earlier run can be
+ * given as a baseline; any result that is slower than it by more than the
+ * tolerance is reported as a regression, and the exit status is 1.
+ */
+
+#include "iqa.h"
+#include "convolve.h"
+#include "decimate.h"
+#include "simd.h"
+#include "bmp.h"
+#include "hptime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define BENCH_REAL_BMP   "skate_480x360.bmp"
+#define BENCH_MIN_REPS   3
+#define BENCH_MAX_REPS   1000
+#define BENCH_MAX_THREADS 32
+#define BENCH_NOISE      8      /* The degraded plane is the reference +/- up to this */
+#define BENCH_SIGMA      1.5    /* Gaussian window of SSIM, used for convolve and decimate */
+
+#define BENCH_MSE           0
+#define BENCH_PSNR          1
+#define BENCH_SSIM_GAUSSIAN 2
+#define BENCH_SSIM_LINEAR   3
+#define BENCH_MS_SSIM       4
+#define BENCH_CONVOLVE      5
+#define BENCH_DECIMATE      6
+#define BENCH_KERNELS       7
+
+#define BENCH_SYNTHETIC 0
+#define BENCH_REAL      1
+#define BENCH_SOURCES   2
+
+static const char *kernel_names[BENCH_KERNELS] = {
+    "mse", "psnr", "ssim_gaussian", "ssim_linear", "ms_ssim", "convolve", "decimate"
+};
+
+/* Bytes read and written per input pixel: two 8-bit planes for the metrics, a
+ * float plane in and out for convolve, and in and a quarter out for decimate. */
+static const double kernel_bytes[BENCH_KERNELS] = { 2.0, 2.0, 2.0, 2.0, 2.0, 8.0, 5.0 };
+
+static const char *source_names[BENCH_SOURCES] = { "synthetic", "real" };
+
+struct _bench_size {
+    const char *name;
+    int w;
+    int h;
+};
+
+static const struct _bench_size sizes[] = {
+    { "480p",   854,  480 },
+    { "720p",  1280,  720 },
+    { "1080p", 1920, 1080 },
+    { "2160p", 3840, 2160 },
+    { "4320p", 7680, 4320 },
+};
+#define BENCH_SIZES (int)(sizeof(sizes)/sizeof(sizes[0]))
+
+/* Command line settings. The flag arrays select what to run. */
+struct _bench_opts {
+    int kernels[BENCH_KERNELS];
+    int sizes[BENCH_SIZES];
+    int sources[BENCH_SOURCES];
+    int threads[BENCH_MAX_THREADS];
+    int nthreads;
+    double min_time;
+    double tolerance;   /* Percent */
+    const char *csv;
+    const char *json;
+    const char *baseline;
+};
+
+/* The input planes of one size and source */
+struct _bench_planes {
+    int w;
+    int h;
+    unsigned char *ref;
+    unsigned char *cmp;
+    float *fref;        /* 'ref' as floats, for convolve and decimate */
+    float *fout;        /* w*h floats of output */
+};
+
+/* What one timed run needs. The workspaces are created before timing. */
+struct _bench_state {
+    int kernel;
+    const struct _bench_planes *p;
+    struct iqa_ssim_ws *ssim_ws;
+    struct iqa_ms_ssim_ws *ms_ssim_ws;
+    struct _kernel window;
+};
+
+struct _bench_result {
+    int kernel;
+    int size;
+    int source;
+    int threads;
+    int reps;
+    double median;      /* Seconds per run */
+    double best;
+    double ns_pixel;
+    double mpix_s;
+    double gb_s;
+    double speedup;     /* Over one thread of the same kernel, size and source */
+};
+
+static float g_window[11*11];
+static float g_window_1d[11];
+
+/* Fills the 11x11 Gaussian window and its 1-D factor */
+static void _make_window(struct _kernel *k)
+{
+    double sum=0.0;
+    int x, y;
+
+    for (x=0; x<11; ++x) {
+        g_window_1d[x] = (float)exp(-0.5*(x-5)*(x-5)/(BENCH_SIGMA*BENCH_SIGMA));
+        sum += g_window_1d[x];
+    }
+    for (x=0; x<11; ++x)
+        g_window_1d[x] = (float)(g_window_1d[x]/sum);
+    for (y=0; y<11; ++y)
+        for (x=0; x<11; ++x)
+            g_window[y*11+x] = g_window_1d[y]*g_window_1d[x];
+
+    k->kernel = g_window;
+    k->w = k->h = 11;
+    k->normalized = 1;
+    k->bnd_opt = KBND_SYMMETRIC;
+    k->bnd_const = 0.0f;
+    k->kernel_h = k->kernel_v = g_window_1d;
+}
+
+/* xorshift32, so every run benchmarks the same pixels */
+static unsigned int _next_random(unsigned int *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static void _free_planes(struct _bench_planes *p)
+{
+    free(p->ref);
+    free(p->cmp);
+    free(p->fref);
+    free(p->fout);
+    memset(p, 0, sizeof(*p));
+}
+
+/* Fills the planes for a size and source. 'real' is the loaded test image,
+ * or 0 if it couldn't be loaded. Returns 0 on success. */
+static int _make_planes(struct _bench_planes *p, int w, int h, int source, const struct bmp *real)
+{
+    unsigned int seed=0x2545F491;
+    int x, y, sx, sy, v;
+
+    p->w = w;
+    p->h = h;
+    p->ref = (unsigned char*)malloc(w*h);
+    p->cmp = (unsigned char*)malloc(w*h);
+    p->fref = (float*)malloc(w*h*sizeof(float));
+    p->fout = (float*)malloc(w*h*sizeof(float));
+    if (!p->ref || !p->cmp || !p->fref || !p->fout) {
+        _free_planes(p);
+        return 1;
+    }
+
+    for (y=0; y<h; ++y) {
+        for (x=0; x<w; ++x) {
+            if (source == BENCH_REAL) {
+                /* Mirror tiling keeps the image continuous across the seams */
+                sx = x % (2*real->w);
+                sy = y % (2*real->h);
+                if (sx >= real->w) sx = 2*real->w - 1 - sx;
+                if (sy >= real->h) sy = 2*real->h - 1 - sy;
+                v = real->img[sy*real->stride + sx];
+            }
+            else
+                v = (x*255/w + y*255/h)/2 + (int)(_next_random(&seed) % 64) - 32;
+            v = v < 0 ? 0 : (v > 255 ? 255 : v);
+            p->ref[y*w+x] = (unsigned char)v;
+            p->fref[y*w+x] = (float)v;
+
+            v += (int)(_next_random(&seed) % (2*BENCH_NOISE+1)) - BENCH_NOISE;
+            p->cmp[y*w+x] = (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+        }
+    }
+    return 0;
+}
+
+/* Runs the kernel once. Returns 0 on success. */
+static int _bench_once(struct _bench_state *s)
+{
+    const struct _bench_planes *p = s->p;
+    float result=0.0f;
+
+    switch (s->kernel) {
+    case BENCH_MSE:
+        result = iqa_mse(p->ref, p->cmp, p->w, p->h, p->w);
+        break;
+    case BENCH_PSNR:
+        result = iqa_psnr(p->ref, p->cmp, p->w, p->h, p->w);
+        if (result == INFINITY)
+            result = 0.0f;
+        break;
+    case BENCH_SSIM_GAUSSIAN:
+    case BENCH_SSIM_LINEAR:
+        result = iqa_ssim_ws_run(s->ssim_ws, p->ref, p->cmp, p->w);
+        break;
+    case BENCH_MS_SSIM:
+        result = iqa_ms_ssim_ws_run(s->ms_ssim_ws, p->ref, p->cmp, p->w);
+        break;
+    case BENCH_CONVOLVE:
+        _iqa_convolve(p->fref, p->w, p->h, &s->window, p->fout, 0, 0);
+        break;
+    case BENCH_DECIMATE:
+        return _iqa_decimate(p->fref, p->w, p->h, 2, &s->window, p->fout, 0, 0);
+    }
+    return result == INFINITY ? 1 : 0;
+}
+
+static int _cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Times repeated runs, after one to warm up (page faults, caches). Returns 0
+ * on success. */
+static int _bench_time(struct _bench_state *s, double min_time, struct _bench_result *r)
+{
+    static double times[BENCH_MAX_REPS];
+    unsigned long long freq=hpt_get_frequency(), start, end;
+    double total=0.0;
+    int n=0;
+
+    if (_bench_once(s))
+        return 1;
+    while (n < BENCH_MAX_REPS && (n < BENCH_MIN_REPS || total < min_time)) {
+        start = hpt_get_time();
+        _bench_once(s);
+        end = hpt_get_time();
+        times[n] = hpt_elapsed_time(start, end, freq);
+        total += times[n++];
+    }
+    qsort(times, n, sizeof(double), _cmp_double);
+    r->reps = n;
+    r->median = times[n/2];
+    r->best = times[0];
+    return 0;
+}
+
+/* Sets up, times and tears down one kernel at one thread count. Returns 0 on
+ * success. */
+static int _bench_kernel(int kernel, int threads, const struct _bench_planes *p, double min_time,
+    struct _bench_result *r)
+{
+    struct _bench_state s;
+    double pixels = (double)p->w * p->h;
+    int failed;
+
+    memset(&s, 0, sizeof(s));
+    s.kernel = kernel;
+    s.p = p;
+    _make_window(&s.window);
+    if (kernel == BENCH_SSIM_GAUSSIAN || kernel == BENCH_SSIM_LINEAR) {
+        s.ssim_ws = iqa_ssim_ws_create(p->w, p->h, kernel == BENCH_SSIM_GAUSSIAN, 0);
+        if (!s.ssim_ws)
+            return 1;
+        iqa_ssim_ws_set_threads(s.ssim_ws, threads);
+    }
+    else if (kernel == BENCH_MS_SSIM) {
+        s.ms_ssim_ws = iqa_ms_ssim_ws_create(p->w, p->h, 0);
+        if (!s.ms_ssim_ws)
+            return 1;
+    }
+
+    r->kernel = kernel;
+    r->threads = threads;
+    failed = _bench_time(&s, min_time, r);
+    if (!failed) {
+        r->ns_pixel = r->median * 1e9 / pixels;
+        r->mpix_s = pixels / r->median / 1e6;
+        r->gb_s = kernel_bytes[kernel] * pixels / r->median / 1e9;
+    }
+
+    iqa_ssim_ws_destroy(s.ssim_ws);
+    iqa_ms_ssim_ws_destroy(s.ms_ssim_ws);
+    return failed;
+}
+
+static void _print_result(const struct _bench_result *r)
+{
+    printf("  %-14s %-6s %-10s %2d thr %10.3f ns/px %9.1f MPix/s %7.2f GB/s  x%.2f  (%d runs)\n",
+        kernel_names[r->kernel], sizes[r->size].name, source_names[r->source], r->threads,
+        r->ns_pixel, r->mpix_s, r->gb_s, r->speedup, r->reps);
+}
+
+static int _write_csv(const char *path, const struct _bench_result *results, int n)
+{
+    FILE *f = fopen(path, "w");
+    int i;
+
+    if (!f)
+        return 1;
+    fprintf(f, "kernel,size,source,width,height,threads,simd,reps,median_s,best_s,ns_per_pixel,mpix_per_s,gb_per_s,speedup\n");
+    for (i=0; i<n; ++i) {
+        fprintf(f, "%s,%s,%s,%d,%d,%d,%s,%d,%.9g,%.9g,%.6f,%.3f,%.4f,%.3f\n",
+            kernel_names[results[i].kernel], sizes[results[i].size].name, source_names[results[i].source],
+            sizes[results[i].size].w, sizes[results[i].size].h, results[i].threads, _iqa_simd()->name,
+            results[i].reps, results[i].median, results[i].best, results[i].ns_pixel, results[i].mpix_s,
+            results[i].gb_s, results[i].speedup);
+    }
+    fclose(f);
+    return 0;
+}
+
+static int _write_json(const char *path, const struct _bench_result *results, int n)
+{
+    FILE *f = fopen(path, "w");
+    int i;
+
+    if (!f)
+        return 1;
+    fprintf(f, "[\n");
+    for (i=0; i<n; ++i) {
+        fprintf(f, "  {\"kernel\":\"%s\",\"size\":\"%s\",\"source\":\"%s\",\"width\":%d,\"height\":%d,"
+            "\"threads\":%d,\"simd\":\"%s\",\"reps\":%d,\"median_s\":%.9g,\"best_s\":%.9g,"
+            "\"ns_per_pixel\":%.6f,\"mpix_per_s\":%.3f,\"gb_per_s\":%.4f,\"speedup\":%.3f}%s\n",
+            kernel_names[results[i].kernel], sizes[results[i].size].name, source_names[results[i].source],
+            sizes[results[i].size].w, sizes[results[i].size].h, results[i].threads, _iqa_simd()->name,
+            results[i].reps, results[i].median, results[i].best, results[i].ns_pixel, results[i].mpix_s,
+            results[i].gb_s, results[i].speedup, i+1 < n ? "," : "");
+    }
+    fprintf(f, "]\n");
+    fclose(f);
+    return 0;
+}
+
+/* Compares the results with a CSV written by an earlier run. Returns the
+ * number of regressions, or -1 if the baseline can't be read. */
+static int _compare_baseline(const char *path, double tolerance, const struct _bench_result *results, int n)
+{
+    FILE *f = fopen(path, "r");
+    char line[512], kernel[32], size[16], source[16], simd[16];
+    int width, height, threads, reps, i, matched=0, regressions=0;
+    double median, best, ns_pixel, change;
+
+    if (!f)
+        return -1;
+    printf("\nCompared with %s (tolerance %.1f%%):\n", path, tolerance);
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%31[^,],%15[^,],%15[^,],%d,%d,%d,%15[^,],%d,%lf,%lf,%lf", kernel, size, source,
+            &width, &height, &threads, simd, &reps, &median, &best, &ns_pixel) != 11)
+            continue;   /* The header */
+        for (i=0; i<n; ++i) {
+            if (strcmp(kernel, kernel_names[results[i].kernel]) || strcmp(size, sizes[results[i].size].name) ||
+                strcmp(source, source_names[results[i].source]) || threads != results[i].threads)
+                continue;
+            matched++;
+            change = (results[i].ns_pixel - ns_pixel) * 100.0 / ns_pixel;
+            printf("  %-14s %-6s %-10s %2d thr %10.3f -> %10.3f ns/px  %+6.1f%%%s\n", kernel, size, source,
+                threads, ns_pixel, results[i].ns_pixel, change, change > tolerance ? "  REGRESSION" : "");
+            if (change > tolerance)
+                regressions++;
+        }
+    }
+    fclose(f);
+    printf("  %d matched, %d regression%s\n", matched, regressions, regressions == 1 ? "" : "s");
+    return regressions;
+}
+
+static int _cpu_count(void)
+{
+#ifdef WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+static void _usage(const char *program)
+{
+    int i;
+
+    printf("Usage: %s [options]\n", program);
+    printf("  --kernels <list>   Kernels to time (default: all):");
+    for (i=0; i<BENCH_KERNELS; ++i)
+        printf(" %s", kernel_names[i]);
+    printf("\n  --sizes <list>     Plane sizes (default: all):");
+    for (i=0; i<BENCH_SIZES; ++i)
+        printf(" %s", sizes[i].name);
+    printf("\n  --sources <list>   synthetic, real (default: both)\n");
+    printf("  --threads <list>   SSIM thread counts (default: 1, 2, 4, ... up to the CPUs)\n");
+    printf("  --min-time <s>     Time each kernel for at least this long (default: 0.25)\n");
+    printf("  --csv <file>       Write the results as CSV\n");
+    printf("  --json <file>      Write the results as JSON\n");
+    printf("  --baseline <file>  Compare with the CSV of an earlier run; exit with 1 on regressions\n");
+    printf("  --tolerance <pct>  Slowdown allowed before a result is a regression (default: 10)\n");
+    exit(2);
+}
+
+/* Sets the flags of the names in a comma-separated list. Returns 0 if they
+ * were all known. */
+static int _parse_names(const char *list, const char *const *names, int count, int *flags)
+{
+    char buf[256], *name;
+    int i, found;
+
+    memset(flags, 0, count*sizeof(int));
+    strncpy(buf, list, sizeof(buf)-1);
+    buf[sizeof(buf)-1] = 0;
+    for (name=strtok(buf, ","); name; name=strtok(0, ",")) {
+        for (i=0, found=0; i<count; ++i) {
+            if (!strcmp(name, names[i])) {
+                flags[i] = 1;
+                found = 1;
+            }
+        }
+        if (!found)
+            return 1;
+    }
+    return 0;
+}
+
+static void _parse_options(int argc, char **argv, struct _bench_opts *o)
+{
+    const char *size_names[BENCH_SIZES];
+    char buf[256], *item;
+    int i, cpus=_cpu_count();
+
+    memset(o, 0, sizeof(*o));
+    for (i=0; i<BENCH_KERNELS; ++i)
+        o->kernels[i] = 1;
+    for (i=0; i<BENCH_SIZES; ++i) {
+        o->sizes[i] = 1;
+        size_names[i] = sizes[i].name;
+    }
+    o->sources[BENCH_SYNTHETIC] = o->sources[BENCH_REAL] = 1;
+    for (i=1; i<=cpus && o->nthreads < BENCH_MAX_THREADS; i*=2)
+        o->threads[o->nthreads++] = i;
+    if (o->threads[o->nthreads-1] != cpus && o->nthreads < BENCH_MAX_THREADS)
+        o->threads[o->nthreads++] = cpus;
+    o->min_time = 0.25;
+    o->tolerance = 10.0;
+
+    for (i=1; i<argc; ++i) {
+        if (i+1 >= argc)
+            _usage(argv[0]);
+        if (!strcmp(argv[i], "--kernels")) {
+            if (_parse_names(argv[++i], kernel_names, BENCH_KERNELS, o->kernels))
+                _usage(argv[0]);
+        }
+        else if (!strcmp(argv[i], "--sizes")) {
+            if (_parse_names(argv[++i], size_names, BENCH_SIZES, o->sizes))
+                _usage(argv[0]);
+        }
+        else if (!strcmp(argv[i], "--sources")) {
+            if (_parse_names(argv[++i], source_names, BENCH_SOURCES, o->sources))
+                _usage(argv[0]);
+        }
+        else if (!strcmp(argv[i], "--threads")) {
+            o->nthreads = 0;
+            strncpy(buf, argv[++i], sizeof(buf)-1);
+            buf[sizeof(buf)-1] = 0;
+            for (item=strtok(buf, ","); item && o->nthreads < BENCH_MAX_THREADS; item=strtok(0, ",")) {
+                o->threads[o->nthreads] = atoi(item);
+                if (o->threads[o->nthreads] < 1)
+                    _usage(argv[0]);
+                o->nthreads++;
+            }
+            if (!o->nthreads)
+                _usage(argv[0]);
+        }
+        else if (!strcmp(argv[i], "--min-time"))
+            o->min_time = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--csv"))
+            o->csv = argv[++i];
+        else if (!strcmp(argv[i], "--json"))
+            o->json = argv[++i];
+        else if (!strcmp(argv[i], "--baseline"))
+            o->baseline = argv[++i];
+        else if (!strcmp(argv[i], "--tolerance"))
+            o->tolerance = atof(argv[++i]);
+        else
+            _usage(argv[0]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct _bench_opts o;
+    struct _bench_planes p;
+    struct _bench_result *results, *r;
+    struct bmp real;
+    int size, source, kernel, t, n=0, max_results, serial, failed=0, regressions;
+    double one_thread=0.0;
+
+    _parse_options(argc, argv, &o);
+    max_results = BENCH_SIZES * BENCH_SOURCES * BENCH_KERNELS * o.nthreads;
+    results = (struct _bench_result*)calloc(max_results, sizeof(struct _bench_result));
+    if (!results) {
+        printf("Out of memory\n");
+        return 2;
+    }
+    if (o.sources[BENCH_REAL] && load_bmp(BENCH_REAL_BMP, &real)) {
+        printf("Can't load '%s' (run from the build directory); skipping the real planes\n", BENCH_REAL_BMP);
+        o.sources[BENCH_REAL] = 0;
+    }
+
+    printf("\nlibiqa kernel throughput (%s, median of runs of at least %.2fs)\n\n", _iqa_simd()->name, o.min_time);
+    memset(&p, 0, sizeof(p));
+    for (size=0; size<BENCH_SIZES; ++size) {
+        if (!o.sizes[size])
+            continue;
+        for (source=0; source<BENCH_SOURCES; ++source) {
+            if (!o.sources[source])
+                continue;
+            if (_make_planes(&p, sizes[size].w, sizes[size].h, source, &real)) {
+                printf("  %s %s: out of memory\n", sizes[size].name, source_names[source]);
+                failed++;
+                continue;
+            }
+            for (kernel=0; kernel<BENCH_KERNELS; ++kernel) {
+                if (!o.kernels[kernel])
+                    continue;
+                serial = kernel != BENCH_SSIM_GAUSSIAN && kernel != BENCH_SSIM_LINEAR;
+                for (t=0; t<(serial ? 1 : o.nthreads); ++t) {
+                    r = &results[n];
+                    r->size = size;
+                    r->source = source;
+                    if (_bench_kernel(kernel, serial ? 1 : o.threads[t], &p, o.min_time, r)) {
+                        printf("  %-14s %-6s %-10s failed (out of memory?)\n", kernel_names[kernel],
+                            sizes[size].name, source_names[source]);
+                        failed++;
+                        continue;
+                    }
+                    if (t == 0)
+                        one_thread = r->threads == 1 ? r->median : 0.0;
+                    r->speedup = one_thread > 0.0 ? one_thread / r->median : 1.0;
+                    _print_result(r);
+                    n++;
+                }
+            }
+            _free_planes(&p);
+        }
+    }
+    if (o.sources[BENCH_REAL])
+        free_bmp(&real);
+
+    if (o.csv && _write_csv(o.csv, results, n)) {
+        printf("Can't write '%s'\n", o.csv);
+        failed++;
+    }
+    if (o.json && _write_json(o.json, results, n)) {
+        printf("Can't write '%s'\n", o.json);
+        failed++;
+    }
+    regressions = 0;
+    if (o.baseline) {
+        regressions = _compare_baseline(o.baseline, o.tolerance, results, n);
+        if (regressions < 0) {
+            printf("Can't read the baseline '%s'\n", o.baseline);
+            failed++;
+        }
+    }
+    free(results);
+
+    if (failed)
+        return 2;
+    return regressions > 0 ? 1 : 0;
+}
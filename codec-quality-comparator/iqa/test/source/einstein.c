@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2026, The codec-quality-comparator authors
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the copyright holder nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include "einstein.h"
+
+const char *einstein_files[EINSTEIN_COUNT] = {
+    "einstein.bmp", "blur.bmp", "contrast.bmp", "flipvertical.bmp", "impulse.bmp", "jpg.bmp", "meanshift.bmp"
+};
+
+int load_einstein(int idx, struct bmp *img)
+{
+    if (load_bmp(einstein_files[idx], img)) {
+        printf("FAILED to load \'%s\'\n", einstein_files[idx]);
+        return 1;
+    }
+    return 0;
+}
+
+int for_each_einstein(const struct bmp *orig, einstein_check check, void *ctx)
+{
+    struct bmp cmp;
+    int idx, failures=0;
+
+    for (idx=0; idx<EINSTEIN_COUNT; ++idx) {
+        printf("\t  %s: ", einstein_files[idx]);
+        if (load_einstein(idx, &cmp)) {
+            failures++;
+            continue;
+        }
+        failures += check(orig, &cmp, idx, ctx) ? 1 : 0;
+        free_bmp(&cmp);
+    }
+    return failures;
+}
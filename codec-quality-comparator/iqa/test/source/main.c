@@ -37,19 +37,30 @@
 #include "test_psnr.h"
 #include "test_ssim.h"
 #include "test_ms_ssim.h"
+#include "test_accuracy.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-int main()
+int main(int argc, char **argv)
 {
     int failures=0;
 
     printf("\n");
-    failures += test_convolve();
-    failures += test_decimate();
-    failures += test_mse();
-    failures += test_psnr();
-    failures += test_ssim();
-    failures += test_ms_ssim();
+
+    /* 'test accuracy [cases]' runs only the accuracy harness, with more cases */
+    if (argc > 1 && !strcmp(argv[1], "accuracy")) {
+        failures += test_accuracy(argc > 2 ? atoi(argv[2]) : 200, 1);
+    }
+    else {
+        failures += test_convolve();
+        failures += test_decimate();
+        failures += test_mse();
+        failures += test_psnr();
+        failures += test_ssim();
+        failures += test_ms_ssim();
+        failures += test_accuracy(ACCURACY_CASES, 0);
+    }
 
     if (failures)
         printf("\n\nRESULT: *** FAIL (%i) ***\n\n", failures);
@@ -0,0 +1,953 @@
+/*
+ * Copyright (c) 2026, The codec-quality-comparator authors
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the copyright holder nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Differential accuracy harness.
+ *
+ * Runs the library's fast paths side by side with a plain reference and
+ * records the largest deviation of each. The references are the original
+ * full-plane algorithms, kept here: _ref_convolve() is the direct 2-D
+ * convolution, _ref_decimate() filters each kept pixel in full,
+ * _ref_ssim() converts whole images, convolves five full planes and combines
+ * them in double, exactly as iqa_ssim() first did, and _ref_ms_ssim() builds
+ * the original low-pass pyramid of full planes and runs the same SSIM core
+ * at each scale.
+ *
+ * Each case is run at every SIMD level the CPU supports, on random sizes
+ * (odd and even, some large enough to be downscaled), random strides and
+ * several kinds of content, and on the BMP fixtures. A kernel passes when
+ * every deviation is within its absolute OR relative tolerance:
+ *
+ *   convolve 2-D        exact (the same products, summed in the same order)
+ *   convolve separable  3e-3 abs or 5e-4 rel (the 1-D factors only approximate
+ *                       the 2-D Gaussian, to about 2e-4 of the result)
+ *   mse, psnr           exact (integer sums)
+ *   ssim gaussian       1e-5 abs (separable window, summed a row at a time)
+ *   ssim linear         1e-5 abs (summed a row at a time)
+ *   ssim args           2e-5 abs (map/reduce path, exponents other than 1)
+ *   ssim args unit      1e-5 abs (map/reduce path, exponents of 1, summed a row
+ *                       at a time)
+ *   ssim threads        exact, against the serial workspace (rows are added in order)
+ *   ssim multi          exact, against scoring each image on its own
+ *   ms-ssim             5e-6 abs, against _ref_ms_ssim() (full planes, 2-D
+ *                       low-pass filter)
+ *   ms-ssim flat        2e-4 abs, the same on flat content: without constants
+ *                       the structure term divides one rounding error by
+ *                       another, which gives about 1e-4 at every level
+ *   ms-ssim wang        5e-6 abs, against _ref_ms_ssim() with Wang's
+ *                       stabilizing constants
+ *   ssim integer        exact, serial and threaded, against _ref_ssim_integer()
+ *   int vs float        1e-3 abs, against _ref_ssim() (integer Gaussian weights)
+ *   int vs float scaled 5e-3 abs, the same on images large enough to be scaled
+ *                       (the scaled pixels are rounded to 8 bits)
+ *
+ * The tolerances are about twice the largest deviation seen over a long run.
+ * A fast path should only be turned on by default once it passes here with
+ * many cases ('test accuracy <cases>').
+ */
+
+#include "test_accuracy.h"
+#include "iqa.h"
+#include "convolve.h"
+#include "math_utils.h"
+#include "simd.h"
+#include "ssim.h"
+#include "bmp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define ACC_MAX_W       1280    /* Large enough for the largest fixture */
+#define ACC_MAX_H       720
+#define ACC_MAX_STRIDE  (ACC_MAX_W+16)
+#define ACC_LARGE_MIN   384     /* Random cases this large get scaled down by iqa_ssim() */
+#define ACC_LARGE_MAX   560
+#define ACC_SCALED      384     /* Smallest side iqa_ssim() scales down */
+#define ACC_CANDIDATES  3
+#define ACC_MS_SSIM_MIN 176     /* Smallest side MS-SSIM takes with 5 scales and the Gaussian window */
+
+#define ACC_CONVOLVE_2D   0
+#define ACC_CONVOLVE_SEP  1
+#define ACC_MSE           2
+#define ACC_PSNR          3
+#define ACC_SSIM_GAUSSIAN 4
+#define ACC_SSIM_LINEAR   5
+#define ACC_SSIM_ARGS     6
+#define ACC_SSIM_UNIT     7
+#define ACC_SSIM_THREADS  8
+#define ACC_SSIM_MULTI    9
+#define ACC_MS_SSIM       10
+#define ACC_MS_SSIM_FLAT  11
+#define ACC_MS_SSIM_WANG  12
+#define ACC_INTEGER       13
+#define ACC_INTEGER_FLOAT 14
+#define ACC_INTEGER_SCALED 15
+#define ACC_METRICS       16
+
+/* The largest deviation seen for one kernel, and what it may be */
+struct _acc_metric {
+    const char *name;
+    double tol_abs;
+    double tol_rel;
+    double max_abs;
+    double max_rel;
+    int checks;
+    int failures;
+};
+
+static struct _acc_metric metrics[ACC_METRICS] = {
+    { "convolve 2-D",       0.0,  0.0,  0, 0, 0, 0 },
+    { "convolve separable", 3e-3, 5e-4, 0, 0, 0, 0 },
+    { "mse",                0.0,  0.0,  0, 0, 0, 0 },
+    { "psnr",               0.0,  0.0,  0, 0, 0, 0 },
+    { "ssim gaussian",      1e-5, 0.0,  0, 0, 0, 0 },
+    { "ssim linear",        1e-5, 0.0,  0, 0, 0, 0 },
+    { "ssim args",          2e-5, 0.0,  0, 0, 0, 0 },
+    { "ssim args unit",     1e-5, 0.0,  0, 0, 0, 0 },
+    { "ssim threads",       0.0,  0.0,  0, 0, 0, 0 },
+    { "ssim multi",         0.0,  0.0,  0, 0, 0, 0 },
+    { "ms-ssim",            5e-6, 0.0,  0, 0, 0, 0 },
+    { "ms-ssim flat",       2e-4, 0.0,  0, 0, 0, 0 },
+    { "ms-ssim wang",       5e-6, 0.0,  0, 0, 0, 0 },
+    { "ssim integer",       0.0,  0.0,  0, 0, 0, 0 },
+    { "int vs float",       1e-3, 0.0,  0, 0, 0, 0 },
+    { "int vs float scaled", 5e-3, 0.0,  0, 0, 0, 0 },
+};
+
+/* A test case: a reference and ACC_CANDIDATES distorted images */
+struct _acc_case {
+    char desc[64];
+    int w, h, stride;
+    int flat;           /* The reference has no variance */
+    unsigned char *ref;
+    unsigned char *cmp[ACC_CANDIDATES];
+};
+
+static unsigned int acc_seed;
+
+/* xorshift32, so a run can be repeated */
+static unsigned int _acc_random()
+{
+    acc_seed ^= acc_seed << 13;
+    acc_seed ^= acc_seed >> 17;
+    acc_seed ^= acc_seed << 5;
+    return acc_seed;
+}
+
+/* Records a deviation. Non-finite values must match exactly. */
+static void _acc_check(int metric, double value, double expected, const char *desc, const char *simd)
+{
+    struct _acc_metric *m = &metrics[metric];
+    double dev_abs, dev_rel;
+
+    if (!isfinite(value) || !isfinite(expected)) {
+        dev_abs = dev_rel = (value == expected || (isnan(value) && isnan(expected))) ? 0.0 : INFINITY;
+    }
+    else {
+        dev_abs = fabs(value - expected);
+        dev_rel = expected != 0.0 ? dev_abs / fabs(expected) : (dev_abs ? INFINITY : 0.0);
+    }
+    m->checks++;
+    if (dev_abs > m->max_abs)
+        m->max_abs = dev_abs;
+    if (dev_rel > m->max_rel)
+        m->max_rel = dev_rel;
+    if (dev_abs > m->tol_abs && dev_rel > m->tol_rel) {
+        if (m->failures++ < 3)
+            printf("\t  %s (%s, %s): %.9g, expected %.9g\n", m->name, desc, simd, value, expected);
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * References
+ *---------------------------------------------------------------------------*/
+
+/* The original _iqa_convolve(): direct 2-D, summed in double */
+static void _ref_convolve(const float *img, int w, int h, const struct _kernel *k, float *dst)
+{
+    int x, y, u, v;
+    int dst_w = w - k->w + 1;
+    int dst_h = h - k->h + 1;
+    double sum, ksum=0.0;
+    float scale=1.0f;
+    const float *src, *kernel;
+
+    if (!k->normalized) {
+        for (u=0; u<k->w*k->h; ++u)
+            ksum += k->kernel[u];
+        if (ksum != 0.0)
+            scale = (float)(1.0 / ksum);
+    }
+    for (y=0; y<dst_h; ++y) {
+        for (x=0; x<dst_w; ++x) {
+            sum = 0.0;
+            kernel = k->kernel;
+            for (v=0; v<k->h; ++v, kernel+=k->w) {
+                src = img + (y+v)*w + x;
+                for (u=0; u<k->w; ++u)
+                    sum += src[u] * kernel[u];
+            }
+            dst[y*dst_w + x] = (float)(sum * scale);
+        }
+    }
+}
+
+/* The original _iqa_decimate(): each kept pixel filtered in full, summed in
+ * double, with symmetric edges. 'dst' may be 'img', as the original allowed. */
+static void _ref_decimate(float *img, int w, int h, int factor, const float *kernel, int kw, float *dst,
+    int *rw, int *rh)
+{
+    int x, y, u, v, sx, sy, uc = kw/2, even = (kw&1) ? 0 : 1;
+    int sw = w/factor + (w&1);
+    int sh = h/factor + (h&1);
+    double sum;
+    const float *k;
+
+    for (y=0; y<sh; ++y) {
+        for (x=0; x<sw; ++x) {
+            sum = 0.0;
+            k = kernel;
+            for (v=-uc; v<=uc-even; ++v) {
+                for (u=-uc; u<=uc-even; ++u, ++k) {
+                    sy = y*factor+v;
+                    sx = x*factor+u;
+                    sy = sy < 0 ? -1-sy : (sy >= h ? 2*h-sy-1 : sy);
+                    sx = sx < 0 ? -1-sx : (sx >= w ? 2*w-sx-1 : sx);
+                    sum += img[sy*w + sx] * *k;
+                }
+            }
+            dst[y*sw + x] = (float)sum;
+        }
+    }
+    *rw = sw;
+    *rh = sh;
+}
+
+/* The original SSIM components, for the 'args' path */
+static double _ref_component(double num, double den, float exponent)
+{
+    double result = num / den;
+    if (exponent == 1.0f)
+        return result;
+    return (result < 0.0 ? -1.0 : 1.0) * pow(fabs(result), (double)exponent);
+}
+
+/* The original _iqa_ssim(): the float images convolved into five full planes
+ * and combined in double, with MS-SSIM*'s special cases for zero constants.
+ * With 'args' and 'lcs', also returns the mean luminance, contrast and
+ * structure terms, as MS-SSIM's map/reduce collected them. Returns INFINITY
+ * if out of memory. */
+static double _ref_ssim_float(const float *ref_f, const float *cmp_f, int w, int h, int gaussian,
+    const struct iqa_ssim_args *args, double *lcs)
+{
+    float *planes[5], *mu1, *mu2, *s1, *s2, *s12;
+    float alpha=1.0f, beta=1.0f, gamma=1.0f, K1=0.01f, K2=0.03f, C1, C2, C3;
+    int L=255, i, ow, oh, failed=0;
+    double sum=0.0, sum_l=0.0, sum_c=0.0, sum_s=0.0, root, l, c, s;
+    struct _kernel window;
+
+    if (args) {
+        alpha = args->alpha;
+        beta = args->beta;
+        gamma = args->gamma;
+        L = args->L;
+        K1 = args->K1;
+        K2 = args->K2;
+    }
+    C1 = (K1*L)*(K1*L);
+    C2 = (K2*L)*(K2*L);
+    C3 = C2 / 2.0f;
+
+    memset(&window, 0, sizeof(window));
+    window.kernel = gaussian ? (float*)g_gaussian_window : (float*)g_square_window;
+    window.w = window.h = gaussian ? GAUSSIAN_LEN : SQUARE_LEN;
+    window.normalized = 1;
+    window.bnd_opt = KBND_SYMMETRIC;
+
+    for (i=0; i<5; ++i) {
+        planes[i] = (float*)malloc(w*h*sizeof(float));
+        failed |= !planes[i];
+    }
+    if (failed) {
+        for (i=0; i<5; ++i)
+            free(planes[i]);
+        return INFINITY;
+    }
+    mu1 = planes[0];
+    mu2 = planes[1];
+    s1 = planes[2];
+    s2 = planes[3];
+    s12 = planes[4];
+
+    _ref_convolve(ref_f, w, h, &window, mu1);
+    _ref_convolve(cmp_f, w, h, &window, mu2);
+    for (i=0; i<w*h; ++i) {
+        s1[i] = ref_f[i] * ref_f[i];
+        s2[i] = cmp_f[i] * cmp_f[i];
+        s12[i] = ref_f[i] * cmp_f[i];
+    }
+    /* In place, as the original did: each output precedes the inputs it needs */
+    _ref_convolve(s1, w, h, &window, s1);
+    _ref_convolve(s2, w, h, &window, s2);
+    _ref_convolve(s12, w, h, &window, s12);
+    ow = w - window.w + 1;
+    oh = h - window.h + 1;
+
+    for (i=0; i<ow*oh; ++i) {
+        s1[i] -= mu1[i] * mu1[i];
+        s2[i] -= mu2[i] * mu2[i];
+        s12[i] -= mu1[i] * mu2[i];
+        if (!args) {
+            sum += ((2.0 * mu1[i] * mu2[i] + C1) * (2.0 * s12[i] + C2)) /
+                ((mu1[i]*mu1[i] + mu2[i]*mu2[i] + C1) * (s1[i] + s2[i] + C2));
+            continue;
+        }
+        if (s1[i] < 0.0f)
+            s1[i] = 0.0f;
+        if (s2[i] < 0.0f)
+            s2[i] = 0.0f;
+        root = sqrt(s1[i] * s2[i]);
+        if (C1 == 0 && mu1[i]*mu1[i] == 0 && mu2[i]*mu2[i] == 0)
+            l = 1.0;
+        else
+            l = _ref_component(2.0 * mu1[i] * mu2[i] + C1, mu1[i]*mu1[i] + mu2[i]*mu2[i] + C1, alpha);
+        if (C2 == 0 && s1[i] + s2[i] == 0)
+            c = 1.0;
+        else
+            c = _ref_component(2.0 * root + C2, s1[i] + s2[i] + C2, beta);
+        if (C3 == 0 && root == 0 && (s1[i] == 0 || s2[i] == 0))
+            s = (s1[i] == 0 && s2[i] == 0) ? 1.0 : 0.0;
+        else
+            s = _ref_component(s12[i] + C3, root + C3, gamma);
+        sum += l * c * s;
+        sum_l += l;
+        sum_c += c;
+        sum_s += s;
+    }
+    if (lcs) {
+        lcs[0] = sum_l / (double)(ow*oh);
+        lcs[1] = sum_c / (double)(ow*oh);
+        lcs[2] = sum_s / (double)(ow*oh);
+    }
+
+    for (i=0; i<5; ++i)
+        free(planes[i]);
+    return (float)(sum / (double)(ow*oh));
+}
+
+/* The original iqa_ssim(): whole images converted, scaled with a box filter
+ * and handed to _ref_ssim_float(). Returns INFINITY if out of memory. */
+static double _ref_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride,
+    int gaussian, const struct iqa_ssim_args *args)
+{
+    float *ref_f, *cmp_f, *lpf_kernel=0;
+    int scale, x, y, i;
+    double result;
+
+    scale = _max(1, _round((float)_min(w,h) / 256.0f));
+    if (args && args->f)
+        scale = args->f;
+
+    ref_f = (float*)malloc(w*h*sizeof(float));
+    cmp_f = (float*)malloc(w*h*sizeof(float));
+    if (scale > 1)
+        lpf_kernel = (float*)malloc(scale*scale*sizeof(float));
+    if (!ref_f || !cmp_f || (scale > 1 && !lpf_kernel)) {
+        free(ref_f);
+        free(cmp_f);
+        free(lpf_kernel);
+        return INFINITY;
+    }
+
+    for (y=0; y<h; ++y) {
+        for (x=0; x<w; ++x) {
+            ref_f[y*w+x] = (float)ref[y*stride+x];
+            cmp_f[y*w+x] = (float)cmp[y*stride+x];
+        }
+    }
+    if (scale > 1) {
+        for (i=0; i<scale*scale; ++i)
+            lpf_kernel[i] = 1.0f/(scale*scale);
+        _ref_decimate(ref_f, w, h, scale, lpf_kernel, scale, ref_f, &x, &y);
+        _ref_decimate(cmp_f, w, h, scale, lpf_kernel, scale, cmp_f, &w, &h);
+        free(lpf_kernel);
+    }
+
+    result = _ref_ssim_float(ref_f, cmp_f, w, h, gaussian, args, 0);
+    free(ref_f);
+    free(cmp_f);
+    return result;
+}
+
+/* The original MS-SSIM's low-pass filter (9/7 biorthogonal wavelet) and
+ * weights of each scale */
+#define REF_LPF_LEN 9
+static const float ref_lpf[REF_LPF_LEN*REF_LPF_LEN] = {
+    0.000714f,-0.000450f,-0.002090f, 0.007132f, 0.016114f, 0.007132f,-0.002090f,-0.000450f, 0.000714f,
+   -0.000450f, 0.000283f, 0.001316f,-0.004490f,-0.010146f,-0.004490f, 0.001316f, 0.000283f,-0.000450f,
+   -0.002090f, 0.001316f, 0.006115f,-0.020867f,-0.047149f,-0.020867f, 0.006115f, 0.001316f,-0.002090f,
+    0.007132f,-0.004490f,-0.020867f, 0.071207f, 0.160885f, 0.071207f,-0.020867f,-0.004490f, 0.007132f,
+    0.016114f,-0.010146f,-0.047149f, 0.160885f, 0.363505f, 0.160885f,-0.047149f,-0.010146f, 0.016114f,
+    0.007132f,-0.004490f,-0.020867f, 0.071207f, 0.160885f, 0.071207f,-0.020867f,-0.004490f, 0.007132f,
+   -0.002090f, 0.001316f, 0.006115f,-0.020867f,-0.047149f,-0.020867f, 0.006115f, 0.001316f,-0.002090f,
+   -0.000450f, 0.000283f, 0.001316f,-0.004490f,-0.010146f,-0.004490f, 0.001316f, 0.000283f,-0.000450f,
+    0.000714f,-0.000450f,-0.002090f, 0.007132f, 0.016114f, 0.007132f,-0.002090f,-0.000450f, 0.000714f,
+};
+static const float ref_alphas[] = { 0.0000f, 0.0000f, 0.0000f, 0.0000f, 0.1333f };
+static const float ref_betas[]  = { 0.0448f, 0.2856f, 0.3001f, 0.2363f, 0.1333f };
+static const float ref_gammas[] = { 0.0448f, 0.2856f, 0.3001f, 0.2363f, 0.1333f };
+
+/* The original iqa_ms_ssim(): a full-plane pyramid, each level decimated
+ * from the one before, and _ref_ssim_float() with unit exponents at each
+ * scale (no constants for MS-SSIM*, Wang's for MS-SSIM). The scale's mean
+ * terms are raised to its weights and multiplied into a float, as before.
+ * Returns INFINITY if the images are too small or out of memory. */
+static double _ref_ms_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride,
+    const struct iqa_ms_ssim_args *args)
+{
+    int wang=0, gaussian=1, scales=5, idx, x, y, cur_w, cur_h;
+    const float *alphas=ref_alphas, *betas=ref_betas, *gammas=ref_gammas;
+    float *imgs[4], *tmp, msssim=1.0f;
+    struct iqa_ssim_args s_args;
+    double lcs[3], result;
+
+    if (args) {
+        wang = args->wang;
+        gaussian = args->gaussian;
+        scales = args->scales;
+        if (args->alphas)
+            alphas = args->alphas;
+        if (args->betas)
+            betas = args->betas;
+        if (args->gammas)
+            gammas = args->gammas;
+    }
+    cur_w = w;
+    cur_h = h;
+    for (idx=0; idx<scales; ++idx) {
+        if (gaussian ? cur_w<GAUSSIAN_LEN || cur_h<GAUSSIAN_LEN : cur_w<REF_LPF_LEN || cur_h<REF_LPF_LEN)
+            return INFINITY;
+        cur_w /= 2;
+        cur_h /= 2;
+    }
+
+    /* The current scale of each image in imgs[0] and [1], the next in [2] and [3] */
+    for (idx=0; idx<4; ++idx)
+        imgs[idx] = (float*)malloc(w*h*sizeof(float));
+    if (!imgs[0] || !imgs[1] || !imgs[2] || !imgs[3]) {
+        for (idx=0; idx<4; ++idx)
+            free(imgs[idx]);
+        return INFINITY;
+    }
+    for (y=0; y<h; ++y) {
+        for (x=0; x<w; ++x) {
+            imgs[0][y*w+x] = (float)ref[y*stride+x];
+            imgs[1][y*w+x] = (float)cmp[y*stride+x];
+        }
+    }
+
+    s_args.alpha = s_args.beta = s_args.gamma = 1.0f;
+    s_args.L = 255;
+    s_args.K1 = wang ? 0.01f : 0.0f;
+    s_args.K2 = wang ? 0.03f : 0.0f;
+    s_args.f = 1;
+    cur_w = w;
+    cur_h = h;
+    for (idx=0; idx<scales; ++idx) {
+        if (idx > 0) {
+            _ref_decimate(imgs[0], cur_w, cur_h, 2, ref_lpf, REF_LPF_LEN, imgs[2], &x, &y);
+            _ref_decimate(imgs[1], cur_w, cur_h, 2, ref_lpf, REF_LPF_LEN, imgs[3], &cur_w, &cur_h);
+            tmp = imgs[0]; imgs[0] = imgs[2]; imgs[2] = tmp;
+            tmp = imgs[1]; imgs[1] = imgs[3]; imgs[3] = tmp;
+        }
+        if (_ref_ssim_float(imgs[0], imgs[1], cur_w, cur_h, gaussian, &s_args, lcs) == INFINITY) {
+            msssim = INFINITY;
+            break;
+        }
+        msssim *= (float)(pow(lcs[0], (double)alphas[idx]) * pow(lcs[1], (double)betas[idx]) *
+            pow(fabs(lcs[2]), (double)gammas[idx]));
+    }
+
+    result = msssim;
+    for (idx=0; idx<4; ++idx)
+        free(imgs[idx]);
+    return result;
+}
+
+static double _ref_mse(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride)
+{
+    unsigned long long sum=0;
+    int x, y, error;
+
+    for (y=0; y<h; ++y) {
+        for (x=0; x<w; ++x) {
+            error = ref[y*stride+x] - cmp[y*stride+x];
+            sum += error * error;
+        }
+    }
+    return (float)((double)sum / (double)(w*h));
+}
+
+/* Fixed-point SSIM (iqa_ssim_ws_set_integer()) written out directly: 8-bit
+ * block averages when scaling, then exact 2-D window sums with the outer
+ * product of the integer 1-D weights. The ratio is the library's, term for
+ * term, and summed in the same order (by row), so the results must match
+ * exactly. Returns INFINITY if out of memory. */
+static double _ref_ssim_integer(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride,
+    int gaussian)
+{
+    const unsigned char *src[2];
+    unsigned char *img[2];
+    const int *k = gaussian ? g_gaussian_1d_fixed : g_square_1d_fixed;
+    int kw = gaussian ? GAUSSIAN_LEN : SQUARE_LEN;
+    int scale, sw, sh, i, x, y, u, v, sum, count, uc, even, sx_, sy_;
+    long long n, wt, sx, sy, sxx, syy, sxy, mu12, mu_sqd, total=0;
+    float C1 = (0.01f*255)*(0.01f*255);
+    float C2 = (0.03f*255)*(0.03f*255);
+    double c1, c2, row, ssim_sum=0.0;
+
+    scale = _max(1, _round((float)_min(w,h) / 256.0f));
+    sw = scale > 1 ? w/scale + (w&1) : w;
+    sh = scale > 1 ? h/scale + (h&1) : h;
+    src[0] = ref;
+    src[1] = cmp;
+    img[0] = (unsigned char*)malloc(sw*sh);
+    img[1] = (unsigned char*)malloc(sw*sh);
+    if (!img[0] || !img[1]) {
+        free(img[0]);
+        free(img[1]);
+        return INFINITY;
+    }
+    uc = scale/2;
+    even = (scale&1) ? 0 : 1;
+    count = scale*scale;
+    for (i=0; i<2; ++i) {
+        for (y=0; y<sh; ++y) {
+            for (x=0; x<sw; ++x) {
+                sum = 0;
+                for (v=-uc; v<=uc-even; ++v) {
+                    for (u=-uc; u<=uc-even; ++u) {
+                        sy_ = y*scale+v;
+                        sx_ = x*scale+u;
+                        sy_ = sy_ < 0 ? -1-sy_ : (sy_ >= h ? 2*h-sy_-1 : sy_);
+                        sx_ = sx_ < 0 ? -1-sx_ : (sx_ >= w ? 2*w-sx_-1 : sx_);
+                        sum += src[i][sy_*stride + sx_];
+                    }
+                }
+                img[i][y*sw+x] = (unsigned char)((sum + count/2) / count);
+            }
+        }
+    }
+
+    for (i=0; i<kw; ++i)
+        total += k[i];
+    n = total*total;
+    c1 = (double)C1 * (double)n * (double)n;
+    c2 = (double)C2 * (double)n * (double)n;
+    for (y=0; y<=sh-kw; ++y) {
+        row = 0.0;
+        for (x=0; x<=sw-kw; ++x) {
+            sx = sy = sxx = syy = sxy = 0;
+            for (v=0; v<kw; ++v) {
+                for (u=0; u<kw; ++u) {
+                    wt = (long long)k[v] * k[u];
+                    i = (y+v)*sw + x+u;
+                    sx  += wt * img[0][i];
+                    sy  += wt * img[1][i];
+                    sxx += wt * img[0][i] * img[0][i];
+                    syy += wt * img[1][i] * img[1][i];
+                    sxy += wt * img[0][i] * img[1][i];
+                }
+            }
+            mu12 = sx * sy;
+            mu_sqd = sx*sx + sy*sy;
+            row += (((double)(2*mu12) + c1) * ((double)(2*(n*sxy - mu12)) + c2)) /
+                (((double)mu_sqd + c1) * ((double)(n*(sxx + syy) - mu_sqd) + c2));
+        }
+        ssim_sum += row;
+    }
+    free(img[0]);
+    free(img[1]);
+    return (float)(ssim_sum / (double)((sw-kw+1)*(sh-kw+1)));
+}
+
+/*----------------------------------------------------------------------------
+ * Cases
+ *---------------------------------------------------------------------------*/
+
+/* Fills a random case: noise, a smooth ramp with noise, flat (zero
+ * variance) or only 0 and 255 (the largest sums), with distorted copies
+ * from light to heavy noise. */
+static void _acc_fill(struct _acc_case *c, int w, int h, int stride)
+{
+    int x, y, i, v, content = _acc_random() % 4;
+    static const char *contents[4] = { "noise", "ramp", "flat", "extremes" };
+
+    c->w = w;
+    c->h = h;
+    c->stride = stride;
+    c->flat = content == 2;
+    sprintf(c->desc, "%dx%d stride %d, %s", w, h, stride, contents[content]);
+    for (y=0; y<h; ++y) {
+        for (x=0; x<stride; ++x) {
+            if (content == 0)
+                v = _acc_random() % 256;
+            else if (content == 1)
+                v = (x*255/stride + y*255/h)/2 + (int)(_acc_random() % 17) - 8;
+            else if (content == 2)
+                v = 77;
+            else
+                v = (_acc_random() & 1) ? 255 : 0;
+            c->ref[y*stride+x] = (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+            for (i=0; i<ACC_CANDIDATES; ++i) {
+                v = c->ref[y*stride+x] + (int)(_acc_random() % (8*i+3)) - 4*i - 1;
+                c->cmp[i][y*stride+x] = (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+            }
+        }
+    }
+}
+
+/* Working buffers, each ACC_MAX_W*ACC_MAX_H floats */
+struct _acc_buffers {
+    float *img;         /* The reference as floats */
+    float *out;         /* Library output */
+    float *conv_2d;     /* Reference convolution with the random kernel */
+    float *conv_sep;    /* Reference convolution with the Gaussian window */
+};
+
+/* The reference results of a case, computed once for all SIMD levels */
+struct _acc_expected {
+    float kernel[9*9];
+    struct _kernel k;   /* Random 2-D kernel */
+    float mse[ACC_CANDIDATES];
+    float psnr[ACC_CANDIDATES];
+    float ssim[2][ACC_CANDIDATES];
+    float args[ACC_CANDIDATES];
+    float unit[ACC_CANDIDATES];
+    float ms_ssim[2][ACC_CANDIDATES];  /* MS-SSIM* and Wang's */
+    float integer[2][ACC_CANDIDATES];
+};
+
+/* SSIM arguments that send iqa_ssim() down the map/reduce path, per pixel
+ * and a row at a time */
+static const struct iqa_ssim_args acc_args = { 1.0f, 0.5f, 2.0f, 255, 0.01f, 0.03f, 1 };
+static const struct iqa_ssim_args acc_unit = { 1.0f, 1.0f, 1.0f, 255, 0.01f, 0.03f, 1 };
+
+static const struct iqa_ms_ssim_args acc_wang = { 1, 1, 5, 0, 0, 0 };
+
+static int _acc_fits(const struct _acc_case *c, int len)
+{
+    return c->w >= len && c->h >= len;
+}
+
+/* Computes the reference results of a case */
+static void _acc_expect(const struct _acc_case *c, struct _acc_buffers *b, struct _acc_expected *e)
+{
+    struct _kernel k;
+    int x, y, i, gaussian;
+
+    for (y=0; y<c->h; ++y)
+        for (x=0; x<c->w; ++x)
+            b->img[y*c->w+x] = (float)c->ref[y*c->stride+x];
+
+    memset(&e->k, 0, sizeof(e->k));
+    e->k.w = 1 + _acc_random() % 9;
+    e->k.h = 1 + _acc_random() % 9;
+    e->k.kernel = e->kernel;
+    e->k.bnd_opt = KBND_SYMMETRIC;
+    for (i=0; i<e->k.w*e->k.h; ++i)
+        e->kernel[i] = (float)(_acc_random() % 1000 + 1) / 1000.0f;
+    _ref_convolve(b->img, c->w, c->h, &e->k, b->conv_2d);
+    if (_acc_fits(c, GAUSSIAN_LEN)) {
+        memset(&k, 0, sizeof(k));
+        k.kernel = (float*)g_gaussian_window;
+        k.w = k.h = GAUSSIAN_LEN;
+        k.normalized = 1;
+        k.bnd_opt = KBND_SYMMETRIC;
+        _ref_convolve(b->img, c->w, c->h, &k, b->conv_sep);
+    }
+
+    for (i=0; i<ACC_CANDIDATES; ++i) {
+        e->mse[i] = (float)_ref_mse(c->ref, c->cmp[i], c->w, c->h, c->stride);
+        e->psnr[i] = (float)(10.0 * log10(255 * 255 / e->mse[i]));
+        for (gaussian=0; gaussian<2; ++gaussian) {
+            if (!_acc_fits(c, gaussian ? GAUSSIAN_LEN : SQUARE_LEN))
+                continue;
+            e->ssim[gaussian][i] = (float)_ref_ssim(c->ref, c->cmp[i], c->w, c->h, c->stride, gaussian, 0);
+            e->integer[gaussian][i] = (float)_ref_ssim_integer(c->ref, c->cmp[i], c->w, c->h, c->stride, gaussian);
+        }
+        if (_acc_fits(c, GAUSSIAN_LEN)) {
+            e->args[i] = (float)_ref_ssim(c->ref, c->cmp[i], c->w, c->h, c->stride, 1, &acc_args);
+            e->unit[i] = (float)_ref_ssim(c->ref, c->cmp[i], c->w, c->h, c->stride, 1, &acc_unit);
+        }
+        if (_acc_fits(c, ACC_MS_SSIM_MIN)) {
+            e->ms_ssim[0][i] = (float)_ref_ms_ssim(c->ref, c->cmp[i], c->w, c->h, c->stride, 0);
+            e->ms_ssim[1][i] = (float)_ref_ms_ssim(c->ref, c->cmp[i], c->w, c->h, c->stride, &acc_wang);
+        }
+    }
+}
+
+/* Convolves the reference with the random 2-D kernel and the SSIM Gaussian
+ * (separable) */
+static void _acc_convolve(const struct _acc_case *c, const char *simd, struct _acc_buffers *b,
+    const struct _acc_expected *e)
+{
+    struct _kernel k;
+    int i;
+
+    _iqa_convolve(b->img, c->w, c->h, &e->k, b->out, 0, 0);
+    for (i=0; i<(c->w-e->k.w+1)*(c->h-e->k.h+1); ++i)
+        _acc_check(ACC_CONVOLVE_2D, b->out[i], b->conv_2d[i], c->desc, simd);
+
+    if (!_acc_fits(c, GAUSSIAN_LEN))
+        return;
+    memset(&k, 0, sizeof(k));
+    k.kernel = (float*)g_gaussian_window;
+    k.kernel_h = k.kernel_v = (float*)g_gaussian_1d;
+    k.w = k.h = GAUSSIAN_LEN;
+    k.normalized = 1;
+    k.bnd_opt = KBND_SYMMETRIC;
+    _iqa_convolve(b->img, c->w, c->h, &k, b->out, 0, 0);
+    for (i=0; i<(c->w-k.w+1)*(c->h-k.h+1); ++i)
+        _acc_check(ACC_CONVOLVE_SEP, b->out[i], b->conv_sep[i], c->desc, simd);
+}
+
+/* Checks every metric of a case at the current SIMD level */
+static void _acc_case_run(const struct _acc_case *c, struct _acc_buffers *b, struct _acc_expected *e)
+{
+    const struct _iqa_simd *simd = _iqa_simd();
+    const unsigned char *cmps[ACC_CANDIDATES];
+    struct iqa_ssim_ws *ws;
+    float results[ACC_CANDIDATES], serial, result;
+    int i, gaussian, wang;
+
+    _acc_convolve(c, simd->name, b, e);
+
+    for (i=0; i<ACC_CANDIDATES; ++i) {
+        cmps[i] = c->cmp[i];
+        _acc_check(ACC_MSE, iqa_mse(c->ref, c->cmp[i], c->w, c->h, c->stride), e->mse[i], c->desc, simd->name);
+        _acc_check(ACC_PSNR, iqa_psnr(c->ref, c->cmp[i], c->w, c->h, c->stride), e->psnr[i], c->desc, simd->name);
+    }
+
+    for (gaussian=0; gaussian<2; ++gaussian) {
+        if (!_acc_fits(c, gaussian ? GAUSSIAN_LEN : SQUARE_LEN))
+            continue;
+        for (i=0; i<ACC_CANDIDATES; ++i)
+            _acc_check(gaussian ? ACC_SSIM_GAUSSIAN : ACC_SSIM_LINEAR,
+                iqa_ssim(c->ref, c->cmp[i], c->w, c->h, c->stride, gaussian, 0), e->ssim[gaussian][i],
+                c->desc, simd->name);
+
+        ws = iqa_ssim_ws_create(c->w, c->h, gaussian, 0);
+        if (!ws)
+            continue;
+        for (i=0; i<ACC_CANDIDATES; ++i) {
+            iqa_ssim_ws_set_threads(ws, 1);
+            serial = iqa_ssim_ws_run(ws, c->ref, c->cmp[i], c->stride);
+            iqa_ssim_ws_set_threads(ws, 3);
+            _acc_check(ACC_SSIM_THREADS, iqa_ssim_ws_run(ws, c->ref, c->cmp[i], c->stride), serial, c->desc, simd->name);
+        }
+        iqa_ssim_ws_set_threads(ws, 1);
+        if (!iqa_ssim_ws_run_multi(ws, c->ref, cmps, ACC_CANDIDATES, c->stride, results)) {
+            for (i=0; i<ACC_CANDIDATES; ++i)
+                _acc_check(ACC_SSIM_MULTI, results[i], iqa_ssim_ws_run(ws, c->ref, c->cmp[i], c->stride),
+                    c->desc, simd->name);
+        }
+
+        /* Fixed-point, serial then in tiles */
+        if (!iqa_ssim_ws_set_integer(ws, 1)) {
+            _acc_check(ACC_INTEGER, INFINITY, 0.0, c->desc, simd->name);
+        }
+        else {
+            for (i=0; i<ACC_CANDIDATES; ++i) {
+                serial = iqa_ssim_ws_run(ws, c->ref, c->cmp[i], c->stride);
+                _acc_check(ACC_INTEGER, serial, e->integer[gaussian][i], c->desc, simd->name);
+                _acc_check(_min(c->w, c->h) >= ACC_LARGE_MIN ? ACC_INTEGER_SCALED : ACC_INTEGER_FLOAT, serial,
+                    e->ssim[gaussian][i], c->desc, simd->name);
+            }
+            iqa_ssim_ws_set_threads(ws, 3);
+            for (i=0; i<ACC_CANDIDATES; ++i)
+                _acc_check(ACC_INTEGER, iqa_ssim_ws_run(ws, c->ref, c->cmp[i], c->stride), e->integer[gaussian][i],
+                    c->desc, simd->name);
+        }
+        iqa_ssim_ws_destroy(ws);
+    }
+
+    if (_acc_fits(c, GAUSSIAN_LEN)) {
+        for (i=0; i<ACC_CANDIDATES; ++i) {
+            _acc_check(ACC_SSIM_ARGS, iqa_ssim(c->ref, c->cmp[i], c->w, c->h, c->stride, 1, &acc_args), e->args[i],
+                c->desc, simd->name);
+            _acc_check(ACC_SSIM_UNIT, iqa_ssim(c->ref, c->cmp[i], c->w, c->h, c->stride, 1, &acc_unit), e->unit[i],
+                c->desc, simd->name);
+        }
+    }
+
+    if (_acc_fits(c, ACC_MS_SSIM_MIN)) {
+        for (i=0; i<ACC_CANDIDATES; ++i) {
+            for (wang=0; wang<2; ++wang) {
+                result = iqa_ms_ssim(c->ref, c->cmp[i], c->w, c->h, c->stride, wang ? &acc_wang : 0);
+                _acc_check(wang ? ACC_MS_SSIM_WANG : (c->flat ? ACC_MS_SSIM_FLAT : ACC_MS_SSIM), result,
+                    e->ms_ssim[wang][i], c->desc, simd->name);
+            }
+        }
+    }
+}
+
+/* Runs a case at every SIMD level the CPU has, scalar first */
+static void _acc_case_levels(const struct _acc_case *c, struct _acc_buffers *b)
+{
+    struct _acc_expected e;
+    int level;
+
+    _acc_expect(c, b, &e);
+    for (level=IQA_SIMD_SCALAR; level<=IQA_SIMD_AVX512; ++level) {
+        if (_iqa_simd_select(level) != level)
+            continue;
+        _acc_case_run(c, b, &e);
+    }
+}
+
+/* Runs the BMP fixtures: each distorted image against its original. The
+ * reference is slow on the large ones, so they're left to the long run. */
+#define ACC_SMALL_FIXTURES 3
+static int _acc_fixtures(struct _acc_case *c, struct _acc_buffers *b, int all)
+{
+    static const char *pairs[][2] = {
+        { "einstein.bmp", "blur.bmp" },
+        { "einstein.bmp", "contrast.bmp" },
+        { "einstein.bmp", "impulse.bmp" },
+        { "Courtright.bmp", "Courtright_Noise.bmp" },
+        { "skate_480x360.bmp", "skate_480x360.bmp" },
+    };
+    struct bmp orig, cmp;
+    int p, y, failures=0;
+
+    for (p=0; p<(all ? (int)(sizeof(pairs)/sizeof(pairs[0])) : ACC_SMALL_FIXTURES); ++p) {
+        if (load_bmp(pairs[p][0], &orig)) {
+            printf("\tFAILED to load '%s'\n", pairs[p][0]);
+            failures++;
+            continue;
+        }
+        if (load_bmp(pairs[p][1], &cmp)) {
+            printf("\tFAILED to load '%s'\n", pairs[p][1]);
+            free_bmp(&orig);
+            failures++;
+            continue;
+        }
+        if (orig.w > ACC_MAX_W || orig.h > ACC_MAX_H || orig.w != cmp.w || orig.h != cmp.h) {
+            printf("\t'%s' is too large or doesn't match '%s'\n", pairs[p][0], pairs[p][1]);
+            failures++;
+        }
+        else {
+            /* Copied into the case so the BMP stride (and padding) doesn't
+             * matter. The candidates are the distorted image, the original
+             * itself and the distorted image upside down. */
+            c->w = orig.w;
+            c->h = orig.h;
+            c->stride = orig.w;
+            c->flat = 0;
+            sprintf(c->desc, "%s vs %s", pairs[p][0], pairs[p][1]);
+            for (y=0; y<c->h; ++y) {
+                memcpy(c->ref + y*c->stride, orig.img + y*orig.stride, c->w);
+                memcpy(c->cmp[0] + y*c->stride, cmp.img + y*cmp.stride, c->w);
+                memcpy(c->cmp[1] + y*c->stride, orig.img + y*orig.stride, c->w);
+                memcpy(c->cmp[2] + y*c->stride, cmp.img + (c->h-1-y)*cmp.stride, c->w);
+            }
+            _acc_case_levels(c, b);
+        }
+        free_bmp(&orig);
+        free_bmp(&cmp);
+    }
+    return failures;
+}
+
+/*----------------------------------------------------------------------------
+ * TEST ENTRY POINT
+ *---------------------------------------------------------------------------*/
+int test_accuracy(int cases, int all_fixtures)
+{
+    struct _acc_case c;
+    struct _acc_buffers b;
+    int n, i, w, h, failures=0, start_level;
+
+    printf("\nAccuracy against the reference (%d random cases, all SIMD levels up to %s):\n", cases, _iqa_simd()->name);
+    start_level = _iqa_simd()->level;
+    acc_seed = 0x9E3779B9;
+
+    c.ref = (unsigned char*)malloc(ACC_MAX_STRIDE*ACC_MAX_H);
+    b.img = (float*)malloc(ACC_MAX_W*ACC_MAX_H*sizeof(float));
+    b.out = (float*)malloc(ACC_MAX_W*ACC_MAX_H*sizeof(float));
+    b.conv_2d = (float*)malloc(ACC_MAX_W*ACC_MAX_H*sizeof(float));
+    b.conv_sep = (float*)malloc(ACC_MAX_W*ACC_MAX_H*sizeof(float));
+    failures = !c.ref || !b.img || !b.out || !b.conv_2d || !b.conv_sep;
+    for (i=0; i<ACC_CANDIDATES; ++i) {
+        c.cmp[i] = (unsigned char*)malloc(ACC_MAX_STRIDE*ACC_MAX_H);
+        failures |= !c.cmp[i];
+    }
+    if (failures) {
+        printf("\tFAILED: out of memory\n");
+    }
+    else {
+        for (n=0; n<cases; ++n) {
+            /* Every eighth case is large enough for iqa_ssim() to scale it down */
+            if (n % 8 == 7) {
+                w = ACC_LARGE_MIN + _acc_random() % (ACC_LARGE_MAX-ACC_LARGE_MIN+1);
+                h = ACC_LARGE_MIN + _acc_random() % (ACC_LARGE_MAX-ACC_LARGE_MIN+1);
+            }
+            else {
+                w = SQUARE_LEN + _acc_random() % 200;
+                h = SQUARE_LEN + _acc_random() % 200;
+            }
+            _acc_fill(&c, w, h, w + _acc_random() % 17);
+            _acc_case_levels(&c, &b);
+        }
+        failures += _acc_fixtures(&c, &b, all_fixtures);
+
+        for (i=0; i<ACC_METRICS; ++i) {
+            printf("\t  %-20s max abs %.3e  max rel %.3e  (%d values, tolerance %.0e abs, %.0e rel)\t%s\n",
+                metrics[i].name, metrics[i].max_abs, metrics[i].max_rel, metrics[i].checks,
+                metrics[i].tol_abs, metrics[i].tol_rel, metrics[i].failures ? "FAILED" : "PASS");
+            failures += metrics[i].failures ? 1 : 0;
+        }
+    }
+
+    _iqa_simd_select(start_level);
+    free(c.ref);
+    for (i=0; i<ACC_CANDIDATES; ++i)
+        free(c.cmp[i]);
+    free(b.img);
+    free(b.out);
+    free(b.conv_2d);
+    free(b.conv_sep);
+    return failures;
+}
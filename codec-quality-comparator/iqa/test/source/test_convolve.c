@@ -49,6 +49,8 @@ static float kernel_3x3[9] = {
     k3x3, k3x3, k3x3,
     k3x3, k3x3, k3x3
 };
+#define k3x1 1.0f/3.0f
+static float kernel_3x1[3] = { k3x1, k3x1, k3x1 };
 
 static float img_1x1[1] = {
     128.0f
@@ -72,6 +74,7 @@ static float img_4x4[16] = {
 static int _test_convolve_1x1_kernel();
 static int _test_convolve_2x2_kernel();
 static int _test_convolve_3x3_kernel();
+static int _test_convolve_3x3_separable();
 static int _test_img_filter_1x1_kernel();
 static int _test_img_filter_2x2_kernel();
 static int _test_img_filter_3x3_kernel();
@@ -87,6 +90,7 @@ int test_convolve()
     failure += _test_convolve_1x1_kernel();
     failure += _test_convolve_2x2_kernel();
     failure += _test_convolve_3x3_kernel();
+    failure += _test_convolve_3x3_separable();
     printf("\nImage Filter:\n");
     failure += _test_img_filter_1x1_kernel();
     failure += _test_img_filter_2x2_kernel();
@@ -113,6 +117,7 @@ int _test_convolve_1x1_kernel()
     k.w = k.h = 1;
     k.kernel = kernel_1x1;
     k.normalized = 1;
+    k.kernel_h = k.kernel_v = 0;
 
     printf("\t1x1 image, 1x1 kernel:\n");
     printf("\t  w/ result no rw/rh: ");
@@ -191,6 +196,7 @@ int _test_convolve_2x2_kernel()
     k.w = k.h = 2;
     k.kernel = kernel_2x2;
     k.normalized = 1;
+    k.kernel_h = k.kernel_v = 0;
 
     /* With result buffer, no rw or rh */
     printf("\t  w/ result no rw/rh: ");
@@ -233,6 +239,7 @@ int _test_convolve_3x3_kernel()
     k.w = k.h = 3;
     k.kernel = kernel_3x3;
     k.normalized = 1;
+    k.kernel_h = k.kernel_v = 0;
 
     /* With result buffer, no rw or rh */
     printf("\t  w/ result no rw/rh: ");
@@ -257,6 +264,53 @@ int _test_convolve_3x3_kernel()
     return failures;
 }
 
+/*----------------------------------------------------------------------------
+ * _test_convolve_3x3_separable
+ *---------------------------------------------------------------------------*/
+int _test_convolve_3x3_separable()
+{
+    int rw, rh, passed, failures=0;
+    struct _kernel k;
+    float img_tmp_4x4[16];
+
+    float result_2x2[4] = {
+        106.444f, 99.333f,
+        99.333f, 127.667f
+    };
+
+    printf("\t4x4 image, 3x3 separable kernel:\n");
+    k.w = k.h = 3;
+    k.kernel = kernel_3x3;
+    k.normalized = 1;
+    k.kernel_h = k.kernel_v = kernel_3x1;
+
+    /* With result buffer, WITH rw or rh */
+    printf("\t  w/ result w/ rw/rh: ");
+    memset(img_tmp_4x4,0,sizeof(img_tmp_4x4));
+    _iqa_convolve(img_4x4, 4, 4, &k, img_tmp_4x4, &rw, &rh);
+    passed = 0;
+    if (_matrix_cmp(img_tmp_4x4, result_2x2, 2, 2, 3) == 0 &&
+        rw == 2 &&
+        rh == 2)
+        passed = 1;
+    printf("[%i,%i]\t%s\n", rw, rh, passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    /* In-place, WITH rw or rh */
+    printf("\t  in-place  w/ rw/rh: ");
+    memcpy(img_tmp_4x4, img_4x4, sizeof(img_4x4));
+    _iqa_convolve(img_tmp_4x4, 4, 4, &k, 0, &rw, &rh);
+    passed = 0;
+    if (_matrix_cmp(img_tmp_4x4, result_2x2, 2, 2, 3) == 0 &&
+        rw == 2 &&
+        rh == 2)
+        passed = 1;
+    printf("[%i,%i] \t%s\n", rw, rh, passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    return failures;
+}
+
 /*----------------------------------------------------------------------------
  * _test_img_filter_1x1_kernel
  *---------------------------------------------------------------------------*/
@@ -275,6 +329,7 @@ int _test_img_filter_1x1_kernel()
     k.w = k.h = 1;
     k.kernel = kernel_1x1;
     k.normalized = 1;
+    k.kernel_h = k.kernel_v = 0;
     k.bnd_opt = KBND_SYMMETRIC;
 
     /* 1x1 image, 1x1 kernel */
@@ -330,6 +385,7 @@ int _test_img_filter_2x2_kernel()
     k.w = k.h = 2;
     k.kernel = kernel_2x2;
     k.normalized = 1;
+    k.kernel_h = k.kernel_v = 0;
     k.bnd_opt = KBND_SYMMETRIC;
 
     /* With result buffer */
@@ -375,6 +431,7 @@ int _test_img_filter_3x3_kernel()
     k.w = k.h = 3;
     k.kernel = kernel_3x3;
     k.normalized = 1;
+    k.kernel_h = k.kernel_v = 0;
     k.bnd_opt = KBND_SYMMETRIC;
 
     /* With result buffer */
@@ -104,11 +104,13 @@ int _test_decimate_2x_4x4()
     k_linear.w = k_linear.h = 2;
     k_linear.kernel = lpf_avg_2x2;
     k_linear.normalized = 1;
+    k_linear.kernel_h = k_linear.kernel_v = 0;
     k_linear.bnd_opt = KBND_SYMMETRIC;
 
     k_gaussian.w = k_gaussian.h = 3;
     k_gaussian.kernel = lpf_gaussian_3x3;
     k_gaussian.normalized = 1;
+    k_gaussian.kernel_h = k_gaussian.kernel_v = 0;
     k_gaussian.bnd_opt = KBND_SYMMETRIC;
 
     printf("\t4x4 image, 2x2 linear filter, 2x factor:\n");
@@ -184,11 +186,13 @@ int _test_decimate_2x_5x5()
     k_linear.w = k_linear.h = 2;
     k_linear.kernel = lpf_avg_2x2;
     k_linear.normalized = 1;
+    k_linear.kernel_h = k_linear.kernel_v = 0;
     k_linear.bnd_opt = KBND_SYMMETRIC;
 
     k_gaussian.w = k_gaussian.h = 3;
     k_gaussian.kernel = lpf_gaussian_3x3;
     k_gaussian.normalized = 1;
+    k_gaussian.kernel_h = k_gaussian.kernel_v = 0;
     k_gaussian.bnd_opt = KBND_SYMMETRIC;
 
     printf("\t5x5 image, 2x2 linear filter, 2x factor:\n");
@@ -257,6 +261,7 @@ int _test_decimate_3x_5x5()
     k_gaussian.w = k_gaussian.h = 3;
     k_gaussian.kernel = lpf_gaussian_3x3;
     k_gaussian.normalized = 1;
+    k_gaussian.kernel_h = k_gaussian.kernel_v = 0;
     k_gaussian.bnd_opt = KBND_SYMMETRIC;
 
     printf("\t5x5 image, 3x3 Gaussian filter, 3x factor:\n");
@@ -35,6 +35,7 @@
 #include "iqa.h"
 #include "convolve.h"
 #include "bmp.h"
+#include "einstein.h"
 #include "hptime.h"
 #include "math_utils.h"
 #include <stdio.h>
@@ -168,6 +169,8 @@ static int _test_einstein_bmp(const struct answer *answers, const struct iqa_ms_
 static int _test_courtright_bmp(const struct answer *answers, const struct iqa_ms_ssim_args *args, const char* str);
 static int _test_skate_bmp(const struct answer *answers, const struct iqa_ms_ssim_args *args, const char* str);
 static int _test_h_greater_than_w(const char* str); /* Regression test for bug 3349231 */
+static int _check_ws_run(const struct bmp *orig, const struct bmp *cmp, int idx, void *ctx);
+static int _test_workspace(const struct answer *answers, const struct iqa_ms_ssim_args *args, const char* str);
 
 /*----------------------------------------------------------------------------
  * TEST ENTRY POINT
@@ -185,6 +188,8 @@ int test_ms_ssim()
     failure += _test_courtright_bmp(ans_key_courtright, 0, "Rouse/Hemami");
     failure += _test_skate_bmp(ans_key_skate, 0, "Buffer overflow [#3288043]");
     failure += _test_h_greater_than_w("Height greater than width [#3349231]");
+    failure += _test_workspace(ans_key_einstein_def, 0, "Rouse/Hemami");
+    failure += _test_workspace(ans_key_einstein_wang, &args_wang, "Wang");
 
     return failure;
 }
@@ -471,4 +476,66 @@ int _test_h_greater_than_w(const char* str)
 
     free_bmp(&orig);
     return failures;
-}
\ No newline at end of file
+}
+
+/* For _check_ws_run() */
+struct ws_run {
+    struct iqa_ms_ssim_ws *ws;
+    const struct answer *answers;
+};
+
+/*----------------------------------------------------------------------------
+ * _check_ws_run
+ *
+ * Scores the image with run->ws, which must match the answer key.
+ *---------------------------------------------------------------------------*/
+int _check_ws_run(const struct bmp *orig, const struct bmp *cmp, int idx, void *ctx)
+{
+    struct ws_run *run = (struct ws_run*)ctx;
+    float result;
+    unsigned long long start, end;
+    int passed;
+
+    start = hpt_get_time();
+    result = iqa_ms_ssim_ws_run(run->ws, orig->img, cmp->img, orig->stride);
+    end = hpt_get_time();
+    passed = _cmp_float(result, run->answers[idx].value, run->answers[idx].precision) ? 0 : 1;
+    printf("\t%.5f  (%.3lf ms)\t%s\n", 
+        result, 
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+    return passed ? 0 : 1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_workspace
+ *
+ * Scores the Einstein images twice with one iqa_ms_ssim_ws. Its image
+ * pyramid is rebuilt for every pair, so both passes must give the answers
+ * of iqa_ms_ssim().
+ *---------------------------------------------------------------------------*/
+int _test_workspace(const struct answer *answers, const struct iqa_ms_ssim_args *args, const char* str)
+{
+    struct bmp orig;
+    struct ws_run run;
+    int pass, failures=0;
+
+    printf("\tEinstein workspace (%s):\n", str);
+
+    if (load_einstein(0, &orig))
+        return 1;
+    run.ws = iqa_ms_ssim_ws_create(orig.w, orig.h, args);
+    run.answers = answers;
+    if (!run.ws) {
+        printf("FAILED to create workspace\n");
+        free_bmp(&orig);
+        return 1;
+    }
+
+    for (pass=0; pass<2; ++pass)
+        failures += for_each_einstein(&orig, _check_ws_run, &run);
+
+    iqa_ms_ssim_ws_destroy(run.ws);
+    free_bmp(&orig);
+    return failures;
+}
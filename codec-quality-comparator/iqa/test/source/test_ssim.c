@@ -35,6 +35,7 @@
 #include "iqa.h"
 #include "convolve.h"
 #include "bmp.h"
+#include "einstein.h"
 #include "hptime.h"
 #include "math_utils.h"
 #include <stdio.h>
@@ -151,6 +152,18 @@ static const struct answer ans_key_courtright[] = {
 static int _test_ssim_22x15(int gaussian, const struct answer *answers, const struct iqa_ssim_args *args);
 static int _test_ssim_einstein_bmp(int gaussian, const struct answer *answers, const struct iqa_ssim_args *args);
 static int _test_ssim_courtright_bmp(int gaussian, const struct answer *answers, const struct iqa_ssim_args *args);
+/* For _check_ws_run() */
+struct ws_run {
+    struct iqa_ssim_ws *ws;
+    struct iqa_ssim_ws *reference;  /* If set, the result must match this one exactly */
+    const struct answer *answers;
+};
+
+static int _check_ws_run(const struct bmp *orig, const struct bmp *cmp, int idx, void *ctx);
+static int _test_ssim_workspace(int gaussian, const struct answer *answers, const struct iqa_ssim_args *args);
+static int _test_ssim_threads(int gaussian, const struct answer *answers, int threads);
+static int _test_ssim_multi(int gaussian, const struct answer *answers);
+static int _test_ssim_timing(int gaussian, const struct answer *answers, int threads);
 
 
 /*----------------------------------------------------------------------------
@@ -168,6 +181,15 @@ int test_ssim()
     failure += _test_ssim_einstein_bmp(0, ans_key_einstein_linear, 0);
     failure += _test_ssim_einstein_bmp(1, ans_key_einstein_args, &ssim_args);
     failure += _test_ssim_courtright_bmp(1, ans_key_courtright, 0);
+    failure += _test_ssim_workspace(1, ans_key_einstein_gauss, 0);
+    failure += _test_ssim_workspace(0, ans_key_einstein_linear, 0);
+    failure += _test_ssim_workspace(1, ans_key_einstein_args, &ssim_args);
+    failure += _test_ssim_threads(1, ans_key_einstein_gauss, 4);
+    failure += _test_ssim_threads(0, ans_key_einstein_linear, 3);
+    failure += _test_ssim_multi(1, ans_key_einstein_gauss);
+    failure += _test_ssim_multi(0, ans_key_einstein_linear);
+    failure += _test_ssim_timing(1, ans_key_einstein_gauss, 1);
+    failure += _test_ssim_timing(1, ans_key_einstein_gauss, 4);
 
     return failure;
 }
@@ -220,6 +242,7 @@ int _test_ssim_22x15(int gaussian, const struct answer *answers, const struct iq
     lpf.kernel = lpf_linear_2x2;
     lpf.w = lpf.h = 2;
     lpf.normalized = 1;
+    lpf.kernel_h = lpf.kernel_v = 0;
     lpf.bnd_opt = KBND_SYMMETRIC;
     for (y=0; y < img_height; ++y) {
         for (x=0; x < img_width; ++x) {
@@ -440,3 +463,213 @@ int _test_ssim_courtright_bmp(int gaussian, const struct answer *answers, const
     return failures;
 }
 
+/*----------------------------------------------------------------------------
+ * _check_ws_run
+ *
+ * Scores the image with run->ws. It must match the answer key and, if there
+ * is a reference workspace, be exactly the same as its result.
+ *---------------------------------------------------------------------------*/
+int _check_ws_run(const struct bmp *orig, const struct bmp *cmp, int idx, void *ctx)
+{
+    struct ws_run *run = (struct ws_run*)ctx;
+    float result, expected=0.0f;
+    unsigned long long start, end;
+    int passed;
+
+    if (run->reference)
+        expected = iqa_ssim_ws_run(run->reference, orig->img, cmp->img, orig->stride);
+    start = hpt_get_time();
+    result = iqa_ssim_ws_run(run->ws, orig->img, cmp->img, orig->stride);
+    end = hpt_get_time();
+    passed = (!_cmp_float(result, run->answers[idx].value, run->answers[idx].precision) &&
+        (!run->reference || result == expected)) ? 1 : 0;
+    printf("\t%.5f  (%.3lf ms)\t%s\n", 
+        result, 
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+    return passed ? 0 : 1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_ssim_workspace
+ *
+ * Scores the Einstein images twice with one iqa_ssim_ws. Both passes must
+ * give iqa_ssim()'s answers, so nothing from one pair carries over into the
+ * next.
+ *---------------------------------------------------------------------------*/
+int _test_ssim_workspace(int gaussian, const struct answer *answers, const struct iqa_ssim_args *args)
+{
+    struct bmp orig;
+    struct ws_run run;
+    int pass, failures=0;
+
+    printf("\tEinstein workspace (%s%s):\n", gaussian?"Gaussian":"Linear",args?" - Custom Args":"");
+
+    if (load_einstein(0, &orig))
+        return 1;
+    run.ws = iqa_ssim_ws_create(orig.w, orig.h, gaussian, args);
+    run.reference = 0;
+    run.answers = answers;
+    if (!run.ws) {
+        printf("FAILED to create workspace\n");
+        free_bmp(&orig);
+        return 1;
+    }
+
+    for (pass=0; pass<2; ++pass)
+        failures += for_each_einstein(&orig, _check_ws_run, &run);
+
+    iqa_ssim_ws_destroy(run.ws);
+    free_bmp(&orig);
+    return failures;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_ssim_threads
+ *
+ * Scores the Einstein images with a workspace split into tiles across
+ * 'threads' threads. The result must match the answer key and be exactly
+ * the same as the serial workspace.
+ *---------------------------------------------------------------------------*/
+int _test_ssim_threads(int gaussian, const struct answer *answers, int threads)
+{
+    struct bmp orig;
+    struct ws_run run;
+    int used, failures;
+
+    printf("\tEinstein %d threads (%s):\n", threads, gaussian?"Gaussian":"Linear");
+
+    if (load_einstein(0, &orig))
+        return 1;
+    run.ws = iqa_ssim_ws_create(orig.w, orig.h, gaussian, 0);
+    run.reference = iqa_ssim_ws_create(orig.w, orig.h, gaussian, 0);
+    run.answers = answers;
+    if (!run.ws || !run.reference) {
+        printf("FAILED to create workspace\n");
+        iqa_ssim_ws_destroy(run.ws);
+        iqa_ssim_ws_destroy(run.reference);
+        free_bmp(&orig);
+        return 1;
+    }
+    used = iqa_ssim_ws_set_threads(run.ws, threads);
+    printf("\t  Threads used: %d\n", used);
+
+    failures = for_each_einstein(&orig, _check_ws_run, &run);
+
+    iqa_ssim_ws_destroy(run.reference);
+    iqa_ssim_ws_destroy(run.ws);
+    free_bmp(&orig);
+    return failures;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_ssim_multi
+ *
+ * Scores all the Einstein images against the original in one call, with
+ * the buffers reserved up front. Each
+ * result must match the answer key and be exactly the same as scoring that
+ * image on its own.
+ *---------------------------------------------------------------------------*/
+int _test_ssim_multi(int gaussian, const struct answer *answers)
+{
+    struct bmp orig, cmp[EINSTEIN_COUNT];
+    const unsigned char *imgs[EINSTEIN_COUNT];
+    struct iqa_ssim_ws *ws, *single;
+    int idx, loaded, passed, failures=0;
+    float results[EINSTEIN_COUNT], expected;
+    unsigned long long start=0, end=0;
+
+    printf("\tEinstein one-to-many (%s):\n", gaussian?"Gaussian":"Linear");
+
+    if (load_einstein(0, &orig))
+        return 1;
+    for (loaded=0; loaded<EINSTEIN_COUNT; ++loaded) {
+        if (load_einstein(loaded, &cmp[loaded])) {
+            failures = 1;
+            break;
+        }
+        imgs[loaded] = cmp[loaded].img;
+    }
+    ws = iqa_ssim_ws_create(orig.w, orig.h, gaussian, 0);
+    single = iqa_ssim_ws_create(orig.w, orig.h, gaussian, 0);
+    if (!failures && (!ws || !single)) {
+        printf("FAILED to create workspace\n");
+        failures = 1;
+    }
+
+    if (!failures && iqa_ssim_ws_reserve_multi(ws, EINSTEIN_COUNT)) {
+        printf("FAILED to reserve buffers\n");
+        failures = 1;
+    }
+
+    if (!failures) {
+        start = hpt_get_time();
+        if (iqa_ssim_ws_run_multi(ws, orig.img, imgs, EINSTEIN_COUNT, orig.stride, results)) {
+            printf("FAILED to run\n");
+            failures = 1;
+        }
+        end = hpt_get_time();
+    }
+    if (!failures) {
+        printf("\t  All %d in %.3lf ms\n", EINSTEIN_COUNT, hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0);
+        for (idx=0; idx<EINSTEIN_COUNT; ++idx) {
+            expected = iqa_ssim_ws_run(single, orig.img, imgs[idx], orig.stride);
+            passed = (results[idx] == expected && _cmp_float(results[idx], answers[idx].value, answers[idx].precision)) ? 0 : 1;
+            printf("\t  %s: \t%.5f\t%s\n", einstein_files[idx], results[idx], passed?"PASS":"FAILED");
+            failures += passed?0:1;
+        }
+    }
+
+    iqa_ssim_ws_destroy(single);
+    iqa_ssim_ws_destroy(ws);
+    for (idx=0; idx<loaded; ++idx)
+        free_bmp(&cmp[idx]);
+    free_bmp(&orig);
+    return failures;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_ssim_timing
+ *
+ * Stage timing must not change the results. Each stage must have taken some
+ * time, and reading the times must clear them.
+ *---------------------------------------------------------------------------*/
+int _test_ssim_timing(int gaussian, const struct answer *answers, int threads)
+{
+    struct bmp orig;
+    struct ws_run run;
+    struct iqa_ssim_timing timing, cleared;
+    int passed, failures;
+
+    printf("\tEinstein stage timing, %d threads (%s):\n", threads, gaussian?"Gaussian":"Linear");
+
+    if (load_einstein(0, &orig))
+        return 1;
+    run.ws = iqa_ssim_ws_create(orig.w, orig.h, gaussian, 0);
+    run.reference = iqa_ssim_ws_create(orig.w, orig.h, gaussian, 0);
+    run.answers = answers;
+    if (!run.ws || !run.reference) {
+        printf("FAILED to create workspace\n");
+        iqa_ssim_ws_destroy(run.ws);
+        iqa_ssim_ws_destroy(run.reference);
+        free_bmp(&orig);
+        return 1;
+    }
+    iqa_ssim_ws_set_timing(run.ws, 1);
+    iqa_ssim_ws_set_threads(run.ws, threads);
+
+    failures = for_each_einstein(&orig, _check_ws_run, &run);
+
+    iqa_ssim_ws_take_timing(run.ws, &timing);
+    iqa_ssim_ws_take_timing(run.ws, &cleared);
+    passed = (timing.convert > 0.0 && timing.filter > 0.0 && timing.combine > 0.0 &&
+        cleared.convert == 0.0 && cleared.filter == 0.0 && cleared.combine == 0.0) ? 1 : 0;
+    printf("\t  Convert %.3lf ms, filter %.3lf ms, combine %.3lf ms\t%s\n",
+        timing.convert * 1000.0, timing.filter * 1000.0, timing.combine * 1000.0, passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    iqa_ssim_ws_destroy(run.reference);
+    iqa_ssim_ws_destroy(run.ws);
+    free_bmp(&orig);
+    return failures;
+}
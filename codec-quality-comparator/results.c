@@ -0,0 +1,152 @@
+#include "results.h"
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define RESULTS_BUFFER_SIZE (1 << 20)
+
+static const char* format_names[] = { "text", "csv", "ndjson", "binary" };
+static const char* metric_names[RESULT_METRICS] = { "psnr", "ssim", "ms_ssim" };
+static const char* plane_names[RESULT_PLANES] = { "y", "cb", "cr", "yuv" };
+
+static FILE* output;
+static int output_format;
+static int candidate_count;
+static unsigned long* frames_written;   // Per candidate
+static double* sums;                    // For the summary means, RESULT_VALUES per candidate
+
+float weighted_yuv(const float* plane_results) {
+  return (LUMA_WEIGHT * plane_results[0] + plane_results[1] + plane_results[2]) / (LUMA_WEIGHT + 2);
+}
+
+float weighted_psnr_yuv(const float* plane_results) {
+  float mse[RESULT_PLANES - 1];
+  int plane;
+
+  for (plane = 0; plane < RESULT_PLANES - 1; plane++) {
+    mse[plane] = 255.0f * 255.0f / powf(10.0f, plane_results[plane] / 10.0f);
+  }
+  return 10.0f * log10f(255.0f * 255.0f / weighted_yuv(mse));
+}
+
+int results_format(const char* name) {
+  int format;
+
+  for (format = 0; format < (int)(sizeof(format_names) / sizeof(format_names[0])); format++) {
+    if (strcmp(name, format_names[format]) == 0) return format;
+  }
+  return -1;
+}
+
+void results_open(FILE* out, int format, int candidates) {
+  int metric, plane;
+
+  output = out;
+  output_format = format;
+  candidate_count = candidates;
+  frames_written = calloc(candidates, sizeof(unsigned long));
+  sums = calloc(candidates * RESULT_VALUES, sizeof(double));
+  if (frames_written == NULL || sums == NULL) {
+    fprintf(stderr, "\nERROR: Out of memory allocating result totals!\n");
+    exit(1);
+  }
+  // Must come before anything is written. The buffer lives for the rest of the process.
+  setvbuf(output, NULL, _IOFBF, RESULTS_BUFFER_SIZE);
+
+  if (format == RESULTS_CSV) {
+    fputs("frame,candidate", output);
+    for (metric = 0; metric < RESULT_METRICS; metric++) {
+      for (plane = 0; plane < RESULT_PLANES; plane++) {
+        fprintf(output, ",%s_%s", metric_names[metric], plane_names[plane]);
+      }
+    }
+    fputc('\n', output);
+  }
+}
+
+// Writes the values as CSV columns or JSON members.
+static void write_values(const float* values) {
+  int i;
+
+  for (i = 0; i < RESULT_VALUES; i++) {
+    if (output_format == RESULTS_CSV) {
+      fprintf(output, ",%.5f", values[i]);
+    } else if (isfinite(values[i])) {
+      fprintf(output, ",\"%s_%s\":%.5f", metric_names[i / RESULT_PLANES], plane_names[i % RESULT_PLANES], values[i]);
+    } else {
+      fprintf(output, ",\"%s_%s\":null", metric_names[i / RESULT_PLANES], plane_names[i % RESULT_PLANES]);
+    }
+  }
+}
+
+static void write_record(const char* tag, int candidate, uint64_t frame, const float* values) {
+  struct result_record record;
+
+  memcpy(record.tag, tag, 4);
+  record.candidate = candidate;
+  record.frame = frame;
+  memcpy(record.values, values, sizeof(record.values));
+  fwrite(&record, sizeof(record), 1, output);
+}
+
+void results_frame(unsigned long frame_number, int candidate, const float values[RESULT_VALUES]) {
+  char prefix[32] = "";
+  int i;
+
+  for (i = 0; i < RESULT_VALUES; i++) {
+    sums[candidate * RESULT_VALUES + i] += values[i];
+  }
+  frames_written[candidate]++;
+
+  switch (output_format) {
+    case RESULTS_TEXT:
+      if (candidate_count > 1) {
+        snprintf(prefix, sizeof(prefix), "Candidate %d ", candidate);
+      }
+      fprintf(output, "%sFrame %lu PSNR:    luma = %8.5f, chroma_cb = %8.5f, chroma_cr = %8.5f, yuv = %8.5f\n", prefix, frame_number, values[0], values[1], values[2], values[3]);
+      fprintf(output, "%sFrame %lu SSIM:    luma = %8.5f, chroma_cb = %8.5f, chroma_cr = %8.5f, yuv = %8.5f\n", prefix, frame_number, values[4], values[5], values[6], values[7]);
+      fprintf(output, "%sFrame %lu MS-SSIM: luma = %8.5f, chroma_cb = %8.5f, chroma_cr = %8.5f, yuv = %8.5f\n", prefix, frame_number, values[8], values[9], values[10], values[11]);
+      break;
+    case RESULTS_CSV:
+      fprintf(output, "%lu,%d", frame_number, candidate);
+      write_values(values);
+      fputc('\n', output);
+      break;
+    case RESULTS_NDJSON:
+      fprintf(output, "{\"type\":\"frame\",\"frame\":%lu,\"candidate\":%d", frame_number, candidate);
+      write_values(values);
+      fputs("}\n", output);
+      break;
+    case RESULTS_BINARY:
+      write_record("FRAM", candidate, frame_number, values);
+      break;
+  }
+}
+
+void results_close() {
+  float means[RESULT_VALUES];
+  int candidate, i;
+
+  for (candidate = 0; candidate < candidate_count; candidate++) {
+    for (i = 0; i < RESULT_VALUES; i++) {
+      means[i] = frames_written[candidate] ? sums[candidate * RESULT_VALUES + i] / frames_written[candidate] : 0;
+    }
+
+    switch (output_format) {
+      case RESULTS_CSV:
+        fprintf(output, "summary,%d", candidate);
+        write_values(means);
+        fputc('\n', output);
+        break;
+      case RESULTS_NDJSON:
+        fprintf(output, "{\"type\":\"summary\",\"candidate\":%d,\"frames\":%lu", candidate, frames_written[candidate]);
+        write_values(means);
+        fputs("}\n", output);
+        break;
+      case RESULTS_BINARY:
+        write_record("SUMM", candidate, frames_written[candidate], means);
+        break;
+    }
+  }
+  fflush(output);
+}
@@ -0,0 +1,53 @@
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Per-frame result output for the comparators, in a choice of formats.
+
+#define RESULT_METRICS 3             // PSNR, SSIM, MS-SSIM
+#define RESULT_PLANES 4              // Y, Cb, Cr, then the combined YUV score
+#define RESULT_VALUES (RESULT_METRICS * RESULT_PLANES)
+#define LUMA_WEIGHT 6                // The combined score is (6*Y + Cb + Cr) / 8
+
+#define RESULTS_TEXT   0             // The original three human-readable lines per frame
+#define RESULTS_CSV    1             // A header row, one row per frame, then "summary" rows
+#define RESULTS_NDJSON 2             // One JSON object per line; non-finite values are null
+#define RESULTS_BINARY 3             // Fixed 64-byte records (struct result_record)
+
+// Every format identifies the degraded stream (candidate) a result is for, counting from
+// 0, except text with a single candidate, which keeps the original lines.
+
+// A binary record, in the writer's byte order. 'tag' is "FRAM" for a frame, whose number
+// is in 'frame', or "SUMM" for a candidate's summary at the end, which has the number of
+// frames in 'frame' and the mean of each value. values[metric * RESULT_PLANES + plane].
+struct result_record {
+  char tag[4];
+  uint32_t candidate;
+  uint64_t frame;
+  float values[RESULT_VALUES];
+};
+
+// Combined score of a frame's Y, Cb and Cr results, weighting luma LUMA_WEIGHT times
+// as much as each chroma plane.
+float weighted_yuv(const float* plane_results);
+
+// The same for PSNR, but averaging the planes' MSE, so one identical plane (infinite
+// PSNR) doesn't make the whole frame infinite.
+float weighted_psnr_yuv(const float* plane_results);
+
+// Returns the RESULTS_* format called 'name' (text, csv, ndjson or binary), or -1.
+int results_format(const char* name);
+
+// Starts writing results for 'candidates' degraded streams to 'out', through a large
+// buffer that is flushed as it fills.
+void results_open(FILE* out, int format, int candidates);
+
+// Writes one frame's results for a candidate, in frame order.
+void results_frame(unsigned long frame_number, int candidate, const float values[RESULT_VALUES]);
+
+// Writes each candidate's summary record (nothing in text format) and flushes the output.
+void results_close();
+
+#endif
@@ -0,0 +1,196 @@
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+
+#define STATS_BUCKETS 65             // Bucket b holds values in [2^(b-1), 2^b); bucket 0 holds 0
+
+static const char* format_names[] = { "json", "csv" };
+static const char* stage_names[STAGE_COUNT] = {
+  "header", "read", "convert", "filter", "combine", "psnr", "output", "worker_idle", "reader_blocked", "queue_depth"
+};
+
+// Values are nanoseconds, or plain counts for STAGE_QUEUE. Updated with relaxed atomics,
+// so a dump taken while the workers run may be a few records out of step between fields.
+struct histogram {
+  unsigned long long count;
+  unsigned long long total;
+  unsigned long long max;
+  unsigned long long buckets[STATS_BUCKETS];
+};
+
+int stats_enabled = 0;
+static struct histogram histograms[STAGE_COUNT];
+static FILE* output;
+static int output_format;
+static double started;
+static unsigned long snapshots = 0;
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static sigset_t dump_signals;
+
+int stats_format(const char* name) {
+  int format;
+
+  for (format = 0; format < (int)(sizeof(format_names) / sizeof(format_names[0])); format++) {
+    if (strcmp(name, format_names[format]) == 0) return format;
+  }
+  return -1;
+}
+
+double stats_now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static void add_value(int stage, unsigned long long value) {
+  struct histogram* histogram = &histograms[stage];
+  unsigned long long max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+  int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+
+  __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->total, value, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+  while (value > max && !__atomic_compare_exchange_n(&histogram->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+void stats_record(int stage, double seconds) {
+  if (!stats_enabled) return;
+  add_value(stage, seconds > 0 ? (unsigned long long)(seconds * 1e9 + 0.5) : 0);
+}
+
+void stats_count(int stage, unsigned long count) {
+  if (!stats_enabled) return;
+  add_value(stage, count);
+}
+
+// A value in the stage's unit: seconds, or frames for the queue depth.
+static double in_units(int stage, double value) {
+  return stage == STAGE_QUEUE ? value : value / 1e9;
+}
+
+// The largest value a bucket can hold (the last is only bounded by the maximum).
+static double bucket_top(const struct histogram* histogram, int bucket) {
+  if (bucket == 0) return 0;
+  if (bucket == STATS_BUCKETS - 1) return (double)histogram->max;
+  return (double)((1ULL << bucket) - 1);
+}
+
+// Estimates a quantile from the buckets: the top of the bucket it falls in, or the
+// largest value if that's lower. Good to within a factor of two.
+static double quantile(const struct histogram* histogram, double q) {
+  unsigned long long rank = (unsigned long long)(q * histogram->count + 0.5), seen = 0;
+  double top;
+  int bucket;
+
+  if (rank < 1) rank = 1;
+  for (bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+    seen += histogram->buckets[bucket];
+    if (seen >= rank) break;
+  }
+  if (bucket == STATS_BUCKETS) return (double)histogram->max;
+  top = bucket_top(histogram, bucket);
+  return top < (double)histogram->max ? top : (double)histogram->max;
+}
+
+// Writes the non-empty buckets as (top of bucket, count) pairs.
+static void write_buckets(int stage, const struct histogram* histogram) {
+  int bucket, first = 1;
+
+  for (bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+    if (histogram->buckets[bucket] == 0) continue;
+    if (output_format == STATS_CSV) {
+      fprintf(output, "%s%.9g:%llu", first ? "" : " ", in_units(stage, bucket_top(histogram, bucket)), histogram->buckets[bucket]);
+    } else {
+      fprintf(output, "%s[%.9g,%llu]", first ? "" : ",", in_units(stage, bucket_top(histogram, bucket)), histogram->buckets[bucket]);
+    }
+    first = 0;
+  }
+}
+
+void stats_dump(const char* reason) {
+  struct histogram snapshot;
+  double elapsed;
+  int stage, bucket;
+
+  if (!stats_enabled) return;
+  pthread_mutex_lock(&dump_lock);
+  snapshots++;
+  elapsed = stats_now() - started;
+  if (output_format == STATS_JSON) {
+    fprintf(output, "{\"snapshot\":%lu,\"reason\":\"%s\",\"elapsed\":%.6f,\"stages\":{", snapshots, reason, elapsed);
+  }
+  for (stage = 0; stage < STAGE_COUNT; stage++) {
+    snapshot.count = __atomic_load_n(&histograms[stage].count, __ATOMIC_RELAXED);
+    snapshot.total = __atomic_load_n(&histograms[stage].total, __ATOMIC_RELAXED);
+    snapshot.max = __atomic_load_n(&histograms[stage].max, __ATOMIC_RELAXED);
+    for (bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+      snapshot.buckets[bucket] = __atomic_load_n(&histograms[stage].buckets[bucket], __ATOMIC_RELAXED);
+    }
+
+    if (output_format == STATS_CSV) {
+      fprintf(output, "%lu,%s,%.6f,%s,%s,%llu", snapshots, reason, elapsed, stage_names[stage],
+              stage == STAGE_QUEUE ? "frames" : "s", snapshot.count);
+    } else {
+      fprintf(output, "%s\"%s\":{\"unit\":\"%s\",\"count\":%llu", stage ? "," : "", stage_names[stage],
+              stage == STAGE_QUEUE ? "frames" : "s", snapshot.count);
+    }
+    if (snapshot.count == 0) {
+      fputs(output_format == STATS_CSV ? ",,,,,,,\n" : "}", output);
+      continue;
+    }
+    fprintf(output, output_format == STATS_CSV ? ",%.9g,%.9g,%.9g,%.9g,%.9g,%.9g," :
+            ",\"total\":%.9g,\"mean\":%.9g,\"max\":%.9g,\"p50\":%.9g,\"p90\":%.9g,\"p99\":%.9g,\"histogram\":[",
+            in_units(stage, (double)snapshot.total), in_units(stage, (double)snapshot.total / snapshot.count),
+            in_units(stage, (double)snapshot.max), in_units(stage, quantile(&snapshot, 0.5)),
+            in_units(stage, quantile(&snapshot, 0.9)), in_units(stage, quantile(&snapshot, 0.99)));
+    write_buckets(stage, &snapshot);
+    fputs(output_format == STATS_CSV ? "\n" : "]}", output);
+  }
+  if (output_format == STATS_JSON) {
+    fputs("}}\n", output);
+  }
+  fflush(output);
+  pthread_mutex_unlock(&dump_lock);
+}
+
+// Dumps on every SIGUSR1, for a look at a long run while it goes.
+static void* dump_on_signal(void* unused) {
+  int signal;
+
+  for (;;) {
+    if (sigwait(&dump_signals, &signal) == 0) {
+      stats_dump("signal");
+    }
+  }
+  return unused;
+}
+
+static void dump_at_exit() {
+  stats_dump("exit");
+}
+
+void stats_open(FILE* out, int format) {
+  pthread_t thread;
+
+  output = out;
+  output_format = format;
+  started = stats_now();
+  if (format == STATS_CSV) {
+    fputs("snapshot,reason,elapsed,stage,unit,count,total,mean,max,p50,p90,p99,histogram\n", output);
+  }
+  stats_enabled = 1;
+  atexit(dump_at_exit);
+
+  sigemptyset(&dump_signals);
+  sigaddset(&dump_signals, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &dump_signals, NULL);
+  if (pthread_create(&thread, NULL, dump_on_signal, NULL) == 0) {
+    pthread_detach(thread);
+  } else {
+    fprintf(stderr, "Warning: can't start the thread that dumps timing on SIGUSR1.\n");
+  }
+}
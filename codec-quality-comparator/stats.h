@@ -0,0 +1,49 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+// Per-stage timing for the comparators (--stats). Each stage keeps a histogram of how
+// long it took each time, in power-of-two buckets of nanoseconds, which is dumped when
+// the process exits and whenever it gets SIGUSR1. Recording is lock-free, so any thread
+// may record at any time.
+
+#define STAGE_HEADER   0             // Reading and checking a stream header
+#define STAGE_READ     1             // Reading (or decoding) one frame of one stream
+#define STAGE_CONVERT  2             // SSIM: converting a plane's pixels to floats
+#define STAGE_FILTER   3             // SSIM: a plane's window convolution
+#define STAGE_COMBINE  4             // SSIM: combining a plane's window statistics
+#define STAGE_PSNR     5             // PSNR of a plane
+#define STAGE_OUTPUT   6             // Writing a frame's results
+#define STAGE_IDLE     7             // A worker waiting for work
+#define STAGE_BLOCKED  8             // The reader waiting for a free slot
+#define STAGE_QUEUE    9             // Frames in flight when one is queued. A count, not a time.
+#define STAGE_COUNT    10
+
+#define STATS_JSON 0                 // One JSON object per dump, on a line of its own
+#define STATS_CSV  1                 // A header row, then a row per stage for each dump
+
+// Nonzero once stats_open() has been called.
+extern int stats_enabled;
+
+// Returns the STATS_* format called 'name' (json or csv), or -1.
+int stats_format(const char* name);
+
+// Starts collecting, to be dumped to 'out'. Must be called before any other thread is
+// started: SIGUSR1 is blocked in this thread, so the threads it starts inherit the mask
+// and only the dumping thread this starts receives it.
+void stats_open(FILE* out, int format);
+
+// CLOCK_MONOTONIC, in seconds.
+double stats_now();
+
+// Adds a time (in seconds) to a stage's histogram. Does nothing unless enabled.
+void stats_record(int stage, double seconds);
+
+// Adds a count to a stage's histogram (STAGE_QUEUE). Does nothing unless enabled.
+void stats_count(int stage, unsigned long count);
+
+// Writes the histograms as they are now. 'reason' is "signal" or "exit".
+void stats_dump(const char* reason);
+
+#endif
@@ -0,0 +1,39 @@
+#!/bin/sh
+# --align on low-structure content: the reference is noise around mid grey, so every frame's
+# fingerprint is close to every other's, and the degraded stream is a slightly noisier copy
+# with frame DROP missing. The pairing must settle on an offset of -1 once, right after the
+# drop, and stay there rather than wander off to other frames.
+
+FRAMES=12
+DROP=4
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+LC_ALL=C awk -v frames=$FRAMES -v drop=$DROP -v dir="$dir" 'BEGIN {
+  w = 176; h = 144; size = w * h * 3 / 2
+  srand(1)
+  header = "YUV4MPEG2 W" w " H" h " F25:1 Ip A1:1 C420jpeg\n"
+  printf "%s", header > (dir "/reference.y4m")
+  printf "%s", header > (dir "/degraded.y4m")
+  for (f = 0; f < frames; f++) {
+    printf "FRAME\n" > (dir "/reference.y4m")
+    if (f != drop) printf "FRAME\n" > (dir "/degraded.y4m")
+    for (i = 0; i < size; i++) {
+      v = 128 + int((rand() - 0.5) * 20)
+      printf "%c", v > (dir "/reference.y4m")
+      if (f != drop) printf "%c", v + int((rand() - 0.5) * 10) > (dir "/degraded.y4m")
+    }
+  }
+}'
+
+./compare_444p_psnr --align 3 "$dir/reference.y4m" "$dir/degraded.y4m" > "$dir/out.txt" || exit 1
+grep "^Alignment:" "$dir/out.txt" > "$dir/alignment.txt"
+
+if [ $(wc -l < "$dir/alignment.txt") -ne 1 ] ||
+   ! grep -Eq "paired with reference frame ($DROP|$((DROP + 1))) \(offset -1\)$" "$dir/alignment.txt"; then
+  echo "FAILED: expected a single change to offset -1 at reference frame $DROP or $((DROP + 1)), got:"
+  cat "$dir/alignment.txt"
+  exit 1
+fi
+echo "PASS: $(cat "$dir/alignment.txt")"
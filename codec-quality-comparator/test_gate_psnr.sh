@@ -0,0 +1,48 @@
+#!/bin/sh
+# A frame identical to the reference has an infinite PSNR. It must not carry the mean PSNR
+# gate: the first degraded frame here is lossless and the rest are as bad as they get, so
+# the gate has to fail, both when it can decide early (mapped input) and at the end (fifo).
+
+WIDTH=320
+HEIGHT=240
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+header="YUV4MPEG2 W$WIDTH H$HEIGHT F25:1 Ip A1:1 C444"
+frame_size=$((WIDTH * HEIGHT * 3))
+
+black() {
+  echo FRAME
+  head -c $frame_size /dev/zero
+}
+
+white() {
+  echo FRAME
+  head -c $frame_size /dev/zero | tr '\0' '\377'
+}
+
+{ echo "$header"; black; black; black; black; } > "$dir/reference.y4m"
+{ echo "$header"; black; white; white; white; } > "$dir/degraded.y4m"
+
+failures=0
+check() {
+  description=$1
+  shift
+  ./compare_444p_psnr --gate-mean 50 --gate-metric psnr "$@" > "$dir/out.txt"
+  status=$?
+  if [ $status -ne 3 ] || ! grep -q "^Gate: FAIL" "$dir/out.txt"; then
+    echo "FAILED: $description: exit status $status, expected 3 and a failed gate"
+    cat "$dir/out.txt"
+    failures=$((failures + 1))
+  else
+    echo "PASS: $description: $(grep "^Gate:" "$dir/out.txt")"
+  fi
+}
+
+check "mapped" "$dir/reference.y4m" "$dir/degraded.y4m"
+mkfifo "$dir/degraded.fifo" || exit 1
+cat "$dir/degraded.y4m" > "$dir/degraded.fifo" &
+check "fifo" "$dir/reference.y4m" "$dir/degraded.fifo"
+wait
+[ $failures -eq 0 ]
@@ -0,0 +1,57 @@
+#!/bin/sh
+# A failed quality gate must end the run at once, even while compare_444p_psnr is blocked
+# reading a fifo whose writer has stalled. The degraded stream's first frame is below the
+# floor and its writer then goes quiet for STALL seconds without closing the fifo; the run
+# has to exit with the gate's status well before that.
+
+STALL=20
+LIMIT=5
+WIDTH=320
+HEIGHT=240
+
+dir=$(mktemp -d) || exit 1
+writer=
+cleanup() {
+  [ -n "$writer" ] && kill "$writer" 2>/dev/null
+  rm -rf "$dir"
+}
+trap cleanup EXIT
+
+header="YUV4MPEG2 W$WIDTH H$HEIGHT F25:1 Ip A1:1 C444"
+frame_size=$((WIDTH * HEIGHT * 3))
+
+# A black reference, three frames long.
+{
+  echo "$header"
+  for i in 1 2 3; do
+    echo FRAME
+    head -c $frame_size /dev/zero
+  done
+} > "$dir/reference.y4m"
+
+# One white frame, then nothing. 'exec' leaves the sleep holding the fifo open.
+mkfifo "$dir/degraded.y4m" || exit 1
+(
+  echo "$header"
+  echo FRAME
+  head -c $frame_size /dev/zero | tr '\0' '\377'
+  exec sleep $STALL
+) > "$dir/degraded.y4m" &
+writer=$!
+
+timeout $LIMIT ./compare_444p_psnr --gate-floor 0.5 "$dir/reference.y4m" "$dir/degraded.y4m" > "$dir/out.txt"
+status=$?
+
+if [ $status -eq 124 ]; then
+  echo "FAILED: still running after $LIMIT s while the degraded fifo was stalled"
+  exit 1
+elif [ $status -ne 3 ]; then
+  echo "FAILED: exit status $status, expected 3 for a failed gate"
+  cat "$dir/out.txt"
+  exit 1
+elif ! grep -q "^Gate: FAIL - frame 0 " "$dir/out.txt"; then
+  echo "FAILED: the gate didn't fail on frame 0"
+  cat "$dir/out.txt"
+  exit 1
+fi
+echo "PASS: gate failure ended the stalled read"
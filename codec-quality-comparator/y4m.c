@@ -0,0 +1,376 @@
+#define _GNU_SOURCE
+#include "y4m.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef HAVE_LIBAV
+#include "av_input.h"
+#endif
+
+#define LINE_BUFFER_SIZE 256            // Longest stream header or FRAME line parsed
+
+// Chroma subsampling for each supported colour space, as shifts of the luma size.
+static const struct {
+  const char* tag;
+  int x_shift;
+  int y_shift;
+} chroma_formats[] = {
+  { "444",      0, 0 },
+  { "422",      1, 0 },
+  { "420",      1, 1 },
+  { "420jpeg",  1, 1 },
+  { "420mpeg2", 1, 1 },
+  { "420paldv", 1, 1 },
+};
+
+const char* y4m_parse_header(const char* line, struct y4m_format* format) {
+  const char* token;
+  const char* chroma = "420jpeg";    // The spec's default
+  size_t chroma_length = strlen(chroma);
+  size_t length, i;
+  int found = -1;
+
+  memset(format, 0, sizeof(*format));
+  if (strncmp(line, "YUV4MPEG2", 9) != 0 || (line[9] != ' ' && line[9] != '\n' && line[9] != '\0')) {
+    return "not YUV4MPEG formatted";
+  }
+
+  // Parameters are space separated, each starting with a one letter tag.
+  for (token = line + 9; *token; token += length) {
+    while (*token == ' ') token++;
+    length = strcspn(token, " \n");
+    if (length == 0) break;
+    switch (token[0]) {
+      case 'W': sscanf(token + 1, "%u", &format->width); break;
+      case 'H': sscanf(token + 1, "%u", &format->height); break;
+      case 'C': chroma = token + 1; chroma_length = length - 1; break;
+      case 'F':
+        if (sscanf(token + 1, "%u:%u", &format->fps_num, &format->fps_den) != 2 || format->fps_num == 0 || format->fps_den == 0) {
+          format->fps_num = format->fps_den = 0;
+        }
+        break;
+    }
+  }
+
+  if (format->width == 0) return "frame width missing";
+  if (format->height == 0) return "frame height missing";
+
+  for (i = 0; i < sizeof(chroma_formats) / sizeof(chroma_formats[0]); i++) {
+    if (strlen(chroma_formats[i].tag) == chroma_length && strncmp(chroma, chroma_formats[i].tag, chroma_length) == 0) {
+      found = (int)i;
+    }
+  }
+  if (found < 0 || chroma_length >= sizeof(format->chroma)) {
+    return "colour space must be 8-bit 4:4:4, 4:2:2 or 4:2:0";   // e.g. C444p10, Cmono, C411
+  }
+  memcpy(format->chroma, chroma, chroma_length);
+
+  format->plane_width[0] = format->width;
+  format->plane_height[0] = format->height;
+  for (i = 1; i < 3; i++) {
+    // Odd sizes round up: the last chroma sample covers the extra luma column/row.
+    format->plane_width[i] = (format->width + (1 << chroma_formats[found].x_shift) - 1) >> chroma_formats[found].x_shift;
+    format->plane_height[i] = (format->height + (1 << chroma_formats[found].y_shift) - 1) >> chroma_formats[found].y_shift;
+  }
+  for (i = 0; i < 3; i++) {
+    format->plane_offset[i] = format->frame_size;
+    format->frame_size += format->plane_width[i] * format->plane_height[i];
+  }
+  return NULL;
+}
+
+int y4m_same_layout(const struct y4m_format* a, const struct y4m_format* b) {
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    if (a->plane_width[i] != b->plane_width[i] || a->plane_height[i] != b->plane_height[i]) return 0;
+  }
+  return 1;
+}
+
+// An input that isn't mapped. stdio reads it through read_stream(), which waits for data
+// with poll() so a blocked read can be given up on.
+struct y4m_stream {
+  int fd;
+  int cancel_fd;                     // Give up once this is readable, or -1 (set_cancel)
+  int cancelled;
+};
+
+static ssize_t read_stream(void* cookie, char* buf, size_t size) {
+  struct y4m_stream* stream = cookie;
+  struct pollfd fds[2];
+
+  fds[0].fd = stream->fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = stream->cancel_fd;     // Ignored by poll() while it's -1
+  fds[1].events = POLLIN;
+  for (;;) {
+    fds[0].revents = fds[1].revents = 0;
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (fds[1].revents != 0) {
+      stream->cancelled = 1;
+      errno = ECANCELED;
+      return -1;
+    }
+    if (fds[0].revents != 0) return read(stream->fd, buf, size);
+  }
+}
+
+static int close_stream(void* cookie) {
+  struct y4m_stream* stream = cookie;
+  int result = close(stream->fd);
+
+  free(stream);
+  return result;
+}
+
+int y4m_open(struct y4m_input* input, const char* path) {
+  static const cookie_io_functions_t stream_functions = { read_stream, NULL, NULL, close_stream };
+  struct stat info;
+  void* map;
+  int fd, saved_errno;
+
+  memset(input, 0, sizeof(*input));
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return -1;
+
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+    map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      input->map = (unsigned char*)map;
+      input->map_size = (size_t)info.st_size;
+      input->file = fdopen(fd, "r");
+    }
+  }
+  if (input->map == NULL) {
+    input->stream = malloc(sizeof(struct y4m_stream));
+    if (input->stream != NULL) {
+      input->stream->fd = fd;
+      input->stream->cancel_fd = -1;
+      input->stream->cancelled = 0;
+      input->file = fopencookie(input->stream, "r", stream_functions);
+      if (input->file == NULL) free(input->stream);
+    }
+  }
+  if (input->file == NULL) {
+    saved_errno = errno;
+    if (input->map != NULL) munmap(input->map, input->map_size);
+    close(fd);
+    memset(input, 0, sizeof(*input));
+    errno = saved_errno;
+    return -1;
+  }
+  return 0;
+}
+
+void y4m_set_cancel(struct y4m_input* input, int cancel_fd) {
+  if (input->stream != NULL) input->stream->cancel_fd = cancel_fd;
+}
+
+// Records where each frame of a mapped file starts, touching only the FRAME lines.
+static const char* index_frames(struct y4m_input* input, size_t position) {
+  size_t capacity = 0;
+  size_t* offsets;
+  unsigned char* line_end;
+
+  input->end_status = Y4M_END;
+  while (position < input->map_size) {
+    if (input->map_size - position < 5 || memcmp(input->map + position, "FRAME", 5) != 0) {
+      input->end_status = Y4M_BAD_FRAME_HEADER;
+      break;
+    }
+    // FRAME lines may carry parameters; the data starts after the newline.
+    line_end = memchr(input->map + position, '\n', input->map_size - position);
+    if (line_end == NULL) break;   // A FRAME line with no data, like a truncated pipe.
+    position = (size_t)(line_end - input->map) + 1;
+    if (input->map_size - position < input->format.frame_size) {
+      if (input->map_size > position) input->end_status = Y4M_INCOMPLETE;
+      break;
+    }
+
+    if (input->frame_total == capacity) {
+      capacity = capacity ? 2 * capacity : 1024;
+      offsets = realloc(input->frame_offsets, capacity * sizeof(size_t));
+      if (offsets == NULL) return "out of memory indexing frames";
+      input->frame_offsets = offsets;
+    }
+    input->frame_offsets[input->frame_total++] = position;
+    position += input->format.frame_size;
+  }
+  return NULL;
+}
+
+const char* y4m_read_header(struct y4m_input* input) {
+  char buf[LINE_BUFFER_SIZE];
+  unsigned char* line_end;
+  size_t length;
+  const char* problem;
+
+  if (input->decoder != NULL) return NULL;   // av_input_open() already set the format
+
+  if (input->map != NULL) {
+    line_end = memchr(input->map, '\n', input->map_size);
+    if (line_end == NULL) return "no newline after header";
+    length = (size_t)(line_end - input->map) + 1;
+    memcpy(buf, input->map, length < sizeof(buf) ? length : sizeof(buf) - 1);
+    buf[length < sizeof(buf) ? length : sizeof(buf) - 1] = '\0';
+
+    problem = y4m_parse_header(buf, &input->format);
+    if (problem != NULL) return problem;
+
+    // Only FRAME lines are touched while indexing, so don't read ahead; afterwards the frames are read in order.
+    madvise(input->map, input->map_size, MADV_RANDOM);
+    problem = index_frames(input, length);
+    madvise(input->map, input->map_size, MADV_SEQUENTIAL);
+    return problem;
+  }
+
+  // Running on the assumption that a STREAM or FRAME header line is never more than LINE_BUFFER_SIZE long.
+  //   -- generally safe, especially with controlled streams, but not literally guaranteed.
+  if (fgets(buf, sizeof(buf), input->file) == NULL) return "no input";
+  problem = y4m_parse_header(buf, &input->format);
+  if (problem != NULL) return problem;
+
+  // Make sure we read the whole header before we go on.
+  while (!strchr(buf, '\n')) {
+    if (fgets(buf, sizeof(buf), input->file) == NULL) return "no newline after header";
+  }
+  return NULL;
+}
+
+int y4m_read_frame(struct y4m_input* input, unsigned char* buffer, unsigned char** frame) {
+  char buf[LINE_BUFFER_SIZE];
+  size_t bytes_read;
+
+#ifdef HAVE_LIBAV
+  if (input->decoder != NULL) {
+    int status = av_input_read_frame(input, buffer);
+    if (status != Y4M_FRAME) return status;
+    input->next_frame++;
+    *frame = buffer;
+    return Y4M_FRAME;
+  }
+#endif
+
+  if (input->map != NULL) {
+    if (input->next_frame >= input->frame_total) return input->end_status;
+    *frame = input->map + input->frame_offsets[input->next_frame++];
+    return Y4M_FRAME;
+  }
+
+  if (fgets(buf, sizeof(buf), input->file) != NULL) {
+    if (strncmp(buf, "FRAME", 5) != 0) {
+      return Y4M_BAD_FRAME_HEADER;
+    } else if (!strchr(buf, '\n')) {
+      return Y4M_LONG_FRAME_HEADER;
+    }
+  }
+
+  bytes_read = fread(buffer, 1, input->format.frame_size, input->file);
+  if (bytes_read < input->format.frame_size) {
+    if (input->stream != NULL && input->stream->cancelled) return Y4M_CANCELLED;
+    return bytes_read > 0 ? Y4M_INCOMPLETE : Y4M_END;
+  }
+  input->next_frame++;
+  *frame = buffer;
+  return Y4M_FRAME;
+}
+
+// Reports a broken stream the way the comparators' error_exit() does, and exits.
+static void stream_error(const char* format, ...) {
+  va_list args;
+
+  fprintf(stderr, "\nERROR: ");
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+int y4m_read_stream_frame(struct y4m_input* input, const char* stream_name, FILE* report,
+                          unsigned char* buffer, unsigned char** frame) {
+  double before = stats_now();
+  int status = y4m_read_frame(input, buffer, frame);
+
+  stats_record(STAGE_READ, stats_now() - before);
+  switch (status) {
+    case Y4M_FRAME:
+      return 1;
+    case Y4M_INCOMPLETE:
+      fprintf(report, "Warning: Final frame of %s was incomplete.\n", stream_name);
+      return 0;
+    case Y4M_BAD_FRAME_HEADER:
+      stream_error("Frame header not found in %s!", stream_name);
+    case Y4M_LONG_FRAME_HEADER:
+      stream_error("Frame header in %s too long - aborting!", stream_name);
+    case Y4M_DECODE_ERROR:
+      stream_error("Decoding %s failed - aborting!", stream_name);
+    case Y4M_CANCELLED:
+      return 0;
+  }
+  // All done.
+  return 0;
+}
+
+unsigned char* y4m_frame_buffer(const struct y4m_input* input, int first_touch) {
+  unsigned char* buffer;
+
+  if (input->map != NULL) return NULL;
+  buffer = malloc(input->format.frame_size);
+  if (buffer == NULL) {
+    stream_error("Out of memory allocating frame buffers!");
+  }
+  if (first_touch) {
+    memset(buffer, 0, input->format.frame_size);
+  }
+  return buffer;
+}
+
+unsigned long y4m_skip_frames(struct y4m_input* input, unsigned long count, unsigned char* scratch) {
+  char buf[LINE_BUFFER_SIZE];
+  unsigned long skipped;
+
+#ifdef HAVE_LIBAV
+  if (input->decoder != NULL) {
+    skipped = av_input_skip_frames(input, count);
+    input->next_frame += skipped;
+    return skipped;
+  }
+#endif
+
+  if (input->map != NULL) {
+    skipped = input->frame_total - input->next_frame;
+    if (skipped > count) skipped = count;
+    input->next_frame += skipped;
+    return skipped;
+  }
+
+  for (skipped = 0; skipped < count; skipped++) {
+    if (fgets(buf, sizeof(buf), input->file) == NULL || strncmp(buf, "FRAME", 5) != 0 || !strchr(buf, '\n')) break;
+    if (fread(scratch, 1, input->format.frame_size, input->file) < input->format.frame_size) break;
+    input->next_frame++;
+  }
+  return skipped;
+}
+
+void y4m_close(struct y4m_input* input) {
+#ifdef HAVE_LIBAV
+  if (input->decoder != NULL) av_input_close(input);
+#endif
+  if (input->map != NULL) munmap(input->map, input->map_size);
+  if (input->file != NULL) fclose(input->file);
+  free(input->frame_offsets);
+  memset(input, 0, sizeof(*input));
+}
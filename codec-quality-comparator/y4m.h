@@ -0,0 +1,96 @@
+#ifndef Y4M_H
+#define Y4M_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// YUV4MPEG2 stream parsing and reading shared by the comparators.
+
+// Frame layout of an 8-bit planar Y4M stream. Each plane is stored at its own
+// resolution, one after the other (Y, Cb, Cr), with no padding.
+struct y4m_format {
+  unsigned int width;                // Luma size
+  unsigned int height;
+  char chroma[16];                   // Colour space tag without the 'C', e.g. "420jpeg"
+  unsigned int plane_width[3];
+  unsigned int plane_height[3];
+  unsigned int plane_offset[3];      // Byte offset of each plane within a frame
+  unsigned int frame_size;           // Bytes per frame, excluding the FRAME line
+  unsigned int fps_num;              // Frame rate from the F tag, or 0/0 if there isn't one
+  unsigned int fps_den;
+};
+
+// Parses a "YUV4MPEG2 ..." stream header line into 'format'. Accepts 8-bit 4:4:4,
+// 4:2:2 and all the 4:2:0 sitings (jpeg, mpeg2, paldv). A missing C tag means
+// 4:2:0, as in the spec. Returns NULL on success, or a description of the problem.
+const char* y4m_parse_header(const char* line, struct y4m_format* format);
+
+// Returns 1 if two streams have the same frame layout.
+int y4m_same_layout(const struct y4m_format* a, const struct y4m_format* b);
+
+// An input stream. Regular files are memory mapped and their frames indexed when the
+// header is read, so frames are used in place with no copy and the page cache does the
+// I/O. Anything else (fifos, pipes) is read with stdio into the caller's buffers, waiting
+// for data with poll() so that y4m_set_cancel() can interrupt it.
+// Inputs opened with av_input_open() are decoded into the caller's buffers instead.
+struct y4m_input {
+  struct y4m_format format;          // Set by y4m_read_header()
+  FILE* file;
+  unsigned char* map;                // Whole file when mapped, otherwise NULL
+  size_t map_size;
+  size_t* frame_offsets;             // Mapped: where each complete frame's data starts
+  unsigned long frame_total;         // Mapped: number of complete frames
+  int end_status;                    // Mapped: what y4m_read_frame() returns after the last frame
+  unsigned long next_frame;          // Next frame y4m_read_frame() returns
+  struct av_decoder* decoder;        // Decoded in-process (av_input.h), otherwise NULL
+  struct y4m_stream* stream;         // Not mapped: the descriptor 'file' reads through
+};
+
+// y4m_read_frame() results
+#define Y4M_FRAME                1   // A frame was read
+#define Y4M_END                  0   // No more frames
+#define Y4M_INCOMPLETE          -1   // The stream ended part way through a frame
+#define Y4M_BAD_FRAME_HEADER    -2   // Frame data wasn't preceded by a FRAME line
+#define Y4M_LONG_FRAME_HEADER   -3   // FRAME line too long (stdio only)
+#define Y4M_DECODE_ERROR        -4   // The decoder failed, or the frame size or format changed (decoded only)
+#define Y4M_CANCELLED           -5   // Given up because the cancel descriptor became readable (stdio only)
+
+// Opens 'path' for reading. Returns 0 on success, or -1 with errno set.
+int y4m_open(struct y4m_input* input, const char* path);
+
+// Makes reads of a fifo or pipe give up, returning Y4M_CANCELLED, as soon as 'cancel_fd'
+// becomes readable, even if they are blocked waiting for data. Meant for the read end of
+// a pipe that another thread writes to once the rest of the input isn't wanted. Doesn't
+// affect mapped or decoded inputs, which never wait on the stream.
+void y4m_set_cancel(struct y4m_input* input, int cancel_fd);
+
+// Reads and parses the stream header, and indexes the frames of a mapped file.
+// Returns NULL on success, or a description of the problem.
+const char* y4m_read_header(struct y4m_input* input);
+
+// Reads the next frame. On Y4M_FRAME, '*frame' points at its data: in place in the
+// mapping, or in 'buffer' (format.frame_size bytes), which isn't touched when mapped.
+int y4m_read_frame(struct y4m_input* input, unsigned char* buffer, unsigned char** frame);
+
+// y4m_read_frame() for the comparators, timed as STAGE_READ (stats.h). Returns 1 if
+// there was a frame and 0 at the end or when cancelled, with a warning on 'report' if the
+// last frame was cut short. Any other problem with the stream is reported on stderr and
+// exits.
+int y4m_read_stream_frame(struct y4m_input* input, const char* stream_name, FILE* report,
+                          unsigned char* buffer, unsigned char** frame);
+
+// Allocates a buffer for a frame of the input, or returns NULL if the input is mapped and
+// its frames are used in place. 'first_touch' zeroes it, so the pages are placed right
+// away by the thread that will use them. Exits if out of memory.
+unsigned char* y4m_frame_buffer(const struct y4m_input* input, int first_touch);
+
+// Skips up to 'count' frames without returning their data. Mapped inputs jump straight
+// there through the index; fifos and pipes can't seek, so each frame is read into
+// 'scratch' (format.frame_size bytes) and dropped. Returns the number of frames skipped,
+// less than 'count' at the end of the stream.
+unsigned long y4m_skip_frames(struct y4m_input* input, unsigned long count, unsigned char* scratch);
+
+// Unmaps and closes the input.
+void y4m_close(struct y4m_input* input);
+
+#endif